@@ -0,0 +1,358 @@
+#ifndef INTRUSIVE_RB_TREE_H_
+#define INTRUSIVE_RB_TREE_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <type_traits>
+#include <utility>
+
+#include "include/rb-tree.h"
+#include "include/rb-tree-stats.h"
+
+/*
+    Type-safe wrapper of the intrusive rb-tree.
+
+    T        the entry type, which embeds an RbNode.
+    Member   pointer to that RbNode, e.g. &MyData::rb_node.
+    KeyOf    functor returning the key of a `const T&`.
+    Compare  strict weak ordering of keys. If it has `is_transparent` (e.g. std::less<>),
+             find/lower_bound/upper_bound also accept any type comparable with the key.
+
+    The descent loops are generated for each instantiation, so comparisons are inlined
+    instead of going through a function pointer. The tree never allocates, copies or moves
+    the entries, so T may be move-only or even immovable. Equal keys are kept in insertion order.
+
+    Example:
+        struct MyDataValue { int operator()(const MyData& data) const { return data.value; } };
+        IntrusiveRbTree<MyData, &MyData::rb_node, MyDataValue> tree;
+        tree.insert(NewMyData(42));
+        for (MyData& data : tree) { ... }
+*/
+template <typename T, RbNode T::*Member, typename KeyOf, typename Compare = std::less<>>
+class IntrusiveRbTree {
+public:
+    using value_type = T;
+    using key_type = typename std::decay<decltype(std::declval<KeyOf>()(std::declval<const T&>()))>::type;
+    using key_compare = Compare;
+
+    class iterator {
+    public:
+        using iterator_category = std::bidirectional_iterator_tag;
+        using value_type = T;
+        using difference_type = std::ptrdiff_t;
+        using pointer = T*;
+        using reference = T&;
+
+        iterator() : node_(nullptr), root_(nullptr) {}
+
+        reference operator*() const { return *ToItem(node_); }
+        pointer operator->() const { return ToItem(node_); }
+
+        iterator& operator++() {
+            node_ = NextRbNode(node_);
+            return *this;
+        }
+        iterator operator++(int) {
+            iterator old = *this;
+            ++*this;
+            return old;
+        }
+        // Decrementing end() gives the last entry.
+        iterator& operator--() {
+            node_ = node_ ? PrevRbNode(node_) : LastRbNode(root_);
+            return *this;
+        }
+        iterator operator--(int) {
+            iterator old = *this;
+            --*this;
+            return old;
+        }
+
+        bool operator==(const iterator& other) const { return node_ == other.node_; }
+        bool operator!=(const iterator& other) const { return node_ != other.node_; }
+
+    private:
+        friend class IntrusiveRbTree;
+        iterator(RbNode* node, const RbRoot* root) : node_(node), root_(root) {}
+
+        RbNode* node_;
+        const RbRoot* root_;
+    };
+
+    IntrusiveRbTree() : root_(), size_(0), key_of_(), compare_() {}
+    explicit IntrusiveRbTree(const Compare& compare, const KeyOf& key_of = KeyOf())
+        : root_(), size_(0), key_of_(key_of), compare_(compare) {}
+
+    // The nodes don't point back to RbRoot, so moving the root is enough.
+    IntrusiveRbTree(IntrusiveRbTree&& other) noexcept
+        : root_(other.root_), size_(other.size_), key_of_(std::move(other.key_of_)),
+          compare_(std::move(other.compare_)) {
+        other.root_.rb_node = nullptr;
+        other.size_ = 0;
+    }
+    IntrusiveRbTree& operator=(IntrusiveRbTree&& other) noexcept {
+        if (this != &other) {
+            root_ = other.root_;
+            size_ = other.size_;
+            key_of_ = std::move(other.key_of_);
+            compare_ = std::move(other.compare_);
+            other.root_.rb_node = nullptr;
+            other.size_ = 0;
+        }
+        return *this;
+    }
+    IntrusiveRbTree(const IntrusiveRbTree&) = delete;
+    IntrusiveRbTree& operator=(const IntrusiveRbTree&) = delete;
+
+    bool empty() const { return root_.rb_node == nullptr; }
+    size_t size() const { return size_; }
+
+    iterator begin() const { return iterator(FirstRbNode(&root_), &root_); }
+    iterator end() const { return iterator(nullptr, &root_); }
+    iterator iterator_to(T& item) const { return iterator(&(item.*Member), &root_); }
+
+    T* front() const { return ToItem(FirstRbNode(&root_)); }
+    T* back() const { return ToItem(LastRbNode(&root_)); }
+
+    // Links `item` after all entries with an equal key.
+    iterator insert(T* item) { return InsertBelow(item, nullptr, &root_.rb_node); }
+
+    // Same as insert(item), but searches from `hint`, an entry close to where `item` belongs
+    // (e.g. the previously inserted one). On the way up, only the ancestors on the side `item`
+    // goes to are compared, so inserting next to `hint` costs O(1) comparisons.
+    // The walk stops at the first of them that bounds `key`, but after back() there is none,
+    // so a monotone stream still climbs O(log n) links per insert.
+    // end() means searching from the root.
+    iterator insert(iterator hint, T* item) {
+        RbNode* finger = hint.node_;
+        if (finger == nullptr) {
+            return insert(item);
+        }
+        const auto& key = key_of_(*item);
+        bool go_right = !compare_(key, key_of_(*ToItem(finger)));
+        RbNode* parent = nullptr;
+        for (RbNode* node = finger; (parent = GetParent(node)) != nullptr; node = parent) {
+            if (node != (go_right ? parent->left : parent->right)) {
+                continue;
+            }
+            // `parent` bounds the subtree of `finger` on the side of `key`.
+            bool key_less = compare_(key, key_of_(*ToItem(parent)));
+            if (go_right ? key_less : !key_less) {
+                break;
+            }
+            finger = parent;
+        }
+        return InsertBelow(item, finger, go_right ? &finger->right : &finger->left);
+    }
+
+    // Links `item` only if no entry has an equivalent key, in a single descent.
+    // Returns the iterator to that entry or to `item`, and whether `item` was linked.
+    std::pair<iterator, bool> insert_unique(T* item) {
+        RbNode* parent = nullptr;
+        RbNode** link = nullptr;
+        RbNode* existing = FindUniqueLink(key_of_(*item), &parent, &link);
+        if (existing != nullptr) {
+            return std::make_pair(iterator(existing, &root_), false);
+        }
+        InsertIntoRbTree(&(item->*Member), parent, link, &root_);
+        ++size_;
+        return std::make_pair(iterator(&(item->*Member), &root_), true);
+    }
+
+    // Returns the entry with `key`, or links `make()` (which must return a T* with that key)
+    // at the place the lookup ended, without descending again.
+    template <typename Factory>
+    std::pair<iterator, bool> find_or_insert(const key_type& key, Factory&& make) {
+        RbNode* parent = nullptr;
+        RbNode** link = nullptr;
+        RbNode* existing = FindUniqueLink(key, &parent, &link);
+        if (existing != nullptr) {
+            return std::make_pair(iterator(existing, &root_), false);
+        }
+        T* item = make();
+        InsertIntoRbTree(&(item->*Member), parent, link, &root_);
+        ++size_;
+        return std::make_pair(iterator(&(item->*Member), &root_), true);
+    }
+
+    // Unlinks `item`, and returns the iterator to the entry after it. `item` isn't destroyed.
+    iterator erase(T* item) {
+        RbNode* node = &(item->*Member);
+        RbNode* next = NextRbNode(node);
+        RemoveFromRbTree(node, &root_);
+        --size_;
+        return iterator(next, &root_);
+    }
+    iterator erase(iterator it) { return erase(&*it); }
+
+    // Puts `item` in the place of `victim` in O(1). Both must have equivalent keys.
+    void replace_node(T* victim, T* item) {
+        ReplaceRbNode(&(victim->*Member), &(item->*Member), &root_);
+    }
+
+    // Call after changing the key of `item` in place. It's only moved if the new key
+    // breaks the order with its neighbors, and the iterator to it is returned.
+    iterator update_position(T* item) {
+        RbNode* node = &(item->*Member);
+        RbNode* prev = PrevRbNode(node);
+        RbNode* next = NextRbNode(node);
+        const auto& key = key_of_(*item);
+        if ((prev == nullptr || !compare_(key, key_of_(*ToItem(prev)))) &&
+            (next == nullptr || !compare_(key_of_(*ToItem(next)), key))) {
+            return iterator(node, &root_);
+        }
+        erase(item);
+        return insert(item);
+    }
+
+    // Forgets all entries without touching them, e.g. after their NodePool is destroyed.
+    void clear() {
+        root_.rb_node = nullptr;
+        size_ = 0;
+    }
+
+    // Unlinks all entries and calls `dispose(T*)` on each, children before parents, in O(n)
+    // without rebalancing. `dispose` may free the entry or move it into another tree.
+    template <typename Disposer>
+    void clear_and_dispose(Disposer&& dispose) {
+        RbNode* node = nullptr;
+        RbNode* next = nullptr;
+        RbPostorderForEachSafe(node, next, &root_) {
+            dispose(ToItem(node));
+        }
+        clear();
+    }
+
+    template <typename K, typename C = Compare, typename = typename C::is_transparent>
+    iterator find(const K& key) const { return iterator(FindImpl(key), &root_); }
+    iterator find(const key_type& key) const { return iterator(FindImpl(key), &root_); }
+
+    template <typename K, typename C = Compare, typename = typename C::is_transparent>
+    iterator lower_bound(const K& key) const { return LowerBoundImpl(key); }
+    iterator lower_bound(const key_type& key) const { return LowerBoundImpl(key); }
+
+    template <typename K, typename C = Compare, typename = typename C::is_transparent>
+    iterator upper_bound(const K& key) const { return UpperBoundImpl(key); }
+    iterator upper_bound(const key_type& key) const { return UpperBoundImpl(key); }
+
+    template <typename K, typename C = Compare, typename = typename C::is_transparent>
+    bool contains(const K& key) const { return FindImpl(key) != nullptr; }
+    bool contains(const key_type& key) const { return FindImpl(key) != nullptr; }
+
+    // The underlying root, for the C functions in rb-tree.h.
+    // Don't insert or remove through it, or size() will be wrong.
+    RbRoot* root() { return &root_; }
+    const RbRoot* root() const { return &root_; }
+
+private:
+    static std::size_t MemberOffset() {
+        // Same as OffsetOf, but with a member pointer.
+        return reinterpret_cast<std::size_t>(&(reinterpret_cast<T*>(0)->*Member));
+    }
+
+    static T* ToItem(RbNode* node) {
+        return node ? reinterpret_cast<T*>(reinterpret_cast<char*>(node) - MemberOffset()) : nullptr;
+    }
+
+    template <typename K>
+    RbNode* FindImpl(const K& key) const {
+        RbNode* node = root_.rb_node;
+        int depth = 0;
+        while (node) {
+            const auto& node_key = key_of_(*ToItem(node));
+            ++depth;
+            if (compare_(key, node_key)) {
+                node = node->left;
+            } else if (compare_(node_key, key)) {
+                node = node->right;
+            } else {
+                RbStatsSearchDepth(depth);
+                return node;
+            }
+        }
+        RbStatsSearchDepth(depth);
+        return nullptr;
+    }
+
+    // Descends from `link`, whose node's parent is `parent`, and links `item` at the bottom.
+    iterator InsertBelow(T* item, RbNode* parent, RbNode** link) {
+        const auto& key = key_of_(*item);
+        int depth = 0;
+        while (*link) {
+            parent = *link;
+            ++depth;
+            if (compare_(key, key_of_(*ToItem(parent)))) {
+                link = &parent->left;
+            } else {
+                link = &parent->right;
+            }
+        }
+        RbStatsSearchDepth(depth);
+        InsertIntoRbTree(&(item->*Member), parent, link, &root_);
+        ++size_;
+        return iterator(&(item->*Member), &root_);
+    }
+
+    // Like FindImpl, but also returns the link where `key` should be inserted if it's missing.
+    RbNode* FindUniqueLink(const key_type& key, RbNode** parent_ptr, RbNode*** link_ptr) {
+        RbNode* parent = nullptr;
+        RbNode** link = &root_.rb_node;
+        int depth = 0;
+        while (*link) {
+            parent = *link;
+            ++depth;
+            const auto& node_key = key_of_(*ToItem(parent));
+            if (compare_(key, node_key)) {
+                link = &parent->left;
+            } else if (compare_(node_key, key)) {
+                link = &parent->right;
+            } else {
+                RbStatsSearchDepth(depth);
+                return parent;
+            }
+        }
+        RbStatsSearchDepth(depth);
+        *parent_ptr = parent;
+        *link_ptr = link;
+        return nullptr;
+    }
+
+    template <typename K>
+    iterator LowerBoundImpl(const K& key) const {
+        RbNode* node = root_.rb_node;
+        RbNode* result = nullptr;
+        while (node) {
+            if (compare_(key_of_(*ToItem(node)), key)) {
+                node = node->right;
+            } else {
+                result = node;
+                node = node->left;
+            }
+        }
+        return iterator(result, &root_);
+    }
+
+    template <typename K>
+    iterator UpperBoundImpl(const K& key) const {
+        RbNode* node = root_.rb_node;
+        RbNode* result = nullptr;
+        while (node) {
+            if (compare_(key, key_of_(*ToItem(node)))) {
+                result = node;
+                node = node->left;
+            } else {
+                node = node->right;
+            }
+        }
+        return iterator(result, &root_);
+    }
+
+    RbRoot root_;
+    size_t size_;
+    KeyOf key_of_;
+    Compare compare_;
+};
+
+#endif  // INTRUSIVE_RB_TREE_H_
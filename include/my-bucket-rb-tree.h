@@ -0,0 +1,127 @@
+#ifndef MY_BUCKET_RB_TREE_H_
+#define MY_BUCKET_RB_TREE_H_
+
+#include <stdint.h>
+
+#include "include/rb-tree.h"
+#include "include/node-pool.h"
+
+/*
+    Build with MY_BUCKET_SIMD=0 to search the buckets with plain scalar code.
+    Otherwise they are searched with AVX2 if the compiler targets it (/arch:AVX2 or -mavx2),
+    else with SSE2 on x86/x64, else with scalar code anyway.
+*/
+#ifndef MY_BUCKET_SIMD
+#define MY_BUCKET_SIMD 1
+#endif
+
+// Keys per bucket, one cache line of int32_t.
+constexpr int kMyBucketCapacity = 16;
+
+/*
+    A node of MyBucketRbTree, which holds up to kMyBucketCapacity sorted keys.
+    The links and `lower` share the first cache line, so a descent never touches the keys,
+    and the keys fill the second one:
+        | rb_node | lower | count | ... | keys[0] ... keys[15] |
+        0                             64                      128
+*/
+struct MyBucket {
+    RbNode rb_node;
+    // Same as keys[0]. The buckets are ordered by it.
+    int32_t lower;
+    int32_t count;
+    // Sorted, and the unused slots are INT32_MAX, so a search can compare all the slots at once.
+    alignas(64) int32_t keys[kMyBucketCapacity];
+};
+
+// Returns how many keys of `bucket` are less than `value`, i.e. where `value` is or would be.
+int MyLowerBoundInBucket(const MyBucket* bucket, int value);
+
+/*
+    Set of int values like an rb-tree of MyData, but each rb-tree node holds a bucket of up to
+    kMyBucketCapacity sorted values instead of one, so there are several times fewer nodes,
+    a descent is several levels shorter, and a scan reads whole cache lines of values.
+
+    The buckets hold disjoint ranges, ordered by their lowest value, and rb-tree.c balances them
+    as usual. A full bucket splits in two halves. A bucket drained to a quarter merges into
+    a neighbor, if both fit in three quarters of a bucket, which leaves room before the next split.
+    Buckets are allocated from a NodePool of the tree's own, so teardown costs O(1).
+
+    Values are moved around inside and between the buckets, so no pointer to them is handed out.
+*/
+class MyBucketRbTree {
+public:
+    MyBucketRbTree();
+    ~MyBucketRbTree();
+
+    MyBucketRbTree(const MyBucketRbTree&) = delete;
+    MyBucketRbTree& operator=(const MyBucketRbTree&) = delete;
+
+    // Returns false if `value` is already there.
+    bool Insert(int value);
+
+    // Returns false if `value` isn't there.
+    bool Remove(int value);
+
+    bool Contains(int value) const;
+
+    // Calls `visit(int value)` on every value in [lo, hi) in ascending order,
+    // and returns the number of visited values.
+    template <typename Visitor>
+    size_t VisitRange(int lo, int hi, Visitor&& visit) const {
+        size_t count = 0;
+        const MyBucket* bucket = FindBucket(lo);
+        int index = bucket != nullptr ? MyLowerBoundInBucket(bucket, lo) : 0;
+        for (; bucket != nullptr; bucket = NextBucket(bucket), index = 0) {
+            for (; index < bucket->count; ++index) {
+                if (bucket->keys[index] >= hi) {
+                    return count;
+                }
+                visit(static_cast<int>(bucket->keys[index]));
+                ++count;
+            }
+        }
+        return count;
+    }
+
+    size_t GetSize() const { return size_; }
+
+    size_t GetBucketNum() const { return bucket_num_; }
+
+    // Bytes taken by the buckets.
+    size_t GetMemoryUsage() const { return bucket_num_ * GetNodePoolSlotSize(pool_); }
+
+    // Returns false if the buckets aren't a legal rb-tree, or their keys are out of order.
+    bool Check() const;
+
+private:
+    static MyBucket* ToBucket(const RbNode* node) {
+        return node != nullptr ? ContainerOf(node, struct MyBucket, rb_node) : nullptr;
+    }
+
+    static MyBucket* NextBucket(const MyBucket* bucket) { return ToBucket(NextRbNode(&bucket->rb_node)); }
+
+    static MyBucket* PrevBucket(const MyBucket* bucket) { return ToBucket(PrevRbNode(&bucket->rb_node)); }
+
+    // Returns the last bucket whose lower value is not greater than `value`,
+    // or the first bucket if there is none (nullptr if the tree is empty).
+    MyBucket* FindBucket(int value) const;
+
+    // Allocates an empty bucket, and links it right after `prev` (or as the only one if nullptr).
+    MyBucket* NewBucketAfter(MyBucket* prev);
+
+    void DeleteBucket(MyBucket* bucket);
+
+    // Moves the upper half of the full `bucket` into a new one right after it, and returns the new one.
+    MyBucket* SplitBucket(MyBucket* bucket);
+
+    // Merges the drained `bucket` with a neighbor if they fit, or drops it if empty.
+    void MaybeMergeBucket(MyBucket* bucket);
+
+    RbRoot root_;
+    NodePool* pool_;
+    size_t size_;
+    size_t bucket_num_;
+};
+
+#endif  // MY_BUCKET_RB_TREE_H_
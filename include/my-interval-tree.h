@@ -0,0 +1,47 @@
+#ifndef MY_INTERVAL_TREE_H_
+#define MY_INTERVAL_TREE_H_
+
+#include <stdint.h>
+
+#include "include/rb-tree.h"
+
+/*
+    Interval tree over half-open intervals [start, end), ordered by `start`.
+    Every node also records the max `end` in its subtree,
+    so overlap queries can skip whole subtrees and cost O(log n + k).
+*/
+struct MyInterval {
+    int64_t start;
+    int64_t end;
+    int64_t subtree_max_end;
+    struct RbNode rb_node;
+};
+
+/* Basic operations for interval tree */
+void MyInsertIntoIntervalTree(MyInterval* interval, RbRoot* root);
+
+// Unlinks `interval` from the tree. It isn't freed.
+void MyRemoveFromIntervalTree(MyInterval* interval, RbRoot* root);
+
+/* Overlap queries for interval tree */
+// Returns the first interval (ordered by start) which overlaps [lo, hi), or nullptr.
+MyInterval* MyFirstOverlapInIntervalTree(int64_t lo, int64_t hi, RbRoot* root);
+
+// Returns the next interval after `interval` which overlaps [lo, hi), or nullptr.
+MyInterval* MyNextOverlapInIntervalTree(MyInterval* interval, int64_t lo, int64_t hi);
+
+// Calls `visit(MyInterval*)` on every interval which overlaps [lo, hi),
+// and returns the number of visited intervals.
+template <typename Visitor>
+size_t MyVisitOverlapsInIntervalTree(int64_t lo, int64_t hi, RbRoot* root, Visitor&& visit) {
+    size_t count = 0;
+    for (MyInterval* interval = MyFirstOverlapInIntervalTree(lo, hi, root);
+         interval != nullptr;
+         interval = MyNextOverlapInIntervalTree(interval, lo, hi)) {
+        visit(interval);
+        ++count;
+    }
+    return count;
+}
+
+#endif  // MY_INTERVAL_TREE_H_
@@ -0,0 +1,125 @@
+#ifndef MY_RB_TREE_SNAPSHOT_H_
+#define MY_RB_TREE_SNAPSHOT_H_
+
+#include <stdint.h>
+
+#include "include/my-rb-tree.h"
+
+/*
+    Snapshot file of a MyData rb-tree, which can be mapped into memory and searched in place.
+
+    The file is a header followed by one record per node in pre-order, so the root comes first
+    and the top levels of the tree share the first pages. Children always come after their parent,
+    so a record links to them by how many records later they are, and 0 means no child.
+    The links don't depend on where the file is mapped, and can't form a cycle.
+    The color is kept too, so the tree can be loaded back with the same shape without any rotation.
+
+    Files are written in the byte order of the host, and a file of the other byte order is rejected.
+*/
+struct MySnapshotHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t node_size;
+    uint64_t node_num;
+    uint64_t reserved;
+};
+
+struct MySnapshotNode {
+    // Distances to the records of the children, or 0.
+    uint32_t left;
+    uint32_t right;
+    int32_t value;
+    // kBlack or kRed.
+    uint32_t color;
+};
+
+// Writes `root` into the file at `path`, and returns whether it succeeded.
+// The tree may have at most UINT32_MAX nodes.
+bool MyWriteRbTreeSnapshot(const RbRoot* root, const char* path);
+
+/*
+    Read-only view of a snapshot file, mapped with mmap or CreateFileMapping.
+    Opening costs O(1), and every lookup only faults in the pages on its path.
+    The links are checked on the way, so a corrupted file can't send a lookup out of the mapping.
+*/
+class MyRbTreeSnapshot {
+public:
+    MyRbTreeSnapshot() = default;
+    ~MyRbTreeSnapshot() { Close(); }
+
+    MyRbTreeSnapshot(const MyRbTreeSnapshot&) = delete;
+    MyRbTreeSnapshot& operator=(const MyRbTreeSnapshot&) = delete;
+
+    // Maps the file at `path`, and returns false if it can't be mapped or isn't a snapshot.
+    bool Open(const char* path);
+
+    void Close();
+
+    bool IsOpen() const { return mapping_ != nullptr; }
+
+    size_t GetSize() const { return static_cast<size_t>(node_num_); }
+
+    bool Contains(int value) const;
+
+    // Calls `visit(int value)` on every value in [lo, hi) in ascending order,
+    // and returns the number of visited values.
+    template <typename Visitor>
+    size_t VisitRange(int lo, int hi, Visitor&& visit) const {
+        // Pending nodes whose value is in range, the innermost one on top.
+        const MySnapshotNode* stack[kMaxDepth];
+        int top = 0;
+        size_t count = 0;
+        for (const MySnapshotNode* node = Root(); node != nullptr && top < kMaxDepth; ) {
+            if (node->value >= lo) {
+                stack[top++] = node;
+                node = LeftOf(node);
+            } else {
+                node = RightOf(node);
+            }
+        }
+        while (top > 0) {
+            const MySnapshotNode* node = stack[--top];
+            if (node->value >= hi) {
+                break;
+            }
+            visit(static_cast<int>(node->value));
+            ++count;
+            for (node = RightOf(node); node != nullptr && top < kMaxDepth; node = LeftOf(node)) {
+                stack[top++] = node;
+            }
+        }
+        return count;
+    }
+
+    // Rebuilds the tree into the empty `root` with NewMyData in O(n), with the same shape and colors,
+    // so no rotation is needed. Returns false (and leaves `root` empty) if the records don't form
+    // a legal rb-tree, which is checked on the way.
+    bool LoadInto(RbRoot* root) const;
+
+private:
+    // A legal rb-tree of at most UINT32_MAX nodes is never deeper than this.
+    // Deeper paths in a corrupted file are cut off here.
+    static constexpr int kMaxDepth = 64;
+
+    const MySnapshotNode* Root() const { return node_num_ > 0 ? nodes_ : nullptr; }
+
+    const MySnapshotNode* LeftOf(const MySnapshotNode* node) const { return ChildOf(node, node->left); }
+
+    const MySnapshotNode* RightOf(const MySnapshotNode* node) const { return ChildOf(node, node->right); }
+
+    const MySnapshotNode* ChildOf(const MySnapshotNode* node, uint32_t distance) const {
+        uint64_t index = static_cast<uint64_t>(node - nodes_) + distance;
+        return distance != 0 && index < node_num_ ? nodes_ + index : nullptr;
+    }
+
+    void* mapping_ = nullptr;
+    size_t mapping_size_ = 0;
+#if defined(_WIN32)
+    void* file_handle_ = nullptr;
+    void* mapping_handle_ = nullptr;
+#endif
+    const MySnapshotNode* nodes_ = nullptr;
+    uint64_t node_num_ = 0;
+};
+
+#endif  // MY_RB_TREE_SNAPSHOT_H_
@@ -4,19 +4,152 @@
 #include <vector>
 
 #include "include/rb-tree.h"
+#include "include/rb-order-tree.h"
+
+class WorkStealingPool;
 
 struct MyData {
     int value;
     struct RbNode rb_node;
 };
 
+// MyData which also supports rank and select, see rb-order-tree.h.
+struct MyRankedData {
+    int value;
+    struct RbSizedNode rb_node;
+};
+
+/* Allocation of MyData, backed by a shared NodePool */
+// Never returns nullptr, it aborts if out of memory.
+MyData* NewMyData(int value);
+
+void DeleteMyData(MyData* data);
+
+// Releases every MyData from NewMyData at once, without walking any tree.
+// Trees holding them must be reset to InitializedRbRoot afterwards,
+// and no other thread may use MyData meanwhile.
+void DeleteAllMyData();
+
+// Bytes taken from the system for MyData, see GetNodePoolFootprint.
+size_t GetMyDataFootprint();
+
 /* Basic operations for rb-tree */
 void MyInsertIntoRbTree(MyData* new_data, RbRoot* root);
 
+// Same as MyInsertIntoRbTree, but searches from `hint`, a node close to where `new_data` belongs
+// (e.g. the previously inserted one), instead of the root. A nullptr `hint` means the root.
+// It takes O(1) comparisons, but after the maximum it still climbs to the root, so use
+// MyAppendToRbTreeCached for a monotone stream.
+void MyInsertIntoRbTreeWithHint(MyData* new_data, MyData* hint, RbRoot* root);
+
+// Links `new_data` only if no node has the same value, in a single descent.
+// Returns that existing node, or nullptr if `new_data` was linked.
+MyData* MyInsertUniqueIntoRbTree(MyData* new_data, RbRoot* root);
+
+// Returns the node with `value`, or links a new one from NewMyData at the place the lookup
+// ended, without descending again. `inserted` (if not nullptr) tells which one happened.
+MyData* MyFindOrInsertInRbTree(int value, RbRoot* root, bool* inserted = nullptr);
+
+// Unlinks `data` and frees it with DeleteMyData.
 void MyRemoveFromRbTree(MyData* data, RbRoot* root);
 
+// Puts `new_data` in the place of `victim` in O(1). Both must have the same value.
+// `victim` is unlinked but not freed.
+void MyReplaceInRbTree(MyData* victim, MyData* new_data, RbRoot* root);
+
+// Sets the value of `data`, and moves it only if the new value breaks the order
+// with its predecessor or successor. Returns whether it was moved.
+bool MyUpdateValueInRbTree(MyData* data, int value, RbRoot* root);
+
 void MyPrintRbTree(RbNode* node);
 
+// Frees every node with DeleteMyData in O(n), without rebalancing, and empties `root`.
+void MyDestroyRbTree(RbRoot* root);
+
+// Moves every node (from NewMyData) into one contiguous run of the MyData pool, laid out for fast descents
+// (see RelayoutRbTree), and frees the old ones. Every MyData* into the tree becomes invalid.
+// The slabs and runs left empty are given back to the system, so repeated passes don't grow the pool,
+// but a pass needs room for a second copy of the tree meanwhile.
+// Returns the number of moved nodes, or 0 if out of memory, in which case nothing changes.
+size_t MyCompactRbTree(RbRoot* root);
+
+// Links `datas`, which must be sorted by value, into an empty rb-tree in O(n).
+void MyBuildRbTreeFromSorted(MyData* const* datas, size_t data_num, RbRoot* root);
+
+/* Join and split operations for rb-tree */
+// Moves the nodes whose value is less than `value` into `less`, and the others into `not_less`.
+void MySplitRbTree(int value, RbRoot* root, RbRoot* less, RbRoot* not_less);
+
+// Moves the nodes whose value is in [lo, hi) from `root` into `extracted` in O(log n).
+void MyExtractRangeFromRbTree(int lo, int hi, RbRoot* root, RbRoot* extracted);
+
+// Frees the nodes whose value is in [lo, hi) with DeleteMyData in O(k + log n),
+// and returns the number of them.
+size_t MyEraseRangeFromRbTree(int lo, int hi, RbRoot* root);
+
+size_t MyEraseRangeFromRbTreeCached(int lo, int hi, RbRootCached* root);
+
+/* Set operations for rb-tree, see rb-tree-set-ops.h */
+// Moves the nodes of `a` and `b` into `root` (which may be `a` or `b`), and frees the duplicates
+// of `b` with DeleteMyData. Both trees must have unique values. Runs in parallel on `pool` if not nullptr.
+void MyUnionRbTree(RbRoot* a, RbRoot* b, RbRoot* root, WorkStealingPool* pool = nullptr);
+
+// Keeps the nodes of `a` whose value is also in `b`, and frees the others of both trees.
+void MyIntersectRbTree(RbRoot* a, RbRoot* b, RbRoot* root, WorkStealingPool* pool = nullptr);
+
+// Keeps the nodes of `a` whose value isn't in `b`, and frees the others of both trees.
+void MyDifferenceRbTree(RbRoot* a, RbRoot* b, RbRoot* root, WorkStealingPool* pool = nullptr);
+
+/* Operations for rb-tree with cached leftmost and rightmost nodes */
+void MyInsertIntoRbTreeCached(MyData* new_data, RbRootCached* root);
+
+// Inserts in O(1) when `new_data` is not less than the current maximum, e.g. for increasing timestamps.
+// Otherwise it searches from the maximum, so slightly late values are still cheap.
+void MyAppendToRbTreeCached(MyData* new_data, RbRootCached* root);
+
+void MyRemoveFromRbTreeCached(MyData* data, RbRootCached* root);
+
+// Unlinks the node with the smallest value and returns it without freeing it.
+MyData* MyPopMinFromRbTreeCached(RbRootCached* root);
+
+/* Lookup operations for rb-tree */
+// Returns a node whose value is equal to `value`, or nullptr.
+MyData* MyFindInRbTree(int value, RbRoot* root);
+
+// Returns the first node whose value is not less than `value`, or nullptr.
+MyData* MyLowerBoundInRbTree(int value, RbRoot* root);
+
+// Returns the first node whose value is greater than `value`, or nullptr.
+MyData* MyUpperBoundInRbTree(int value, RbRoot* root);
+
+// Calls `visit(MyData*)` on every node in [lo, hi) in ascending order,
+// and returns the number of visited nodes. No memory is allocated.
+template <typename Visitor>
+size_t MyVisitRangeInRbTree(int lo, int hi, RbRoot* root, Visitor&& visit) {
+    size_t count = 0;
+    MyData* data = MyLowerBoundInRbTree(lo, root);
+    while (data != nullptr && data->value < hi) {
+        visit(data);
+        ++count;
+        RbNode* next = NextRbNode(&data->rb_node);
+        data = next ? ContainerOf(next, struct MyData, rb_node) : nullptr;
+    }
+    return count;
+}
+
+/* Operations for order-statistic rb-tree */
+// MyRankedData is allocated by the caller, and the tree only links and unlinks it.
+void MyInsertIntoRankedRbTree(MyRankedData* new_data, RbRoot* root);
+
+// Unlinks `data` without freeing it.
+void MyRemoveFromRankedRbTree(MyRankedData* data, RbRoot* root);
+
+// Returns the k-th smallest node (counting from 0), or nullptr.
+MyRankedData* MySelectInRankedRbTree(size_t k, RbRoot* root);
+
+// Returns the number of nodes whose value is less than `value`.
+size_t MyRankInRankedRbTree(int value, RbRoot* root);
+
 /* Test tools for rb-tree */
 bool IsLegalRbTree(RbRoot* root);
 
@@ -0,0 +1,107 @@
+#ifndef MY_SHARDED_RB_TREE_H_
+#define MY_SHARDED_RB_TREE_H_
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+
+#include <climits>
+#include <cstdint>
+
+#include "include/my-rb-tree.h"
+
+/*
+    Set of values partitioned by key range into shards, each one an RbRoot of MyData with its
+    own lock, so writers on different ranges don't contend.
+
+    Shard i holds the values in [lower bound of shard i, lower bound of shard i + 1).
+    A boundary only moves while both shards next to it are locked, so an operation routes
+    by the boundaries without any global lock, then checks them again under the shard lock.
+
+    A shard growing to more than twice the average size moves a key range over to a smaller
+    neighbor with a split and a concat, while the other shards keep working.
+    Only a bounded number of nodes moves per step.
+*/
+class MyShardedRbTree {
+public:
+    // Splits [lo, hi) evenly into `shard_num` shards. Values out of it go to the first or last one.
+    explicit MyShardedRbTree(int shard_num, int lo = INT_MIN, int hi = INT_MAX);
+
+    // Frees every value. No other thread may use the tree meanwhile.
+    ~MyShardedRbTree();
+
+    MyShardedRbTree(const MyShardedRbTree&) = delete;
+    MyShardedRbTree& operator=(const MyShardedRbTree&) = delete;
+
+    // Returns false if `value` is already there.
+    bool Insert(int value);
+
+    // Returns false if `value` isn't there.
+    bool Remove(int value);
+
+    bool Contains(int value);
+
+    /*
+        Calls `visit(const MyData*)` on every value in [lo, hi) in ascending order,
+        and returns the number of visited values.
+        Shards are visited one at a time under their locks, so the scan is consistent per shard,
+        not across them. It still sees every value that stays in the tree during the scan exactly once,
+        even if the boundaries move meanwhile.
+    */
+    template <typename Visitor>
+    size_t VisitRange(int lo, int hi, Visitor&& visit) {
+        size_t count = 0;
+        int64_t from = lo;
+        while (from < hi) {
+            int64_t upper = 0;
+            Shard* shard = LockShardOf(static_cast<int>(from), &upper);
+            int to = upper < hi ? static_cast<int>(upper) : hi;
+            count += MyVisitRangeInRbTree(static_cast<int>(from), to, &shard->root, [&](MyData* data) {
+                visit(static_cast<const MyData*>(data));
+            });
+            shard->mutex.unlock();
+            from = upper;
+        }
+        return count;
+    }
+
+    // Moves key ranges between neighbors until their sizes are about the same.
+    // Other threads may keep using the tree meanwhile.
+    void Rebalance();
+
+    int GetShardNum() const { return shard_num_; }
+
+    // Exact only when no writer is running.
+    size_t GetShardSize(int index) const { return shards_[index].size.load(std::memory_order_relaxed); }
+
+    size_t GetSize() const;
+
+private:
+    struct Shard {
+        std::mutex mutex;
+        // `root` is protected by `mutex`. `lower` and `size` are only written under it,
+        // but read without it for routing and rebalancing decisions.
+        RbRoot root;
+        std::atomic<int> lower;
+        std::atomic<size_t> size;
+        // Keeps the locks of neighboring shards off the same cache line.
+        char padding[64];
+    };
+
+    // Locks and returns the shard holding `value`, and stores the lower bound of the next shard
+    // into `upper` (INT_MAX + 1 for the last shard).
+    Shard* LockShardOf(int value, int64_t* upper);
+
+    // Moves nodes between shard `index` and `index + 1` if their sizes differ by much.
+    // Returns whether anything was moved.
+    bool BalancePair(int index);
+
+    // Balances `index` with its smaller neighbor if it's much larger than the average.
+    // Only called every so many inserts.
+    void MaybeBalanceAround(int index);
+
+    int shard_num_;
+    std::unique_ptr<Shard[]> shards_;
+};
+
+#endif  // MY_SHARDED_RB_TREE_H_
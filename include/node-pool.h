@@ -0,0 +1,45 @@
+#ifndef NODE_POOL_H_
+#define NODE_POOL_H_
+
+#include <stddef.h>
+
+/*
+    Pooled allocator for fixed-size tree entries (e.g. MyData).
+
+    Entries are carved out of cache-line aligned slabs. An entry smaller than a cache line
+    is rounded up to a power of 2, so it never straddles two cache lines.
+    Every thread keeps a small free list per pool, and only goes to the shared free list
+    (under a lock) once per batch of entries.
+
+    DestroyNodePool releases all slabs at once. The trees built on the entries
+    don't need to be walked or rebalanced, just forget their roots.
+*/
+struct NodePool;
+
+NodePool* CreateNodePool(size_t entry_size);
+
+// Releases every entry allocated from `pool`, and `pool` itself.
+void DestroyNodePool(NodePool* pool);
+
+void* AllocFromNodePool(NodePool* pool);
+
+void FreeToNodePool(NodePool* pool, void* entry);
+
+// Allocates `count` entries next to each other in a page-aligned slab of their own, `GetNodePoolSlotSize`
+// bytes apart, e.g. to lay out a tree in a cache-friendly order. Each one is freed with FreeToNodePool
+// as usual, and the slab goes back to the free slots of the pool, unless TrimNodePool releases it.
+// Returns NULL if out of memory.
+void* AllocRunFromNodePool(NodePool* pool, size_t count);
+
+// Releases the slabs and runs whose every entry has been freed, e.g. after moving a tree into a new run.
+// Entries still cached by other threads keep their slabs. Returns the number of bytes released.
+// It walks all the free entries, so call it once after a bulk free, not per entry.
+size_t TrimNodePool(NodePool* pool);
+
+// Bytes taken from malloc by `pool`, for its slabs and runs.
+size_t GetNodePoolFootprint(NodePool* pool);
+
+// The size of the slots, which may be larger than the `entry_size` passed to CreateNodePool.
+size_t GetNodePoolSlotSize(const NodePool* pool);
+
+#endif  // NODE_POOL_H_
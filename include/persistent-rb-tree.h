@@ -0,0 +1,389 @@
+#ifndef PERSISTENT_RB_TREE_H_
+#define PERSISTENT_RB_TREE_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <utility>
+#include <vector>
+
+#include "include/rb-tree.h"
+
+/*
+    Persistent (copy-on-write) rb-tree of keys, for readers which need a point-in-time view
+    while a writer keeps changing the tree.
+
+    snapshot() costs O(1), it only takes a reference to the current root. The writer never changes
+    a node that a snapshot can reach: before changing a node, it clones it unless the node is
+    referenced only once, i.e. only by the writer's own version. So insert and erase clone only the
+    nodes on the search path, and the siblings and nephews the fixups recolor or rotate, O(log n).
+
+    Nodes are shared by many versions, so they have no parent pointer. The writer keeps the search
+    path on a stack instead, and readers walk with a stack too.
+    Every node counts the references from its parents, the tree and the snapshots atomically,
+    and the last owner of a node frees it, so snapshots may be released from any thread.
+
+    Writers must be serialized by the caller, and snapshot() counts as a write.
+    A Snapshot never changes, so any number of threads may read it without locks.
+
+    Example:
+        PersistentRbTree<int> tree;
+        tree.insert(42);
+        PersistentRbTree<int>::Snapshot snapshot = tree.snapshot();
+        tree.erase(42);
+        snapshot.contains(42);  // Still true.
+*/
+template <typename Key, typename Compare = std::less<>>
+class PersistentRbTree {
+    struct Node {
+        Node(const Key& node_key, Color node_color, Node* left_child, Node* right_child)
+            : key(node_key), left(left_child), right(right_child), ref_count(1), color(node_color) {}
+
+        Key key;
+        Node* left;
+        Node* right;
+        std::atomic<uint32_t> ref_count;
+        Color color;
+    };
+
+    // A legal rb-tree is never deeper than 128 levels, and a fixup may push a node one level down.
+    static constexpr int kMaxDepth = 130;
+
+public:
+    class Snapshot {
+    public:
+        Snapshot() : root_(nullptr), size_(0), compare_() {}
+        Snapshot(const Snapshot& other) : root_(other.root_), size_(other.size_), compare_(other.compare_) {
+            Acquire(root_);
+        }
+        Snapshot(Snapshot&& other) noexcept
+            : root_(other.root_), size_(other.size_), compare_(std::move(other.compare_)) {
+            other.root_ = nullptr;
+            other.size_ = 0;
+        }
+        Snapshot& operator=(Snapshot other) noexcept {
+            std::swap(root_, other.root_);
+            std::swap(size_, other.size_);
+            std::swap(compare_, other.compare_);
+            return *this;
+        }
+        ~Snapshot() { Release(root_); }
+
+        bool empty() const { return root_ == nullptr; }
+        size_t size() const { return size_; }
+
+        bool contains(const Key& key) const { return Find(root_, key, compare_) != nullptr; }
+
+        // Returns the stored key equivalent to `key`, or nullptr. Valid as long as this snapshot.
+        const Key* find(const Key& key) const {
+            const Node* node = Find(root_, key, compare_);
+            return node ? &node->key : nullptr;
+        }
+
+        // Calls `visit(const Key&)` on every key in [lo, hi) in ascending order,
+        // and returns the number of visited keys.
+        template <typename Visitor>
+        size_t visit_range(const Key& lo, const Key& hi, Visitor&& visit) const {
+            const Node* stack[kMaxDepth];
+            int top = 0;
+            for (const Node* node = root_; node != nullptr; ) {
+                if (compare_(node->key, lo)) {
+                    node = node->right;
+                } else {
+                    stack[top++] = node;
+                    node = node->left;
+                }
+            }
+            size_t count = 0;
+            while (top > 0) {
+                const Node* node = stack[--top];
+                if (!compare_(node->key, hi)) {
+                    break;
+                }
+                visit(node->key);
+                ++count;
+                for (node = node->right; node != nullptr; node = node->left) {
+                    stack[top++] = node;
+                }
+            }
+            return count;
+        }
+
+    private:
+        friend class PersistentRbTree;
+        // Takes over a reference to `root`.
+        Snapshot(Node* root, size_t size, const Compare& compare) : root_(root), size_(size), compare_(compare) {}
+
+        Node* root_;
+        size_t size_;
+        Compare compare_;
+    };
+
+    PersistentRbTree() : root_(nullptr), size_(0), compare_() {}
+    explicit PersistentRbTree(const Compare& compare) : root_(nullptr), size_(0), compare_(compare) {}
+    ~PersistentRbTree() { Release(root_); }
+
+    PersistentRbTree(const PersistentRbTree&) = delete;
+    PersistentRbTree& operator=(const PersistentRbTree&) = delete;
+
+    bool empty() const { return root_ == nullptr; }
+    size_t size() const { return size_; }
+
+    bool contains(const Key& key) const { return Find(root_, key, compare_) != nullptr; }
+
+    // Returns an immutable view of the current version, valid until the Snapshot is destroyed.
+    Snapshot snapshot() const {
+        Acquire(root_);
+        return Snapshot(root_, size_, compare_);
+    }
+
+    // Returns false if an equivalent key is already there.
+    bool insert(const Key& key) {
+        // Search first, so that a failed insert doesn't clone the path.
+        if (contains(key)) {
+            return false;
+        }
+        Node* path[kMaxDepth];
+        int depth = 0;
+        Node** link = &root_;
+        while (*link != nullptr) {
+            Node* node = MakeUnique(link);
+            path[depth++] = node;
+            link = compare_(key, node->key) ? &node->left : &node->right;
+        }
+        *link = new Node(key, kRed, nullptr, nullptr);
+        path[depth] = *link;
+        FixupAfterInsert(path, depth);
+        ++size_;
+        return true;
+    }
+
+    // Returns false if no equivalent key is there.
+    bool erase(const Key& key) {
+        if (!contains(key)) {
+            return false;
+        }
+        Node* path[kMaxDepth];
+        int depth = 0;
+        Node** link = &root_;
+        Node* node = nullptr;
+        while (true) {
+            node = MakeUnique(link);
+            path[depth] = node;
+            if (compare_(key, node->key)) {
+                link = &node->left;
+            } else if (compare_(node->key, key)) {
+                link = &node->right;
+            } else {
+                break;
+            }
+            ++depth;
+        }
+        // A node with two children takes the key of its successor, which is removed instead.
+        if (node->left != nullptr && node->right != nullptr) {
+            Node* target = node;
+            link = &node->right;
+            do {
+                node = MakeUnique(link);
+                path[++depth] = node;
+                link = &node->left;
+            } while (node->left != nullptr);
+            target->key = node->key;
+        }
+
+        // `node` has at most one child, which takes its place along with its reference.
+        Node* child = node->left ? node->left : node->right;
+        bool is_left = depth > 0 && path[depth - 1]->left == node;
+        *LinkTo(path, depth) = child;
+        Color removed_color = node->color;
+        node->left = node->right = nullptr;
+        Release(node);
+        --size_;
+        if (removed_color == kBlack) {
+            FixupAfterErase(path, depth, is_left);
+        }
+        return true;
+    }
+
+private:
+    static void Acquire(Node* node) {
+        if (node != nullptr) {
+            node->ref_count.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    // Drops a reference to `node`, and frees the nodes nothing refers to anymore.
+    static void Release(Node* node) {
+        std::vector<Node*> garbage;
+        while (true) {
+            if (node != nullptr && node->ref_count.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                garbage.push_back(node->left);
+                garbage.push_back(node->right);
+                delete node;
+            }
+            if (garbage.empty()) {
+                return;
+            }
+            node = garbage.back();
+            garbage.pop_back();
+        }
+    }
+
+    template <typename K>
+    static const Node* Find(const Node* node, const K& key, const Compare& compare) {
+        while (node != nullptr) {
+            if (compare(key, node->key)) {
+                node = node->left;
+            } else if (compare(node->key, key)) {
+                node = node->right;
+            } else {
+                return node;
+            }
+        }
+        return nullptr;
+    }
+
+    /*
+        Returns the node at `link`, cloned first if anyone else refers to it.
+        The clone refers to the same children, so they become shared in turn.
+        The owner of `link` must already be unique.
+    */
+    static Node* MakeUnique(Node** link) {
+        Node* node = *link;
+        if (node->ref_count.load(std::memory_order_acquire) == 1) {
+            return node;
+        }
+        Node* clone = new Node(node->key, node->color, node->left, node->right);
+        Acquire(clone->left);
+        Acquire(clone->right);
+        Release(node);
+        *link = clone;
+        return clone;
+    }
+
+    // The link to path[depth] in its parent, or the root link.
+    Node** LinkTo(Node** path, int depth) {
+        if (depth == 0) {
+            return &root_;
+        }
+        Node* parent = path[depth - 1];
+        return parent->left == path[depth] ? &parent->left : &parent->right;
+    }
+
+    static bool IsRedNode(const Node* node) { return node != nullptr && node->color == kRed; }
+
+    // Same as RotateLeft in rb-tree.c, on `*link` and its right child, which must both be unique.
+    // The references only move from one link to another, so no count changes.
+    static void RotateLeftAt(Node** link) {
+        Node* x = *link;
+        Node* y = x->right;
+        x->right = y->left;
+        y->left = x;
+        *link = y;
+    }
+
+    static void RotateRightAt(Node** link) {
+        Node* x = *link;
+        Node* y = x->left;
+        x->left = y->right;
+        y->right = x;
+        *link = y;
+    }
+
+    // Same cases as FixupAfterInsert in rb-tree.c. `path` holds the new red node at `depth`
+    // and its ancestors, which are all unique.
+    void FixupAfterInsert(Node** path, int depth) {
+        while (depth > 0 && path[depth - 1]->color == kRed) {
+            // A red parent is never the root, so the grandparent exists.
+            Node* node = path[depth];
+            Node* parent = path[depth - 1];
+            Node* grandparent = path[depth - 2];
+            bool parent_is_left = grandparent->left == parent;
+            Node** uncle_link = parent_is_left ? &grandparent->right : &grandparent->left;
+            if (IsRedNode(*uncle_link)) {
+                // Case 1: recolor, and continue from the grandparent.
+                MakeUnique(uncle_link)->color = kBlack;
+                parent->color = kBlack;
+                grandparent->color = kRed;
+                depth -= 2;
+                continue;
+            }
+            if ((node == parent->right) == parent_is_left) {
+                // Case 2: rotate `node` into the place of `parent`, which turns into case 3.
+                Node** parent_link = parent_is_left ? &grandparent->left : &grandparent->right;
+                parent_is_left ? RotateLeftAt(parent_link) : RotateRightAt(parent_link);
+                parent = node;
+            }
+            // Case 3: rotate `parent` into the place of `grandparent`.
+            parent->color = kBlack;
+            grandparent->color = kRed;
+            Node** grandparent_link = LinkTo(path, depth - 2);
+            parent_is_left ? RotateRightAt(grandparent_link) : RotateLeftAt(grandparent_link);
+            break;
+        }
+        root_->color = kBlack;
+    }
+
+    /*
+        Same cases as FixupAfterRemove in rb-tree.c. The subtree on the side `is_left` of path[depth - 1]
+        (maybe empty) has lost a black node. path[0..depth) are unique, and every sibling or nephew
+        is made unique before it's recolored or rotated.
+    */
+    void FixupAfterErase(Node** path, int depth, bool is_left) {
+        while (depth > 0) {
+            Node* parent = path[depth - 1];
+            if (IsRedNode(is_left ? parent->left : parent->right)) {
+                break;
+            }
+            Node** sibling_link = is_left ? &parent->right : &parent->left;
+            Node* sibling = MakeUnique(sibling_link);
+            if (sibling->color == kRed) {
+                // Case 1: rotate the red sibling above `parent`, so the subtree gets a black sibling.
+                sibling->color = kBlack;
+                parent->color = kRed;
+                Node** parent_link = LinkTo(path, depth - 1);
+                is_left ? RotateLeftAt(parent_link) : RotateRightAt(parent_link);
+                path[depth - 1] = sibling;
+                path[depth] = parent;
+                ++depth;
+                sibling = MakeUnique(sibling_link);
+            }
+            Node** near_link = is_left ? &sibling->left : &sibling->right;
+            Node** far_link = is_left ? &sibling->right : &sibling->left;
+            if (!IsRedNode(*near_link) && !IsRedNode(*far_link)) {
+                // Case 2: the sibling's subtree gives up a black node too, so move up.
+                sibling->color = kRed;
+                --depth;
+                is_left = depth > 0 && path[depth - 1]->left == path[depth];
+                continue;
+            }
+            if (!IsRedNode(*far_link)) {
+                // Case 3: rotate the red near nephew above the sibling, which turns into case 4.
+                MakeUnique(near_link)->color = kBlack;
+                sibling->color = kRed;
+                is_left ? RotateRightAt(sibling_link) : RotateLeftAt(sibling_link);
+                sibling = *sibling_link;
+                far_link = is_left ? &sibling->right : &sibling->left;
+            }
+            // Case 4: rotate the sibling above `parent`, and the far nephew makes up the black node.
+            sibling->color = parent->color;
+            parent->color = kBlack;
+            MakeUnique(far_link)->color = kBlack;
+            Node** parent_link = LinkTo(path, depth - 1);
+            is_left ? RotateLeftAt(parent_link) : RotateRightAt(parent_link);
+            return;
+        }
+        // The subtree is rooted by a red node (or is the whole tree), which turns black to make up for it.
+        Node** link = depth == 0 ? &root_ : (is_left ? &path[depth - 1]->left : &path[depth - 1]->right);
+        if (*link != nullptr) {
+            MakeUnique(link)->color = kBlack;
+        }
+    }
+
+    Node* root_;
+    size_t size_;
+    Compare compare_;
+};
+
+#endif  // PERSISTENT_RB_TREE_H_
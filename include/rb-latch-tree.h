@@ -0,0 +1,97 @@
+#ifndef RB_LATCH_TREE_H_
+#define RB_LATCH_TREE_H_
+
+#include "include/rb-tree.h"
+
+/*
+    Lookups without locks, for trees read by many threads and written by a few.
+
+    Writers are serialized among themselves (e.g. by a mutex), and bump a sequence counter
+    before and after every change. Built with RB_TREE_LOCKLESS_READERS=1, which this needs,
+    the rb-tree publishes its links with release stores (see RbWriteLink),
+    so a lookup never reaches a node before it's initialized.
+    A lookup reads the counter before and after its walk, and walks again if a writer came
+    in between, because a rotation may have hidden the key from it for a moment.
+
+    There are two flavors:
+    - RbSeqRoot keeps a single tree. Lookups wait while a write is in progress,
+      so a steady stream of writes may starve them.
+    - RbLatchRoot keeps two copies of the tree, and every entry embeds two RbNode.
+      Writers change one copy while lookups use the other one, so lookups never wait,
+      and only walk again when the copy they are in is changed under them.
+      It costs twice the links and twice the work per insert or remove.
+
+    Only inserting, removing and replacing a node are safe against concurrent lookups.
+    Join, split, erase-range and bulk construction relink nodes with plain stores.
+
+    A lookup which started before a removal may still read the removed entry, so its memory
+    must stay readable until such lookups are done, e.g. by waiting for a grace period
+    before freeing it, or by allocating entries from a NodePool, which doesn't give memory back
+    before DestroyNodePool. In the latter case an entry may be reused right after a lookup
+    returns it, so check its key again under the writer lock if that matters.
+*/
+
+typedef struct RbSeqRoot {
+    RbRoot rb_root;
+    uint32_t sequence;
+} RbSeqRoot;
+
+#define InitializedRbSeqRoot { InitializedRbRoot, 0, }
+
+/*
+    Entry of RbLatchRoot, embedded in the container like RbNode.
+
+    Example:
+        struct MyEntry {
+            RbLatchNode latch_node;
+            int key;
+        };
+*/
+typedef struct RbLatchNode {
+    RbNode rb_node[2];
+} RbLatchNode;
+
+typedef struct RbLatchRoot {
+    uint32_t sequence;
+    RbRoot tree[2];
+} RbLatchRoot;
+
+#define InitializedRbLatchRoot { 0, { InitializedRbRoot, InitializedRbRoot, }, }
+
+// Like RbCompareFunc, for the entries of RbLatchRoot.
+typedef int (*RbLatchCompareFunc)(const RbLatchNode* node, const void* key);
+
+// Returns true if the key of `a` is less than the key of `b`.
+typedef bool (*RbLatchLessFunc)(const RbLatchNode* a, const RbLatchNode* b);
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+    /*
+        Writers of RbSeqRoot wrap every change of `rb_root` with these two calls, e.g.
+            BeginRbSeqWrite(&root);
+            InsertIntoRbTree(node, parent, parent_link, &root.rb_root);
+            EndRbSeqWrite(&root);
+        Writers find the place to insert as usual, without RbReadLink.
+    */
+    void BeginRbSeqWrite(RbSeqRoot* root);
+
+    void EndRbSeqWrite(RbSeqRoot* root);
+
+    // Returns a node equal to `key`, or NULL. Safe against one concurrent writer.
+    RbNode* FindInRbSeqTree(const RbSeqRoot* root, RbCompareFunc compare, const void* key);
+
+    // Equal keys are inserted after the existing ones. Writers must be serialized by the caller.
+    void InsertIntoRbLatchTree(RbLatchNode* node, RbLatchRoot* root, RbLatchLessFunc less);
+
+    void RemoveFromRbLatchTree(RbLatchNode* node, RbLatchRoot* root);
+
+    // Returns an entry equal to `key`, or NULL. Safe against one concurrent writer, and never waits for it.
+    RbLatchNode* FindInRbLatchTree(const RbLatchRoot* root, RbLatchCompareFunc compare, const void* key);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // RB_LATCH_TREE_H_
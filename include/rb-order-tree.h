@@ -0,0 +1,38 @@
+#ifndef RB_ORDER_TREE_H_
+#define RB_ORDER_TREE_H_
+
+#include "include/rb-tree.h"
+
+/*
+    Order-statistic rb-tree.
+    Every node records the size of its subtree, so the k-th node and
+    the rank of a node can be found in O(log n) instead of an in-order walk.
+*/
+typedef struct RbSizedNode {
+    RbNode rb_node;
+    size_t size;
+} RbSizedNode;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+    inline size_t SizeOfRbSizedTree(const RbRoot* root) {
+        return root->rb_node ? ContainerOf(root->rb_node, RbSizedNode, rb_node)->size : 0;
+    }
+
+    void InsertIntoRbSizedTree(RbSizedNode* node, RbNode* parent, RbNode** parent_link, RbRoot* root);
+
+    void RemoveFromRbSizedTree(RbSizedNode* node, RbRoot* root);
+
+    // Returns the k-th smallest node (counting from 0), or NULL if k is out of range.
+    RbSizedNode* SelectFromRbSizedTree(const RbRoot* root, size_t k);
+
+    // Returns the number of nodes before `node` in key order.
+    size_t RankOfRbSizedNode(const RbSizedNode* node);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // RB_ORDER_TREE_H_
@@ -0,0 +1,73 @@
+#ifndef RB_TREE_AUGMENTED_H_
+#define RB_TREE_AUGMENTED_H_
+
+#include "include/rb-tree.h"
+
+/*
+    Augmented rb-tree keeps per-subtree metadata (e.g. max end, sum, count)
+    in every node, and updates it in O(log n) per insert or remove.
+
+    The rb-tree only changes shape in three ways, and each one has a callback:
+    1. `propagate(node, stop)` recomputes the metadata of `node` and its ancestors,
+       stopping before `stop` (NULL means up to the root).
+       It's called after a node is linked or unlinked.
+    2. `copy(old_node, new_node)` is called when `new_node` takes the place of `old_node`,
+       i.e. when the successor replaces a removed node with two children.
+    3. `rotate(old_node, new_node)` is called after a rotation,
+       where `new_node` is the new parent of `old_node`.
+*/
+typedef struct RbAugmentCallbacks {
+    void (*propagate)(RbNode* node, RbNode* stop);
+    void (*copy)(RbNode* old_node, RbNode* new_node);
+    void (*rotate)(RbNode* old_node, RbNode* new_node);
+} RbAugmentCallbacks;
+
+/*
+    Declares the three callbacks and a `const RbAugmentCallbacks rb_name` for an entry type.
+    `rb_compute(rb_struct*)` must return the metadata of an entry from its own fields
+    and the metadata of its children.
+
+    Example:
+        static long long ComputeSum(struct MyEntry* entry);
+        DeclareRbAugmentCallbacks(static, kSumCallbacks, struct MyEntry, rb_node, sum, ComputeSum)
+*/
+#define DeclareRbAugmentCallbacks(rb_static, rb_name, rb_struct, rb_field, rb_augmented, rb_compute)   \
+    static void rb_name##Propagate(RbNode* node, RbNode* stop) {                                        \
+        while (node != stop) {                                                                          \
+            rb_struct* entry = ContainerOf(node, rb_struct, rb_field);                                  \
+            entry->rb_augmented = rb_compute(entry);                                                    \
+            node = GetParent(node);                                                                     \
+        }                                                                                               \
+    }                                                                                                   \
+    static void rb_name##Copy(RbNode* old_node, RbNode* new_node) {                                     \
+        rb_struct* old_entry = ContainerOf(old_node, rb_struct, rb_field);                              \
+        rb_struct* new_entry = ContainerOf(new_node, rb_struct, rb_field);                              \
+        new_entry->rb_augmented = old_entry->rb_augmented;                                              \
+    }                                                                                                   \
+    static void rb_name##Rotate(RbNode* old_node, RbNode* new_node) {                                   \
+        rb_struct* old_entry = ContainerOf(old_node, rb_struct, rb_field);                              \
+        rb_struct* new_entry = ContainerOf(new_node, rb_struct, rb_field);                              \
+        new_entry->rb_augmented = old_entry->rb_augmented;                                              \
+        old_entry->rb_augmented = rb_compute(old_entry);                                                \
+    }                                                                                                   \
+    rb_static const RbAugmentCallbacks rb_name = {                                                      \
+        rb_name##Propagate, rb_name##Copy, rb_name##Rotate,                                             \
+    };
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+    // The metadata of `node` itself is computed here, so it needn't be initialized by the caller.
+    void InsertIntoRbTreeAugmented(
+        RbNode* node, RbNode* parent, RbNode** parent_link,
+        RbRoot* root, const RbAugmentCallbacks* augment
+    );
+
+    void RemoveFromRbTreeAugmented(RbNode* node, RbRoot* root, const RbAugmentCallbacks* augment);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // RB_TREE_AUGMENTED_H_
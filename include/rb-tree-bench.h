@@ -0,0 +1,66 @@
+#ifndef RB_TREE_BENCH_H_
+#define RB_TREE_BENCH_H_
+
+/* Micro benchmarks for rb-tree, see `RunRbTreeBenchmarks`. */
+
+// Reports the node size and lookup throughput of the current RbNode layout.
+// Build once with RB_TREE_COMPACT_NODE=0 and once without it to compare them.
+void BenchRbNodeLayout(int node_num = 1000000, int lookup_num = 2000000);
+
+// Timer churn: repeatedly pops the earliest deadline and re-arms it later,
+// once with RbRoot + FirstRbNode and once with RbRootCached.
+void BenchTimerQueue(int timer_num = 100000, int op_num = 2000000);
+
+// Compares select(k)/rank(value) of the order-statistic tree with in-order walks.
+void BenchOrderStatistics(int node_num, int query_num = 1000000, int linear_query_num = 5);
+
+// Startup time of loading sorted keys: MyInsertIntoRbTree one by one vs MyBuildRbTreeFromSorted.
+void BenchBulkBuild(int node_num = 10000000);
+
+// Insert/remove throughput with malloc/free vs NewMyData/DeleteMyData,
+// and the teardown time of DeleteAllMyData.
+void BenchNodeAllocator(int node_num = 1000000, int round_num = 3);
+
+// Freeing a whole tree: MyRemoveFromRbTree on every node vs MyDestroyRbTree.
+void BenchTeardown(int node_num = 1000000);
+
+// Monotone and 1%-disordered streams: MyInsertIntoRbTreeCached vs MyAppendToRbTreeCached (the O(1)
+// fast path after the maximum), and on a line of its own, MyInsertIntoRbTreeWithHint with the previous
+// node as the hint, which has no cache and climbs the right spine.
+void BenchHintedInsert(int node_num = 1000000);
+
+// Expiring time windows from the front: MyRemoveFromRbTreeCached per node vs MyEraseRangeFromRbTreeCached.
+void BenchEraseRange(int node_num = 1000000, int window_num = 1000);
+
+// Lookup throughput of 1 to `max_reader_num` reader threads while one writer keeps reinserting entries:
+// an external mutex around every lookup vs RbSeqRoot vs RbLatchRoot (see rb-latch-tree.h).
+void BenchReadScaling(int node_num = 1000000, int max_reader_num = 64, double seconds = 0.2);
+
+// Insert/remove throughput of 1 to `max_thread_num` threads on uniform keys:
+// one RbRoot behind a mutex vs MyShardedRbTree, which also has to rebalance its shards online first.
+void BenchShardedWrites(int node_num = 1000000, int max_thread_num = 64, int op_num = 100000, int shard_num = 64);
+
+// Cold start: rebuilding with MyInsertIntoRbTree vs mapping a snapshot file (see my-rb-tree-snapshot.h),
+// and lookups on the tree vs on the mapping. The file is written to the working directory and removed.
+void BenchSnapshot(int node_num = 10000000, int lookup_num = 2000000);
+
+// Lookups on a tree scattered by churn, before and after MyCompactRbTree,
+// with the L1d/LLC/dTLB misses per lookup where the hardware counters are available (Linux only),
+// and the footprint of the MyData pool before and after one and two passes.
+void BenchCompaction(int node_num = 1000000, int churn_num = 4000000, int lookup_num = 2000000);
+
+// Consistent views for readers: copying the tree under a lock vs PersistentRbTree::snapshot(),
+// and the writer throughput with and without a snapshot published every `snapshot_interval` ops.
+void BenchPersistentSnapshots(int node_num = 1000000, int op_num = 1000000, int snapshot_interval = 1000);
+
+// One MyData per value vs MyBucketRbTree (see my-bucket-rb-tree.h): node count, memory per value,
+// random inserts and lookups, and full ordered scans.
+void BenchBucketTree(int node_num = 1000000, int lookup_num = 2000000, int scan_num = 10);
+
+// Union, intersection and difference of a tree of `node_num` values and one of `other_num` values:
+// walking one tree into the other one by one vs the join-based operations on 1 to `max_thread_num` threads.
+void BenchSetOperations(int node_num, int other_num, int max_thread_num = 32);
+
+void RunRbTreeBenchmarks();
+
+#endif  // RB_TREE_BENCH_H_
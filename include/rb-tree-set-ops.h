@@ -0,0 +1,51 @@
+#ifndef RB_TREE_SET_OPS_H_
+#define RB_TREE_SET_OPS_H_
+
+#include "include/rb-tree.h"
+
+class WorkStealingPool;
+
+/*
+    Union, intersection and difference of two rb-trees, built on join and split only
+    (see JoinRbTree), so the result is a legal rb-tree without any rotation of its own.
+
+    Each one exposes the root of one tree, splits the other tree by its key, handles both sides
+    recursively and joins the two results back with the root as the pivot:
+
+             [k]                                    [k]
+            /   \      op   T2      ====>          /     \
+          L1     R1                     L1 op T2<k     R1 op T2>k
+
+    If the operation drops k, the two results are concatenated instead.
+
+    That costs O(m log(n/m + 1)) work for trees of m <= n nodes, plus one `release` call per dropped node
+    (e.g. an intersection with a small tree drops most of the large one). The two sides are independent,
+    so the top levels of the recursion fork them onto `pool`, until there are about 8 tasks per thread,
+    and each task runs sequentially below that. So the span isn't polylogarithmic: it is the work of
+    the largest task, about 1/(8 * threads) of the total if the keys split evenly (more if they don't),
+    plus O(log(threads) * log n) for the splits and joins above it.
+    Without a pool (NULL) it all runs on the calling thread.
+
+    Both trees are consumed: the nodes in the result are relinked into `root`, which may be `a` or `b`,
+    `a` and `b` are emptied, and every other node is passed to `release` (if not NULL).
+    Keys must be unique within each tree. For a key in both trees, the node of `a` is kept.
+    With a pool, `release` and `compare` may be called from several threads at once.
+*/
+void UnionRbTree(
+    RbRoot* a, RbRoot* b, RbNodeCompareFunc compare, RbReleaseFunc release, void* context,
+    RbRoot* root, WorkStealingPool* pool = nullptr
+);
+
+// Keeps the nodes of `a` whose key is also in `b`.
+void IntersectRbTree(
+    RbRoot* a, RbRoot* b, RbNodeCompareFunc compare, RbReleaseFunc release, void* context,
+    RbRoot* root, WorkStealingPool* pool = nullptr
+);
+
+// Keeps the nodes of `a` whose key isn't in `b`.
+void DifferenceRbTree(
+    RbRoot* a, RbRoot* b, RbNodeCompareFunc compare, RbReleaseFunc release, void* context,
+    RbRoot* root, WorkStealingPool* pool = nullptr
+);
+
+#endif  // RB_TREE_SET_OPS_H_
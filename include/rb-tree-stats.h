@@ -0,0 +1,56 @@
+#ifndef RB_TREE_STATS_H_
+#define RB_TREE_STATS_H_
+
+#include <stdint.h>
+
+/*
+    Rebalancing statistics, to tell whether a latency spike comes from the fixups.
+
+    Off by default. Build everything with RB_TREE_STATS=1 to turn the counters on.
+    The counters are global and bumped with relaxed atomic increments, so a metrics thread
+    may poll GetRbTreeStats at any time without stopping the writers.
+    A snapshot is only consistent per counter, not across counters.
+*/
+#ifndef RB_TREE_STATS
+#define RB_TREE_STATS 0
+#endif
+
+// Histograms have one bucket per value, and the last bucket also counts all larger values.
+enum { kRbStatsHistogramSize = 64 };
+
+typedef struct RbTreeStats {
+    uint64_t rotate_left;
+    uint64_t rotate_right;
+    // Hits of case 1, 2 and 3 in FixupAfterInsert, and of case 1 to 4 in FixupAfterRemove.
+    uint64_t insert_cases[3];
+    uint64_t remove_cases[4];
+    // Number of loop iterations per fixup.
+    uint64_t insert_fixup_loops[kRbStatsHistogramSize];
+    uint64_t remove_fixup_loops[kRbStatsHistogramSize];
+    // Number of nodes visited per search, reported through RbStatsSearchDepth.
+    uint64_t search_depth[kRbStatsHistogramSize];
+} RbTreeStats;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+    // Copies the counters into `stats`. All zero when RB_TREE_STATS is off.
+    void GetRbTreeStats(RbTreeStats* stats);
+
+    void ResetRbTreeStats(void);
+
+    void RecordRbSearchDepth(int depth);
+
+#ifdef __cplusplus
+}
+#endif
+
+// Searches written outside rb-tree.c report their depth with this, which costs nothing when stats are off.
+#if RB_TREE_STATS
+#define RbStatsSearchDepth(depth) RecordRbSearchDepth(depth)
+#else
+#define RbStatsSearchDepth(depth) ((void)(depth))
+#endif
+
+#endif  // RB_TREE_STATS_H_
@@ -0,0 +1,72 @@
+#ifndef RB_TREE_TESTER_H_
+#define RB_TREE_TESTER_H_
+
+/*
+    Testers of the features built on the core rb-tree, which RbTreeTesterAuto checks.
+    Each one compares against a brute-force model (e.g. std::set) with a fixed seed,
+    reports the first mismatch to stderr, and returns whether everything passed.
+*/
+
+// Overlap queries against a brute-force scan, while intervals are inserted and removed.
+bool RbTreeTesterIntervals(int interval_num = 2000, int query_num = 2000);
+
+// JoinRbTree, SplitRbTree and ConcatRbTree on trees of very different black heights, and empty ones.
+bool RbTreeTesterJoinAndSplit();
+
+// Allocates, frees and reallocates entries of NodePool with several slot sizes,
+// and checks that no two entries overlap and the large ones are cache-line aligned.
+bool RbTreeTesterNodePool(int entry_num = 5000);
+
+// MyEraseRangeFromRbTree[Cached] on ranges of fewer and more than 64 nodes (where it stops removing
+// them one by one), including ones past either end, and the cached leftmost and rightmost nodes afterwards.
+bool RbTreeTesterEraseRange(int node_num = 2000, int round_num = 500);
+
+// Lookups of keys that stay in RbSeqRoot and RbLatchRoot, from several threads,
+// while a writer keeps inserting and removing other keys.
+bool RbTreeTesterLatchTree(int key_num = 10000, int write_num = 200000);
+
+// MyShardedRbTree against std::set, with several writers on skewed values,
+// while another thread rebalances the shards and scans the values that stay.
+bool RbTreeTesterShardedTree(int op_num = 50000);
+
+// Writes, opens and loads back snapshots against std::set, and checks that truncated
+// or corrupted snapshot files are rejected. Uses a temporary file in the working directory.
+bool RbTreeTesterSnapshot(int node_num = 5000);
+
+// Random inserts and erases on PersistentRbTree against std::set, while several snapshots are held
+// and compared with copies of the std::set, and old snapshots are dropped on another thread.
+bool RbTreeTesterPersistentTree(int op_num = 50000);
+
+// MyLowerBoundInBucket against a scalar count, every split and merge path of MyBucketRbTree,
+// and random operations against std::set, including INT_MIN and INT_MAX.
+// Build it with MY_BUCKET_SIMD=0 too, to check the scalar search as well.
+bool RbTreeTesterBucketTree(int op_num = 20000);
+
+// UnionRbTree, IntersectRbTree and DifferenceRbTree against std::set_union and so on,
+// with and without a WorkStealingPool, and the nodes they keep, empty and release.
+bool RbTreeTesterSetOps();
+
+// MyLowerBoundInRbTree, MyUpperBoundInRbTree and MyVisitRangeInRbTree against std::multiset,
+// with runs of equal values, bounds past both ends and empty ranges, and walks in both directions.
+bool RbTreeTesterBounds(int node_num = 2000, int query_num = 5000);
+
+// Random inserts and removes on the order-statistic tree against std::multiset,
+// checking the subtree sizes, every select and the rank of every value after each one.
+bool RbTreeTesterRankedTree(int op_num = 6000);
+
+// Every way of linking and unlinking entries of IntrusiveRbTree, against the order they must keep
+// (equal keys in insertion order), plus lookups with transparent keys, moves and clear_and_dispose.
+bool RbTreeTesterIntrusiveTree(int op_num = 10000);
+
+// CheckRbTree on a small tree corrupted in each way it detects, with the exact result and bad node.
+bool RbTreeTesterCheck();
+
+// MyInsertIntoRbTreeWithHint and IntrusiveRbTree::insert(hint) with random and stale hints,
+// equal values, and hints at either end, checking the order and the tree after every insert.
+bool RbTreeTesterHintedInsert(int insert_num = 3000);
+
+// MyCompactRbTree (and so RelayoutRbTree) on trees of several sizes with churn between the passes,
+// against std::multiset, and checks that passes without inserts between them don't grow the pool.
+bool RbTreeTesterCompaction();
+
+#endif  // RB_TREE_TESTER_H_
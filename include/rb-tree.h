@@ -3,12 +3,27 @@
 
 #include <stdlib.h>
 #include <stdbool.h>
+#include <stdint.h>
+
+/*
+    By default the color is packed into the lowest bit of the parent pointer,
+    which shrinks RbNode from 32 to 24 bytes on 64-bit targets.
+    This is safe because RbNode only holds pointers, so its address is always even.
+    Build with RB_TREE_COMPACT_NODE=0 to get back the plain layout.
+*/
+#ifndef RB_TREE_COMPACT_NODE
+#define RB_TREE_COMPACT_NODE 1
+#endif
 
 typedef enum { kBlack, kRed } Color;
 
 typedef struct RbNode {
+#if RB_TREE_COMPACT_NODE
+    uintptr_t parent_color;
+#else
     Color color;
     struct RbNode* parent;
+#endif
     struct RbNode* left;
     struct RbNode* right;
 } RbNode;
@@ -19,38 +34,157 @@ typedef struct RbRoot {
 
 #define InitializedRbRoot { NULL, }
 
+/*
+    RbRoot which also caches the leftmost and rightmost nodes,
+    so peeking or popping the minimum (e.g. the next expiring timer) doesn't walk down the tree.
+    Only modify it through the *Cached functions, otherwise the cache will be stale.
+*/
+typedef struct RbRootCached {
+    RbRoot rb_root;
+    RbNode* rb_leftmost;
+    RbNode* rb_rightmost;
+} RbRootCached;
+
+#define InitializedRbRootCached { InitializedRbRoot, NULL, NULL, }
+
+// Returns a negative number, zero or a positive number when the key of `node` is
+// less than, equal to or greater than `key`, like strcmp.
+typedef int (*RbCompareFunc)(const RbNode* node, const void* key);
+
+// Takes back a node the tree no longer links, e.g. to free its container.
+// `context` is passed through from the caller.
+typedef void (*RbReleaseFunc)(RbNode* node, void* context);
+
+// Same as RbCompareFunc, but compares the keys of two nodes.
+typedef int (*RbNodeCompareFunc)(const RbNode* a, const RbNode* b);
+
+typedef enum {
+    kRbCheckOk,
+    kRbCheckRedRoot,
+    kRbCheckBadParentLink,
+    kRbCheckRedRed,
+    kRbCheckBlackHeight,
+    kRbCheckOutOfOrder,
+} RbCheckResult;
+
+/*
+    Build with RB_TREE_CHECK_INTERVAL=N to validate the tree after every N-th insert or remove
+    (counted over all trees), and abort with a message on the first broken one.
+    Each check is O(n), so the amortized cost is O(n / N) per operation, which is cheap enough
+    for canary builds with a large N. The order of keys isn't checked in this mode.
+*/
+#ifndef RB_TREE_CHECK_INTERVAL
+#define RB_TREE_CHECK_INTERVAL 0
+#endif
+
+/*
+    Build with RB_TREE_LOCKLESS_READERS=1 to write child links and root links with release stores,
+    so a reader walking the tree without locks (see rb-latch-tree.h) never reaches a node before
+    its fields are initialized. Such a reader must load the links with RbReadLink.
+    On x86 both compile to plain moves, but on ARM or POWER every relink pays for a barrier,
+    so by default links are written with plain stores, and rb-latch-tree.c refuses to build.
+    MSVC gives volatile accesses acquire and release semantics under /volatile:ms,
+    which is the default on x86 and x64.
+*/
+#ifndef RB_TREE_LOCKLESS_READERS
+#define RB_TREE_LOCKLESS_READERS 0
+#endif
+
+#if defined(_MSC_VER)
+#define RbReadLink(link) (*(RbNode* const volatile*)&(link))
+#else
+#define RbReadLink(link) __atomic_load_n(&(link), __ATOMIC_ACQUIRE)
+#endif
+
+#if !RB_TREE_LOCKLESS_READERS
+#define RbWriteLink(link, node) ((link) = (node))
+#elif defined(_MSC_VER)
+#define RbWriteLink(link, node) (*(RbNode* volatile*)&(link) = (node))
+#else
+#define RbWriteLink(link, node) __atomic_store_n(&(link), (node), __ATOMIC_RELEASE)
+#endif
+
 #define OffsetOf(type, member) ((uintptr_t)(&((type*)0)->member))
 
 #define ContainerOf(ptr, type, member) ((type*)((uintptr_t)(ptr) - OffsetOf(type, member)))
 
+/*
+    Visits every node of `root` in post-order. `next` is fetched before the body runs,
+    so the body may free or relink `node`, e.g. to destroy the whole tree in O(n)
+    without any rebalancing. Reset `root` afterwards, because it still points to the old root.
+
+    Example:
+        RbNode* node;
+        RbNode* next;
+        RbPostorderForEachSafe(node, next, &root) {
+            free(ContainerOf(node, struct MyEntry, rb_node));
+        }
+        root.rb_node = NULL;
+*/
+#define RbPostorderForEachSafe(node, next, root)                                        \
+    for ((node) = FirstPostorderRbNode(root);                                           \
+         (node) != NULL && ((next) = NextPostorderRbNode(node), true);                  \
+         (node) = (next))
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
-    /* Small utils */
+    /* Accessors of the parent link and color, which hide the node layout. */
+    inline RbNode* GetParent(const RbNode* node) {
+#if RB_TREE_COMPACT_NODE
+        return (RbNode*)(node->parent_color & ~(uintptr_t)1);
+#else
+        return node->parent;
+#endif
+    }
+
+    inline Color GetColor(const RbNode* node) {
+#if RB_TREE_COMPACT_NODE
+        return (Color)(node->parent_color & 1);
+#else
+        return node->color;
+#endif
+    }
+
+    inline void SetParent(RbNode* node, RbNode* parent) {
+#if RB_TREE_COMPACT_NODE
+        node->parent_color = (uintptr_t)parent | (node->parent_color & 1);
+#else
+        node->parent = parent;
+#endif
+    }
+
     inline void SetColor(RbNode* node, Color color) {
+#if RB_TREE_COMPACT_NODE
+        node->parent_color = (node->parent_color & ~(uintptr_t)1) | (uintptr_t)color;
+#else
+        node->color = color;
+#endif
+    }
+
+    inline void SetParentAndColor(RbNode* node, RbNode* parent, Color color) {
+#if RB_TREE_COMPACT_NODE
+        node->parent_color = (uintptr_t)parent | (uintptr_t)color;
+#else
+        node->parent = parent;
         node->color = color;
+#endif
     }
 
+    /* Small utils */
     inline bool IsRed(RbNode* node) {
-        return node != NULL && node->color == kRed;
+        return node != NULL && GetColor(node) == kRed;
     }
 
     inline bool IsBlack(RbNode* node) {
-        return node == NULL || node->color == kBlack;
+        return node == NULL || GetColor(node) == kBlack;
     }
 
     inline bool IsEmptyRbRoot(RbRoot* root) {
         return root->rb_node == NULL;
     }
 
-    inline void Transplant(RbNode* old_node, RbNode* new_node, RbRoot* root);  // Same with CLRS
-
-    /* Rotation function. */
-    inline void RotateLeft(RbNode* x, RbRoot* root);
-
-    inline void RotateRight(RbNode* x, RbRoot* root);
-
     /* Insert implementation */
     void FixupAfterInsert(RbNode* node, RbRoot* root);
 
@@ -61,6 +195,111 @@ extern "C" {
 
     void RemoveFromRbTree(RbNode* node, RbRoot* root);
 
+    /*
+        Puts `new_node` in the place of `victim` in O(1), taking over its color and links.
+        No comparison nor rebalancing is done, so the key of `new_node` must keep the order
+        with the neighbors of `victim`. `victim` is left dangling.
+        Augmented metadata isn't copied, copy it along with the key if needed.
+    */
+    void ReplaceRbNode(RbNode* victim, RbNode* new_node, RbRoot* root);
+
+    /*
+        Bulk construction.
+        `entries` holds pointers to the containers of the nodes, already sorted,
+        and `node_offset` is the offset of RbNode in the container (see OffsetOf).
+        The nodes are linked into a legal rb-tree in O(n) without any rotation,
+        and the old content of `root` is discarded.
+    */
+    void BuildRbTreeFromSorted(void* const* entries, size_t entry_num, size_t node_offset, RbRoot* root);
+
+    /*
+        Copies every entry of the tree into `buffer`, which must hold all of them `entry_size` bytes apart,
+        in an order where a descent touches few cache lines and pages, and relinks the copies.
+        Returns the number of entries. The old entries are left unlinked and their nodes overwritten,
+        so only free them (e.g. collect them before). Pointers to the old entries must not be used anymore.
+        Augmented metadata is copied along with the entries, but the cache of RbRootCached isn't updated.
+    */
+    size_t RelayoutRbTree(RbRoot* root, void* buffer, size_t entry_size, size_t node_offset);
+
+    /* In-order iteration. Walking the whole tree with NextRbNode costs O(n) in total. */
+    RbNode* FirstRbNode(const RbRoot* root);
+
+    RbNode* LastRbNode(const RbRoot* root);
+
+    RbNode* NextRbNode(const RbNode* node);
+
+    RbNode* PrevRbNode(const RbNode* node);
+
+    /*
+        Post-order iteration, children before their parent. Like the in-order one,
+        it only follows the parent links, so it needs no stack even on very deep trees.
+        NextPostorderRbNode never reads the children of `node` again,
+        but it does read `node` itself, so use RbPostorderForEachSafe to free nodes on the way.
+    */
+    RbNode* FirstPostorderRbNode(const RbRoot* root);
+
+    RbNode* NextPostorderRbNode(const RbNode* node);
+
+    /*
+        Join and split work on black heights, and only touch O(log n) nodes.
+        They don't maintain the metadata of augmented trees, nor the cache of RbRootCached.
+        The output trees may be the same as the input ones.
+    */
+    // Links `left`, `pivot` and `right` into `root`, and empties `left` and `right`.
+    // No node in `left` may be greater than `pivot`, and no node in `right` may be less than it.
+    void JoinRbTree(RbRoot* left, RbNode* pivot, RbRoot* right, RbRoot* root);
+
+    // Same as JoinRbTree, but without a pivot.
+    void ConcatRbTree(RbRoot* left, RbRoot* right, RbRoot* root);
+
+    // Moves the nodes less than `key` into `less`, and the others into `not_less`.
+    void SplitRbTree(RbRoot* root, RbCompareFunc compare, const void* key, RbRoot* less, RbRoot* not_less);
+
+    /*
+        Unlinks the nodes in [lo, hi) and passes each of them to `release` (if not NULL),
+        children before parents, so `release` may free them. Returns the number of them.
+        Two splits cut the range out and a concat closes the gap, so the tree is rebalanced
+        once in O(log n), and the whole purge costs O(k + log n) for k nodes.
+        The first few nodes are removed one by one, which is cheaper for short ranges.
+    */
+    size_t EraseRangeFromRbTree(
+        RbRoot* root, RbCompareFunc compare, const void* lo, const void* hi,
+        RbReleaseFunc release, void* context
+    );
+
+    /*
+        Validation in O(n) time and O(1) space, without recursion.
+        Checks the parent links, the black root, red-red violations, the black height
+        and, if `compare` isn't NULL, that the keys are in non-descending order.
+        On failure, the node where the problem is found is stored into `bad_node` (if not NULL).
+    */
+    RbCheckResult CheckRbTree(const RbRoot* root, RbNodeCompareFunc compare, const RbNode** bad_node);
+
+    const char* DescribeRbCheckResult(RbCheckResult result);
+
+    /* Implementation with cached leftmost and rightmost nodes */
+    void InsertIntoRbTreeCached(RbNode* node, RbNode* parent, RbNode** parent_link, RbRootCached* root);
+
+    void RemoveFromRbTreeCached(RbNode* node, RbRootCached* root);
+
+    void ReplaceRbNodeCached(RbNode* victim, RbNode* new_node, RbRootCached* root);
+
+    size_t EraseRangeFromRbTreeCached(
+        RbRootCached* root, RbCompareFunc compare, const void* lo, const void* hi,
+        RbReleaseFunc release, void* context
+    );
+
+    inline RbNode* PeekMinInRbTreeCached(const RbRootCached* root) {
+        return root->rb_leftmost;
+    }
+
+    inline RbNode* PeekMaxInRbTreeCached(const RbRootCached* root) {
+        return root->rb_rightmost;
+    }
+
+    // Removes the leftmost node and returns it, or returns NULL if the tree is empty.
+    RbNode* PopMinFromRbTreeCached(RbRootCached* root);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,119 @@
+#ifndef WORK_STEALING_POOL_H_
+#define WORK_STEALING_POOL_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+/*
+    Fork-join thread pool for divide and conquer, e.g. the set operations in rb-tree-set-ops.h.
+
+    Invoke(left, right) queues `right` on the deque of the calling worker, runs `left` itself,
+    then takes `right` back and runs it too, unless an idle worker has stolen it meanwhile.
+    A worker takes its own tasks from the back (the newest and smallest ones, still warm in its cache)
+    and steals from the front of the others (the oldest and largest ones), so a steal is rare
+    and brings a big piece of work. A worker waiting for a stolen task runs other tasks meanwhile.
+
+    The calling thread counts as one of the `thread_num` workers. Invoke may be called from
+    threads outside the pool (including the workers of another pool), but such calls are serialized.
+*/
+class WorkStealingPool {
+public:
+    // Starts `thread_num - 1` threads, or one per hardware thread if 0.
+    explicit WorkStealingPool(int thread_num = 0);
+
+    // No task may be running.
+    ~WorkStealingPool();
+
+    WorkStealingPool(const WorkStealingPool&) = delete;
+    WorkStealingPool& operator=(const WorkStealingPool&) = delete;
+
+    int GetThreadNum() const { return static_cast<int>(workers_.size()); }
+
+    // Runs `left()` and `right()`, maybe in parallel, and returns when both are done.
+    template <typename Left, typename Right>
+    void Invoke(Left&& left, Right&& right) {
+        WorkerSlot& slot = CurrentWorkerSlot();
+        if (slot.pool != this) {
+            // Called from outside the pool: take the place of worker 0 for the whole call.
+            std::lock_guard<std::mutex> lock(external_mutex_);
+            WorkerSlot previous = slot;
+            slot = { this, workers_[0].get() };
+            Invoke(left, right);
+            slot = previous;
+            return;
+        }
+        Worker* worker = slot.worker;
+        Task task(&RunCallable<typename std::remove_reference<Right>::type>, &right);
+        Push(worker, &task);
+        left();
+        if (PopIfLast(worker, &task)) {
+            task.Run();
+        } else {
+            WaitFor(&task);
+        }
+    }
+
+private:
+    struct Task {
+        Task(void (*task_run)(void*), void* task_arg) : run(task_run), arg(task_arg), done(false) {}
+
+        // The owner may destroy the task as soon as `done` is set, so it's the last access.
+        void Run() {
+            run(arg);
+            done.store(true, std::memory_order_release);
+        }
+
+        void (*run)(void*);
+        void* arg;
+        std::atomic<bool> done;
+    };
+
+    struct Worker {
+        std::mutex mutex;
+        std::deque<Task*> tasks;
+    };
+
+    template <typename Callable>
+    static void RunCallable(void* callable) {
+        (*static_cast<Callable*>(callable))();
+    }
+
+    // The pool and the worker the current thread runs as, if any.
+    struct WorkerSlot {
+        const WorkStealingPool* pool;
+        Worker* worker;
+    };
+
+    static WorkerSlot& CurrentWorkerSlot();
+
+    void Push(Worker* worker, Task* task);
+
+    // Takes `task` back if it's still at the back of the deque of `worker`, i.e. nobody stole it.
+    bool PopIfLast(Worker* worker, Task* task);
+
+    // Takes a task from the back of the deque of `worker`, or else from the front of another one.
+    Task* Take(Worker* worker);
+
+    void WaitFor(Task* task);
+
+    void RunWorker(int index);
+
+    std::vector<std::unique_ptr<Worker>> workers_;
+    std::vector<std::thread> threads_;
+    std::mutex external_mutex_;
+
+    // Idle workers sleep until a task is queued.
+    std::mutex idle_mutex_;
+    std::condition_variable idle_cv_;
+    std::atomic<int> queued_num_;
+    std::atomic<int> sleeping_num_;
+    bool stopping_;
+};
+
+#endif  // WORK_STEALING_POOL_H_
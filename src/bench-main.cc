@@ -0,0 +1,469 @@
+/*
+    Benchmark suite of the rb-tree, side by side with std::map and std::set.
+
+    Usage: MyRbTreeBench [--seed=N] [--sizes=1000,1000000,...] [--max-size=N] [--micro]
+        --seed      seed of all workloads, so runs are reproducible (default 42).
+        --sizes     element counts to run, default 1K, 10K, 100K and 1M.
+        --max-size  use the sizes 1K, 10K, ... up to N instead, e.g. --max-size=100000000.
+        --micro     also run the micro benchmarks in rb-tree-bench.cc.
+
+    Every workload prints one line per container:
+        workload size container ops/s p50 p99 p999 bytes/element
+    The latencies (in ns) are sampled on up to kMaxLatencySamples evenly spaced operations.
+    bytes/element counts the memory requested from the allocator, not the malloc headers.
+    Built with RB_TREE_STATS=1, the rebalancing statistics of the rb-tree are printed per size.
+*/
+#include <string.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <random>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "include/rb-tree.h"
+#include "include/rb-tree-stats.h"
+#include "include/my-rb-tree.h"
+#include "include/node-pool.h"
+#include "include/intrusive-rb-tree.h"
+#include "include/rb-tree-bench.h"
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+constexpr size_t kMaxLatencySamples = 1 << 20;
+
+/* Key generation */
+
+// Bijection over 32-bit integers, so the keys of 0..n-1 are unique but scattered.
+int ScrambleKey(uint32_t i) {
+    i ^= i >> 16;
+    i *= 0x7feb352dU;
+    i ^= i >> 15;
+    i *= 0x846ca68bU;
+    i ^= i >> 16;
+    return static_cast<int>(i);
+}
+
+// Zipfian ranks in [0, n) with theta = 0.99, same as YCSB (Gray et al., "Quickly generating
+// billion-record synthetic databases"). Rank 0 is the hottest.
+class ZipfGenerator {
+public:
+    ZipfGenerator(uint64_t n, double theta = 0.99) : n_(n), theta_(theta), dis_(0.0, 1.0) {
+        zetan_ = 0;
+        for (uint64_t i = 1; i <= n; ++i) {
+            zetan_ += 1.0 / std::pow(static_cast<double>(i), theta);
+        }
+        double zeta2 = 1.0 + 1.0 / std::pow(2.0, theta);
+        alpha_ = 1.0 / (1.0 - theta);
+        eta_ = (1.0 - std::pow(2.0 / n, 1.0 - theta)) / (1.0 - zeta2 / zetan_);
+    }
+
+    uint64_t operator()(std::mt19937_64& gen) {
+        double u = dis_(gen);
+        double uz = u * zetan_;
+        if (uz < 1.0) return 0;
+        if (uz < 1.0 + std::pow(0.5, theta_)) return 1;
+        uint64_t rank = static_cast<uint64_t>(n_ * std::pow(eta_ * u - eta_ + 1.0, alpha_));
+        return rank < n_ ? rank : n_ - 1;
+    }
+
+private:
+    uint64_t n_;
+    double theta_;
+    double zetan_;
+    double alpha_;
+    double eta_;
+    std::uniform_real_distribution<double> dis_;
+};
+
+/* Containers under test, all keyed by int */
+
+struct MyDataValue {
+    int operator()(const MyData& data) const { return data.value; }
+};
+
+class TreeAdapter {
+public:
+    static const char* Name() { return "rb-tree"; }
+
+    TreeAdapter() : pool_(CreateNodePool(sizeof(MyData))) {}
+    ~TreeAdapter() {
+        tree_.clear();
+        DestroyNodePool(pool_);
+    }
+
+    bool Insert(int key) {
+        return tree_.find_or_insert(key, [this, key]() {
+            MyData* data = static_cast<MyData*>(AllocFromNodePool(pool_));
+            data->value = key;
+            return data;
+        }).second;
+    }
+
+    bool Find(int key) const { return tree_.contains(key); }
+
+    bool Erase(int key) {
+        auto it = tree_.find(key);
+        if (it == tree_.end()) {
+            return false;
+        }
+        MyData* data = &*it;
+        tree_.erase(data);
+        FreeToNodePool(pool_, data);
+        return true;
+    }
+
+    size_t Size() const { return tree_.size(); }
+    double BytesPerElement() const { return static_cast<double>(GetNodePoolSlotSize(pool_)); }
+
+private:
+    NodePool* pool_;
+    IntrusiveRbTree<MyData, &MyData::rb_node, MyDataValue> tree_;
+};
+
+// Counts the bytes requested by the std containers.
+size_t g_allocated_bytes = 0;
+
+template <typename T>
+struct CountingAllocator {
+    using value_type = T;
+    CountingAllocator() = default;
+    template <typename U>
+    CountingAllocator(const CountingAllocator<U>&) {}
+
+    T* allocate(size_t n) {
+        g_allocated_bytes += n * sizeof(T);
+        return static_cast<T*>(::operator new(n * sizeof(T)));
+    }
+    void deallocate(T* p, size_t n) {
+        g_allocated_bytes -= n * sizeof(T);
+        ::operator delete(p);
+    }
+    template <typename U>
+    bool operator==(const CountingAllocator<U>&) const { return true; }
+    template <typename U>
+    bool operator!=(const CountingAllocator<U>&) const { return false; }
+};
+
+class SetAdapter {
+public:
+    static const char* Name() { return "std::set"; }
+
+    bool Insert(int key) { return set_.insert(key).second; }
+    bool Find(int key) const { return set_.find(key) != set_.end(); }
+    bool Erase(int key) { return set_.erase(key) > 0; }
+    size_t Size() const { return set_.size(); }
+    double BytesPerElement() const {
+        return set_.empty() ? 0 : static_cast<double>(g_allocated_bytes) / set_.size();
+    }
+
+private:
+    std::set<int, std::less<int>, CountingAllocator<int>> set_;
+};
+
+class MapAdapter {
+public:
+    static const char* Name() { return "std::map"; }
+
+    bool Insert(int key) { return map_.emplace(key, key).second; }
+    bool Find(int key) const { return map_.find(key) != map_.end(); }
+    bool Erase(int key) { return map_.erase(key) > 0; }
+    size_t Size() const { return map_.size(); }
+    double BytesPerElement() const {
+        return map_.empty() ? 0 : static_cast<double>(g_allocated_bytes) / map_.size();
+    }
+
+private:
+    std::map<int, int, std::less<int>, CountingAllocator<std::pair<const int, int>>> map_;
+};
+
+/* Measurement */
+
+struct BenchResult {
+    double ops_per_second;
+    double p50;
+    double p99;
+    double p999;
+};
+
+// Runs `op(i)` for i in [0, op_num), timing the whole run and every `stride`-th operation.
+template <typename Op>
+BenchResult Measure(size_t op_num, Op&& op) {
+    size_t stride = op_num / kMaxLatencySamples + 1;
+    std::vector<double> samples;
+    samples.reserve(op_num / stride + 1);
+
+    auto start = Clock::now();
+    for (size_t i = 0; i < op_num; ++i) {
+        if (i % stride == 0) {
+            auto op_start = Clock::now();
+            op(i);
+            samples.push_back(std::chrono::duration<double, std::nano>(Clock::now() - op_start).count());
+        } else {
+            op(i);
+        }
+    }
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+    BenchResult result = { op_num / seconds, 0, 0, 0 };
+    auto percentile = [&samples](double p) {
+        size_t index = std::min(samples.size() - 1, static_cast<size_t>(p * samples.size()));
+        std::nth_element(samples.begin(), samples.begin() + index, samples.end());
+        return samples[index];
+    };
+    if (!samples.empty()) {
+        result.p50 = percentile(0.50);
+        result.p99 = percentile(0.99);
+        result.p999 = percentile(0.999);
+    }
+    return result;
+}
+
+void Report(const char* workload, size_t size, const char* container, const BenchResult& result,
+            double bytes_per_element) {
+    printf("%-18s %10zu %-9s %8.2fMops/s p50=%7.0fns p99=%7.0fns p999=%8.0fns %6.1fB/elem\n",
+           workload, size, container, result.ops_per_second / 1e6,
+           result.p50, result.p99, result.p999, bytes_per_element);
+    fflush(stdout);
+}
+
+/* Workloads */
+
+struct Workload {
+    uint64_t seed;
+    size_t size;
+    std::vector<int> keys;  // `size` unique keys in random order.
+};
+
+template <typename Container>
+void FillContainer(Container* container, const std::vector<int>& keys) {
+    for (int key : keys) {
+        container->Insert(key);
+    }
+}
+
+template <typename Container>
+void RunInsertWorkloads(const Workload& workload) {
+    size_t n = workload.size;
+    {
+        Container container;
+        BenchResult result = Measure(n, [&](size_t i) { container.Insert(static_cast<int>(i)); });
+        Report("insert-sequential", n, Container::Name(), result, container.BytesPerElement());
+    }
+    {
+        Container container;
+        BenchResult result = Measure(n, [&](size_t i) { container.Insert(workload.keys[i]); });
+        Report("insert-random", n, Container::Name(), result, container.BytesPerElement());
+    }
+    {
+        // Hot keys repeat, so most operations find the key already present.
+        std::mt19937_64 gen(workload.seed);
+        ZipfGenerator zipf(n);
+        std::vector<int> keys(n);
+        for (int& key : keys) {
+            key = ScrambleKey(static_cast<uint32_t>(zipf(gen)));
+        }
+        Container container;
+        BenchResult result = Measure(n, [&](size_t i) { container.Insert(keys[i]); });
+        Report("insert-zipf", n, Container::Name(), result, container.BytesPerElement());
+    }
+}
+
+template <typename Container>
+void RunLookupWorkloads(const Workload& workload) {
+    size_t n = workload.size;
+    Container container;
+    FillContainer(&container, workload.keys);
+
+    std::mt19937_64 gen(workload.seed + 1);
+    std::vector<int> random_keys(n);
+    for (int& key : random_keys) {
+        key = workload.keys[gen() % n];
+    }
+    size_t found = 0;
+    BenchResult result = Measure(n, [&](size_t i) { found += container.Find(random_keys[i]); });
+    Report("lookup-random", n, Container::Name(), result, container.BytesPerElement());
+
+    ZipfGenerator zipf(n);
+    std::vector<int> hot_keys(n);
+    for (int& key : hot_keys) {
+        key = workload.keys[zipf(gen)];
+    }
+    result = Measure(n, [&](size_t i) { found += container.Find(hot_keys[i]); });
+    Report("lookup-hot", n, Container::Name(), result, container.BytesPerElement());
+
+    if (found != 2 * n) {
+        printf("error: %s found %zu of %zu keys\n", Container::Name(), found, 2 * n);
+    }
+}
+
+template <typename Container>
+void RunEraseWorkloads(const Workload& workload) {
+    size_t n = workload.size;
+    const std::vector<int>& keys = workload.keys;
+    {
+        Container container;
+        FillContainer(&container, keys);
+        double bytes_per_element = container.BytesPerElement();
+        BenchResult result = Measure(n, [&](size_t i) { container.Erase(keys[i]); });
+        Report("erase-fifo", n, Container::Name(), result, bytes_per_element);
+    }
+    {
+        Container container;
+        FillContainer(&container, keys);
+        double bytes_per_element = container.BytesPerElement();
+        BenchResult result = Measure(n, [&](size_t i) { container.Erase(keys[n - 1 - i]); });
+        Report("erase-lifo", n, Container::Name(), result, bytes_per_element);
+    }
+    {
+        std::vector<int> shuffled = keys;
+        std::shuffle(shuffled.begin(), shuffled.end(), std::mt19937_64(workload.seed + 2));
+        Container container;
+        FillContainer(&container, keys);
+        double bytes_per_element = container.BytesPerElement();
+        BenchResult result = Measure(n, [&](size_t i) { container.Erase(shuffled[i]); });
+        Report("erase-random", n, Container::Name(), result, bytes_per_element);
+    }
+}
+
+// Lookups of live keys mixed with inserts of new keys and erases of random live keys,
+// keeping the size around n.
+template <typename Container>
+void RunMixedWorkload(const Workload& workload, int read_percent) {
+    size_t n = workload.size;
+    Container container;
+    FillContainer(&container, workload.keys);
+    std::vector<int> live_keys = workload.keys;
+
+    std::mt19937_64 gen(workload.seed + 3 + read_percent);
+    uint32_t next_key = static_cast<uint32_t>(n);
+    BenchResult result = Measure(n, [&](size_t i) {
+        uint64_t r = gen();
+        size_t index = static_cast<size_t>(r >> 32) % live_keys.size();
+        if (static_cast<int>(r % 100) < read_percent) {
+            container.Find(live_keys[index]);
+        } else if (i % 2 == 0) {
+            int key = ScrambleKey(next_key++);
+            container.Insert(key);
+            live_keys.push_back(key);
+        } else {
+            container.Erase(live_keys[index]);
+            live_keys[index] = live_keys.back();
+            live_keys.pop_back();
+        }
+    });
+    char name[32];
+    snprintf(name, sizeof(name), "mixed-%d/%d", read_percent, 100 - read_percent);
+    Report(name, n, Container::Name(), result, container.BytesPerElement());
+}
+
+template <typename Container>
+void RunAllWorkloads(const Workload& workload) {
+    RunInsertWorkloads<Container>(workload);
+    RunLookupWorkloads<Container>(workload);
+    RunEraseWorkloads<Container>(workload);
+    RunMixedWorkload<Container>(workload, 95);
+    RunMixedWorkload<Container>(workload, 50);
+}
+
+#if RB_TREE_STATS
+// Prints the mean and the largest non-empty bucket of a histogram in RbTreeStats.
+void PrintHistogram(const char* name, const uint64_t* histogram) {
+    uint64_t count = 0;
+    uint64_t sum = 0;
+    int max = 0;
+    for (int i = 0; i < kRbStatsHistogramSize; ++i) {
+        count += histogram[i];
+        sum += histogram[i] * i;
+        if (histogram[i] > 0) max = i;
+    }
+    printf("  %-18s count=%llu mean=%.2f max=%d\n", name, static_cast<unsigned long long>(count),
+           count ? static_cast<double>(sum) / count : 0.0, max);
+}
+
+void PrintRbTreeStats() {
+    RbTreeStats stats;
+    GetRbTreeStats(&stats);
+    printf("  rotate-left=%llu rotate-right=%llu\n",
+           static_cast<unsigned long long>(stats.rotate_left), static_cast<unsigned long long>(stats.rotate_right));
+    printf("  insert-cases=%llu/%llu/%llu remove-cases=%llu/%llu/%llu/%llu\n",
+           static_cast<unsigned long long>(stats.insert_cases[0]), static_cast<unsigned long long>(stats.insert_cases[1]),
+           static_cast<unsigned long long>(stats.insert_cases[2]), static_cast<unsigned long long>(stats.remove_cases[0]),
+           static_cast<unsigned long long>(stats.remove_cases[1]), static_cast<unsigned long long>(stats.remove_cases[2]),
+           static_cast<unsigned long long>(stats.remove_cases[3]));
+    PrintHistogram("insert-fixup-loops", stats.insert_fixup_loops);
+    PrintHistogram("remove-fixup-loops", stats.remove_fixup_loops);
+    PrintHistogram("search-depth", stats.search_depth);
+}
+#endif
+
+std::vector<size_t> ParseSizes(const char* text) {
+    std::vector<size_t> sizes;
+    while (*text) {
+        char* end = nullptr;
+        sizes.push_back(strtoull(text, &end, 10));
+        text = *end == ',' ? end + 1 : end;
+        if (end == text && *end != '\0') break;
+    }
+    return sizes;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+    uint64_t seed = 42;
+    std::vector<size_t> sizes = { 1000, 10000, 100000, 1000000 };
+    bool micro = false;
+    for (int i = 1; i < argc; ++i) {
+        if (strncmp(argv[i], "--seed=", 7) == 0) {
+            seed = strtoull(argv[i] + 7, nullptr, 10);
+        } else if (strncmp(argv[i], "--sizes=", 8) == 0) {
+            sizes = ParseSizes(argv[i] + 8);
+        } else if (strncmp(argv[i], "--max-size=", 11) == 0) {
+            size_t max_size = strtoull(argv[i] + 11, nullptr, 10);
+            sizes.clear();
+            for (size_t size = 1000; size <= max_size; size *= 10) {
+                sizes.push_back(size);
+            }
+        } else if (strcmp(argv[i], "--micro") == 0) {
+            micro = true;
+        } else {
+            fprintf(stderr, "Usage: %s [--seed=N] [--sizes=N,...] [--max-size=N] [--micro]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    printf("seed=%llu\n", static_cast<unsigned long long>(seed));
+    for (size_t size : sizes) {
+        if (size == 0 || size > UINT32_MAX) {
+            continue;
+        }
+        Workload workload;
+        workload.seed = seed;
+        workload.size = size;
+        workload.keys.resize(size);
+        for (size_t i = 0; i < size; ++i) {
+            workload.keys[i] = ScrambleKey(static_cast<uint32_t>(i));
+        }
+        ResetRbTreeStats();
+        RunAllWorkloads<TreeAdapter>(workload);
+#if RB_TREE_STATS
+        PrintRbTreeStats();
+#endif
+        RunAllWorkloads<SetAdapter>(workload);
+        RunAllWorkloads<MapAdapter>(workload);
+    }
+
+    if (micro) {
+        RunRbTreeBenchmarks();
+    }
+    return 0;
+}
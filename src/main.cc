@@ -7,7 +7,25 @@
 
 #include "include/rb-tree.h"
 #include "include/my-rb-tree.h"
+#include "include/rb-tree-tester.h"
 
 int main() {
-    std::cout << RbTreeTesterAuto() << std::endl;
+    bool passed = RbTreeTesterAuto();
+    passed = RbTreeTesterIntervals() && passed;
+    passed = RbTreeTesterJoinAndSplit() && passed;
+    passed = RbTreeTesterNodePool() && passed;
+    passed = RbTreeTesterEraseRange() && passed;
+    passed = RbTreeTesterLatchTree() && passed;
+    passed = RbTreeTesterShardedTree() && passed;
+    passed = RbTreeTesterSnapshot() && passed;
+    passed = RbTreeTesterPersistentTree() && passed;
+    passed = RbTreeTesterBucketTree() && passed;
+    passed = RbTreeTesterSetOps() && passed;
+    passed = RbTreeTesterBounds() && passed;
+    passed = RbTreeTesterRankedTree() && passed;
+    passed = RbTreeTesterIntrusiveTree() && passed;
+    passed = RbTreeTesterCheck() && passed;
+    passed = RbTreeTesterHintedInsert() && passed;
+    passed = RbTreeTesterCompaction() && passed;
+    std::cout << passed << std::endl;
 }
\ No newline at end of file
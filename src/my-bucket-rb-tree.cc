@@ -0,0 +1,234 @@
+#include "include/my-bucket-rb-tree.h"
+
+#include <cstring>
+#include <cassert>
+
+#if MY_BUCKET_SIMD && defined(__AVX2__)
+#include <immintrin.h>
+#define MY_BUCKET_AVX2 1
+#elif MY_BUCKET_SIMD && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#include <emmintrin.h>
+#define MY_BUCKET_SSE2 1
+#endif
+
+namespace {
+
+// A drained bucket only merges into a neighbor if both fit in this many keys,
+// so the merged bucket can take a few inserts before it splits again.
+constexpr int kMergedBucketMax = kMyBucketCapacity * 3 / 4;
+
+static_assert(kMyBucketCapacity == 16, "The SIMD searches compare exactly 16 keys");
+
+int CompareBuckets(const RbNode* a, const RbNode* b) {
+    int32_t a_lower = ContainerOf(a, struct MyBucket, rb_node)->lower;
+    int32_t b_lower = ContainerOf(b, struct MyBucket, rb_node)->lower;
+    return a_lower < b_lower ? -1 : (a_lower > b_lower ? 1 : 0);
+}
+
+void SetKeys(MyBucket* bucket, int from, int to, int32_t key) {
+    for (int i = from; i < to; ++i) {
+        bucket->keys[i] = key;
+    }
+}
+
+}  // namespace
+
+/*
+    The keys are sorted and padded with INT32_MAX, so the keys less than `value` are a prefix of the slots,
+    and counting them over all 16 slots gives the lower bound without any branch or loop.
+    Each compare yields -1 per key less than `value`, and the lanes are summed up.
+*/
+int MyLowerBoundInBucket(const MyBucket* bucket, int value) {
+#if MY_BUCKET_AVX2
+    __m256i needle = _mm256_set1_epi32(value);
+    __m256i low = _mm256_cmpgt_epi32(needle, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(bucket->keys)));
+    __m256i high = _mm256_cmpgt_epi32(needle, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(bucket->keys + 8)));
+    __m256i sum256 = _mm256_add_epi32(low, high);
+    __m128i sum = _mm_add_epi32(_mm256_castsi256_si128(sum256), _mm256_extracti128_si256(sum256, 1));
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(1, 0, 3, 2)));
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(2, 3, 0, 1)));
+    return -_mm_cvtsi128_si32(sum);
+#elif MY_BUCKET_SSE2
+    const __m128i* keys = reinterpret_cast<const __m128i*>(bucket->keys);
+    __m128i needle = _mm_set1_epi32(value);
+    __m128i sum = _mm_add_epi32(
+        _mm_add_epi32(_mm_cmpgt_epi32(needle, _mm_loadu_si128(keys)), _mm_cmpgt_epi32(needle, _mm_loadu_si128(keys + 1))),
+        _mm_add_epi32(_mm_cmpgt_epi32(needle, _mm_loadu_si128(keys + 2)), _mm_cmpgt_epi32(needle, _mm_loadu_si128(keys + 3))));
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(1, 0, 3, 2)));
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(2, 3, 0, 1)));
+    return -_mm_cvtsi128_si32(sum);
+#else
+    int count = 0;
+    for (int i = 0; i < kMyBucketCapacity; ++i) {
+        count += bucket->keys[i] < value;
+    }
+    return count;
+#endif
+}
+
+MyBucketRbTree::MyBucketRbTree()
+    : root_(InitializedRbRoot), pool_(CreateNodePool(sizeof(MyBucket))), size_(0), bucket_num_(0) {}
+
+MyBucketRbTree::~MyBucketRbTree() {
+    DestroyNodePool(pool_);
+}
+
+MyBucket* MyBucketRbTree::FindBucket(int value) const {
+    MyBucket* found = nullptr;
+    RbNode* node = root_.rb_node;
+    while (node != nullptr) {
+        MyBucket* bucket = ToBucket(node);
+        if (bucket->lower <= value) {
+            found = bucket;
+            node = node->right;
+        } else {
+            node = node->left;
+        }
+    }
+    return found != nullptr ? found : ToBucket(FirstRbNode(&root_));
+}
+
+MyBucket* MyBucketRbTree::NewBucketAfter(MyBucket* prev) {
+    assert(prev != nullptr || IsEmptyRbRoot(&root_));
+    MyBucket* bucket = static_cast<MyBucket*>(AllocFromNodePool(pool_));
+    bucket->lower = INT32_MAX;
+    bucket->count = 0;
+    SetKeys(bucket, 0, kMyBucketCapacity, INT32_MAX);
+
+    // Link it as the leftmost node of the right subtree of `prev`, or as its right child.
+    RbNode* parent = nullptr;
+    RbNode** link = &root_.rb_node;
+    if (prev != nullptr) {
+        parent = &prev->rb_node;
+        link = &parent->right;
+        while (*link != nullptr) {
+            parent = *link;
+            link = &parent->left;
+        }
+    }
+    InsertIntoRbTree(&bucket->rb_node, parent, link, &root_);
+    ++bucket_num_;
+    return bucket;
+}
+
+void MyBucketRbTree::DeleteBucket(MyBucket* bucket) {
+    RemoveFromRbTree(&bucket->rb_node, &root_);
+    FreeToNodePool(pool_, bucket);
+    --bucket_num_;
+}
+
+MyBucket* MyBucketRbTree::SplitBucket(MyBucket* bucket) {
+    assert(bucket->count == kMyBucketCapacity);
+    constexpr int kHalf = kMyBucketCapacity / 2;
+    MyBucket* upper = NewBucketAfter(bucket);
+    memcpy(upper->keys, bucket->keys + kHalf, (kMyBucketCapacity - kHalf) * sizeof(int32_t));
+    upper->count = kMyBucketCapacity - kHalf;
+    upper->lower = upper->keys[0];
+    SetKeys(bucket, kHalf, kMyBucketCapacity, INT32_MAX);
+    bucket->count = kHalf;
+    return upper;
+}
+
+void MyBucketRbTree::MaybeMergeBucket(MyBucket* bucket) {
+    MyBucket* next = NextBucket(bucket);
+    MyBucket* prev = PrevBucket(bucket);
+    if (next != nullptr && bucket->count + next->count <= kMergedBucketMax) {
+        memcpy(bucket->keys + bucket->count, next->keys, next->count * sizeof(int32_t));
+        bucket->count += next->count;
+        bucket->lower = bucket->keys[0];
+        DeleteBucket(next);
+    } else if (prev != nullptr && prev->count + bucket->count <= kMergedBucketMax) {
+        memcpy(prev->keys + prev->count, bucket->keys, bucket->count * sizeof(int32_t));
+        prev->count += bucket->count;
+        DeleteBucket(bucket);
+    } else if (bucket->count == 0) {
+        DeleteBucket(bucket);
+    }
+}
+
+bool MyBucketRbTree::Insert(int value) {
+    MyBucket* bucket = FindBucket(value);
+    if (bucket == nullptr) {
+        bucket = NewBucketAfter(nullptr);
+    }
+    int index = MyLowerBoundInBucket(bucket, value);
+    if (index < bucket->count && bucket->keys[index] == value) {
+        return false;
+    }
+    if (bucket->count == kMyBucketCapacity) {
+        if (index == kMyBucketCapacity && NextBucket(bucket) == nullptr) {
+            // Appending to the last bucket starts a new one instead, so ascending inserts fill up every bucket.
+            bucket = NewBucketAfter(bucket);
+            index = 0;
+        } else {
+            MyBucket* upper = SplitBucket(bucket);
+            if (index > bucket->count) {
+                index -= bucket->count;
+                bucket = upper;
+            }
+        }
+    }
+    memmove(bucket->keys + index + 1, bucket->keys + index, (bucket->count - index) * sizeof(int32_t));
+    bucket->keys[index] = value;
+    ++bucket->count;
+    // Only changes for a value below every other one, which goes to the first bucket.
+    bucket->lower = bucket->keys[0];
+    ++size_;
+    return true;
+}
+
+bool MyBucketRbTree::Remove(int value) {
+    MyBucket* bucket = FindBucket(value);
+    if (bucket == nullptr) {
+        return false;
+    }
+    int index = MyLowerBoundInBucket(bucket, value);
+    if (index == bucket->count || bucket->keys[index] != value) {
+        return false;
+    }
+    memmove(bucket->keys + index, bucket->keys + index + 1, (bucket->count - index - 1) * sizeof(int32_t));
+    bucket->keys[--bucket->count] = INT32_MAX;
+    // Still greater than the values of the previous bucket, so the order holds.
+    bucket->lower = bucket->keys[0];
+    --size_;
+    if (bucket->count <= kMyBucketCapacity / 4) {
+        MaybeMergeBucket(bucket);
+    }
+    return true;
+}
+
+bool MyBucketRbTree::Contains(int value) const {
+    const MyBucket* bucket = FindBucket(value);
+    if (bucket == nullptr) {
+        return false;
+    }
+    int index = MyLowerBoundInBucket(bucket, value);
+    return index < bucket->count && bucket->keys[index] == value;
+}
+
+bool MyBucketRbTree::Check() const {
+    if (CheckRbTree(&root_, CompareBuckets, nullptr) != kRbCheckOk) {
+        return false;
+    }
+    size_t size = 0;
+    size_t bucket_num = 0;
+    const MyBucket* prev = nullptr;
+    for (const MyBucket* bucket = ToBucket(FirstRbNode(&root_)); bucket != nullptr; bucket = NextBucket(bucket)) {
+        if (bucket->count <= 0 || bucket->count > kMyBucketCapacity || bucket->lower != bucket->keys[0]) {
+            return false;
+        }
+        if (prev != nullptr && prev->keys[prev->count - 1] >= bucket->lower) {
+            return false;
+        }
+        for (int i = 1; i < kMyBucketCapacity; ++i) {
+            bool is_padding = i >= bucket->count;
+            if (is_padding ? bucket->keys[i] != INT32_MAX : bucket->keys[i - 1] >= bucket->keys[i]) {
+                return false;
+            }
+        }
+        size += bucket->count;
+        ++bucket_num;
+        prev = bucket;
+    }
+    return size == size_ && bucket_num == bucket_num_;
+}
@@ -0,0 +1,106 @@
+#include "include/my-interval-tree.h"
+
+#include <cassert>
+
+#include "include/rb-tree-augmented.h"
+
+static MyInterval* ToInterval(RbNode* node) {
+    return node ? ContainerOf(node, struct MyInterval, rb_node) : nullptr;
+}
+
+static int64_t ComputeMaxEnd(MyInterval* interval) {
+    int64_t max_end = interval->end;
+    MyInterval* left = ToInterval(interval->rb_node.left);
+    MyInterval* right = ToInterval(interval->rb_node.right);
+    if (left && left->subtree_max_end > max_end) {
+        max_end = left->subtree_max_end;
+    }
+    if (right && right->subtree_max_end > max_end) {
+        max_end = right->subtree_max_end;
+    }
+    return max_end;
+}
+
+DeclareRbAugmentCallbacks(static, kMaxEndCallbacks, struct MyInterval, rb_node, subtree_max_end, ComputeMaxEnd)
+
+void MyInsertIntoIntervalTree(MyInterval* interval, RbRoot* root) {
+    assert(interval->start <= interval->end);
+    RbNode* parent = nullptr;
+    RbNode** link_ptr = &root->rb_node;
+    while (*link_ptr) {
+        parent = *link_ptr;
+        if (ToInterval(parent)->start > interval->start) {
+            link_ptr = &parent->left;
+        }
+        else {
+            link_ptr = &parent->right;
+        }
+    }
+    InsertIntoRbTreeAugmented(&interval->rb_node, parent, link_ptr, root, &kMaxEndCallbacks);
+}
+
+void MyRemoveFromIntervalTree(MyInterval* interval, RbRoot* root) {
+    RemoveFromRbTreeAugmented(&interval->rb_node, root, &kMaxEndCallbacks);
+}
+
+// Returns the leftmost interval in the subtree of `node` which overlaps [lo, hi).
+static MyInterval* SearchOverlapInSubtree(MyInterval* node, int64_t lo, int64_t hi) {
+    while (true) {
+        // Any overlap in the left subtree comes first.
+        // If the left subtree has an interval ending after `lo` but none of them overlaps,
+        // they all start at or after `hi`, and so does everything on the right.
+        MyInterval* left = ToInterval(node->rb_node.left);
+        if (left && left->subtree_max_end > lo) {
+            node = left;
+            continue;
+        }
+        if (node->start >= hi) {
+            return nullptr;
+        }
+        if (node->end > lo) {
+            return node;
+        }
+        MyInterval* right = ToInterval(node->rb_node.right);
+        if (right && right->subtree_max_end > lo) {
+            node = right;
+            continue;
+        }
+        return nullptr;
+    }
+}
+
+MyInterval* MyFirstOverlapInIntervalTree(int64_t lo, int64_t hi, RbRoot* root) {
+    MyInterval* node = ToInterval(root->rb_node);
+    if (node == nullptr || node->subtree_max_end <= lo || lo >= hi) {
+        return nullptr;
+    }
+    return SearchOverlapInSubtree(node, lo, hi);
+}
+
+MyInterval* MyNextOverlapInIntervalTree(MyInterval* interval, int64_t lo, int64_t hi) {
+    RbNode* node = &interval->rb_node;
+    while (true) {
+        // The left subtree and `node` itself are done, so try the right subtree first.
+        MyInterval* right = ToInterval(node->right);
+        if (right && right->subtree_max_end > lo) {
+            return SearchOverlapInSubtree(right, lo, hi);
+        }
+        // Go up until we come from a left child, and that parent is the next candidate.
+        RbNode* prev = nullptr;
+        do {
+            prev = node;
+            node = GetParent(node);
+            if (node == nullptr) {
+                return nullptr;
+            }
+        } while (prev == node->right);
+
+        MyInterval* candidate = ToInterval(node);
+        if (candidate->start >= hi) {
+            return nullptr;
+        }
+        if (candidate->end > lo) {
+            return candidate;
+        }
+    }
+}
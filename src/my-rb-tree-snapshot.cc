@@ -0,0 +1,211 @@
+#include "include/my-rb-tree-snapshot.h"
+
+#include <fstream>
+#include <vector>
+
+#include <cstring>
+#include <cassert>
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+constexpr char kSnapshotMagic[8] = { 'M', 'Y', 'R', 'B', 'S', 'N', 'A', 'P' };
+constexpr uint32_t kSnapshotVersion = 1;
+
+const MyData* ToData(const RbNode* node) {
+    return ContainerOf(node, struct MyData, rb_node);
+}
+
+int MyCompareDataNodes(const RbNode* a, const RbNode* b) {
+    int a_value = ToData(a)->value;
+    int b_value = ToData(b)->value;
+    return a_value < b_value ? -1 : (a_value > b_value ? 1 : 0);
+}
+
+}  // namespace
+
+bool MyWriteRbTreeSnapshot(const RbRoot* root, const char* path) {
+    // Pre-order walk with a stack of the nodes still to emit, and the records which link to them.
+    struct Pending {
+        const RbNode* node;
+        size_t parent_index;
+        bool is_right;
+    };
+    std::vector<MySnapshotNode> records;
+    std::vector<Pending> stack;
+    if (root->rb_node != nullptr) {
+        stack.push_back({ root->rb_node, SIZE_MAX, false });
+    }
+    while (!stack.empty()) {
+        Pending pending = stack.back();
+        stack.pop_back();
+        size_t index = records.size();
+        if (index == UINT32_MAX) {
+            return false;
+        }
+        const RbNode* node = pending.node;
+        records.push_back({ 0, 0, ToData(node)->value, static_cast<uint32_t>(GetColor(node)) });
+        if (pending.parent_index != SIZE_MAX) {
+            MySnapshotNode& parent = records[pending.parent_index];
+            (pending.is_right ? parent.right : parent.left) = static_cast<uint32_t>(index - pending.parent_index);
+        }
+        // The left child is pushed last, so it's emitted right after `node`.
+        if (node->right != nullptr) {
+            stack.push_back({ node->right, index, true });
+        }
+        if (node->left != nullptr) {
+            stack.push_back({ node->left, index, false });
+        }
+    }
+
+    MySnapshotHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, kSnapshotMagic, sizeof(header.magic));
+    header.version = kSnapshotVersion;
+    header.node_size = sizeof(MySnapshotNode);
+    header.node_num = records.size();
+
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file.write(reinterpret_cast<const char*>(records.data()), records.size() * sizeof(MySnapshotNode));
+    file.close();
+    return !file.fail();
+}
+
+bool MyRbTreeSnapshot::Open(const char* path) {
+    Close();
+#if defined(_WIN32)
+    HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                              FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+    LARGE_INTEGER file_size;
+    HANDLE mapping = nullptr;
+    void* view = nullptr;
+    if (GetFileSizeEx(file, &file_size) && file_size.QuadPart >= static_cast<LONGLONG>(sizeof(MySnapshotHeader))) {
+        mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    }
+    if (mapping != nullptr) {
+        view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    }
+    if (view == nullptr) {
+        if (mapping != nullptr) CloseHandle(mapping);
+        CloseHandle(file);
+        return false;
+    }
+    file_handle_ = file;
+    mapping_handle_ = mapping;
+    mapping_ = view;
+    mapping_size_ = static_cast<size_t>(file_size.QuadPart);
+#else
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat file_stat;
+    void* view = MAP_FAILED;
+    if (fstat(fd, &file_stat) == 0 && file_stat.st_size >= static_cast<off_t>(sizeof(MySnapshotHeader))) {
+        view = mmap(nullptr, static_cast<size_t>(file_stat.st_size), PROT_READ, MAP_SHARED, fd, 0);
+    }
+    // The mapping stays valid after the file is closed.
+    close(fd);
+    if (view == MAP_FAILED) {
+        return false;
+    }
+    mapping_ = view;
+    mapping_size_ = static_cast<size_t>(file_stat.st_size);
+#endif
+
+    const MySnapshotHeader* header = static_cast<const MySnapshotHeader*>(mapping_);
+    uint64_t max_node_num = (mapping_size_ - sizeof(MySnapshotHeader)) / sizeof(MySnapshotNode);
+    if (memcmp(header->magic, kSnapshotMagic, sizeof(header->magic)) != 0 ||
+        header->version != kSnapshotVersion || header->node_size != sizeof(MySnapshotNode) ||
+        header->node_num > max_node_num) {
+        Close();
+        return false;
+    }
+    nodes_ = reinterpret_cast<const MySnapshotNode*>(header + 1);
+    node_num_ = header->node_num;
+    return true;
+}
+
+void MyRbTreeSnapshot::Close() {
+    if (mapping_ == nullptr) {
+        return;
+    }
+#if defined(_WIN32)
+    UnmapViewOfFile(mapping_);
+    CloseHandle(mapping_handle_);
+    CloseHandle(file_handle_);
+    file_handle_ = mapping_handle_ = nullptr;
+#else
+    munmap(mapping_, mapping_size_);
+#endif
+    mapping_ = nullptr;
+    mapping_size_ = 0;
+    nodes_ = nullptr;
+    node_num_ = 0;
+}
+
+bool MyRbTreeSnapshot::Contains(int value) const {
+    const MySnapshotNode* node = Root();
+    for (int depth = 0; node != nullptr && depth < kMaxDepth; ++depth) {
+        if (node->value == value) {
+            return true;
+        }
+        node = node->value > value ? LeftOf(node) : RightOf(node);
+    }
+    return false;
+}
+
+bool MyRbTreeSnapshot::LoadInto(RbRoot* root) const {
+    assert(IsEmptyRbRoot(root));
+    std::vector<MyData*> datas(static_cast<size_t>(node_num_));
+    for (size_t i = 0; i < datas.size(); ++i) {
+        datas[i] = NewMyData(nodes_[i].value);
+        datas[i]->rb_node.left = datas[i]->rb_node.right = nullptr;
+        SetParentAndColor(&datas[i]->rb_node, nullptr, nodes_[i].color ? kRed : kBlack);
+    }
+    // Every record only links to later ones, so the links are set up in a single pass.
+    for (size_t i = 0; i < datas.size(); ++i) {
+        RbNode* node = &datas[i]->rb_node;
+        const MySnapshotNode* left = LeftOf(&nodes_[i]);
+        const MySnapshotNode* right = RightOf(&nodes_[i]);
+        if (left != nullptr) {
+            node->left = &datas[left - nodes_]->rb_node;
+            SetParent(node->left, node);
+        }
+        if (right != nullptr) {
+            node->right = &datas[right - nodes_]->rb_node;
+            SetParent(node->right, node);
+        }
+    }
+    if (!datas.empty()) {
+        root->rb_node = &datas[0]->rb_node;
+    }
+
+    // A corrupted file may still link the records into something else than a legal rb-tree.
+    size_t linked_num = 0;
+    for (RbNode* node = FirstRbNode(root); node != nullptr && linked_num <= datas.size(); node = NextRbNode(node)) {
+        ++linked_num;
+    }
+    if (linked_num != datas.size() || CheckRbTree(root, MyCompareDataNodes, nullptr) != kRbCheckOk) {
+        for (MyData* data : datas) {
+            DeleteMyData(data);
+        }
+        root->rb_node = nullptr;
+        return false;
+    }
+    return true;
+}
@@ -1,22 +1,56 @@
 #include "include/my-rb-tree.h"
+#include "include/node-pool.h"
+#include "include/rb-tree-stats.h"
+#include "include/rb-tree-set-ops.h"
 
 #include <iostream>
 #include <algorithm>
 #include <vector>
 #include <queue>
 #include <random>
-#include <unordered_set>
 
 #include <cstdio>
+#include <cstdlib>
 #include <cassert>
 
-void MyInsertIntoRbTree(MyData* new_data, RbRoot* root) {
-    RbNode* parent = nullptr;
-    RbNode** link_ptr = &root->rb_node;
+static NodePool*& MyDataPool() {
+    static NodePool* pool = CreateNodePool(sizeof(MyData));
+    return pool;
+}
+
+MyData* NewMyData(int value) {
+    MyData* data = static_cast<MyData*>(AllocFromNodePool(MyDataPool()));
+    if (data == nullptr) {
+        std::cerr << "NewMyData: out of memory" << std::endl;
+        abort();
+    }
+    data->value = value;
+    return data;
+}
+
+void DeleteMyData(MyData* data) {
+    FreeToNodePool(MyDataPool(), data);
+}
+
+size_t GetMyDataFootprint() {
+    return GetNodePoolFootprint(MyDataPool());
+}
+
+void DeleteAllMyData() {
+    NodePool*& pool = MyDataPool();
+    DestroyNodePool(pool);
+    pool = CreateNodePool(sizeof(MyData));
+}
+
+// Finds the link where a node with `value` should be inserted, below `link_ptr` whose node's parent is `parent`.
+// Equal values go to the right, so nodes with the same value keep their insertion order.
+static RbNode** MyFindInsertLinkBelow(int value, RbNode* parent, RbNode** link_ptr, RbNode** parent_ptr) {
+    int depth = 0;
     while (*link_ptr) {
         parent = *link_ptr;
+        ++depth;
         MyData* parent_data = ContainerOf(parent, struct MyData, rb_node);
-        if (parent_data->value > new_data->value) {
+        if (parent_data->value > value) {
             link_ptr = &parent->left;
         }
         else {
@@ -24,112 +58,392 @@ void MyInsertIntoRbTree(MyData* new_data, RbRoot* root) {
         }
     }
     assert(link_ptr != nullptr);
+    RbStatsSearchDepth(depth);
+    *parent_ptr = parent;
+    return link_ptr;
+}
+
+static RbNode** MyFindInsertLink(int value, RbRoot* root, RbNode** parent_ptr) {
+    return MyFindInsertLinkBelow(value, nullptr, &root->rb_node, parent_ptr);
+}
+
+/*
+    Same as MyFindInsertLink, but starts from `hint` instead of the root.
+    If `value` goes after `hint`, the position is in the right subtree of `hint`,
+    unless an ancestor that `hint` is left of is not greater than `value`.
+    Then that ancestor is the new `hint`. Only those ancestors are compared on the way up,
+    and the descent starts right below the last `hint`, so inserting next to `hint`
+    costs O(1) comparisons. Likewise when `value` goes before `hint`.
+    The walk stops at the first such ancestor that bounds `value`, but a `hint` on the right spine
+    has none, so appending after the maximum still climbs O(log n) links to the root.
+    Only MyAppendToRbTreeCached, which knows the maximum, appends in O(1).
+*/
+static RbNode** MyFindInsertLinkNear(int value, RbNode* hint, RbNode** parent_ptr) {
+    bool go_right = ContainerOf(hint, struct MyData, rb_node)->value <= value;
+    RbNode* parent = nullptr;
+    for (RbNode* node = hint; (parent = GetParent(node)) != nullptr; node = parent) {
+        if (node != (go_right ? parent->left : parent->right)) {
+            continue;
+        }
+        int parent_value = ContainerOf(parent, struct MyData, rb_node)->value;
+        if (go_right ? value < parent_value : parent_value <= value) {
+            break;
+        }
+        hint = parent;
+    }
+    return MyFindInsertLinkBelow(value, hint, go_right ? &hint->right : &hint->left, parent_ptr);
+}
+
+// Finds the node with `value`. If there is none, returns nullptr,
+// and the link and its parent where such a node should be inserted.
+static MyData* MyFindUniqueLink(int value, RbRoot* root, RbNode** parent_ptr, RbNode*** link_ptr) {
+    RbNode* parent = nullptr;
+    RbNode** link = &root->rb_node;
+    int depth = 0;
+    while (*link) {
+        parent = *link;
+        ++depth;
+        MyData* parent_data = ContainerOf(parent, struct MyData, rb_node);
+        if (value < parent_data->value) {
+            link = &parent->left;
+        }
+        else if (value > parent_data->value) {
+            link = &parent->right;
+        }
+        else {
+            RbStatsSearchDepth(depth);
+            return parent_data;
+        }
+    }
+    RbStatsSearchDepth(depth);
+    *parent_ptr = parent;
+    *link_ptr = link;
+    return nullptr;
+}
+
+void MyInsertIntoRbTree(MyData* new_data, RbRoot* root) {
+    RbNode* parent = nullptr;
+    RbNode** link_ptr = MyFindInsertLink(new_data->value, root, &parent);
+    InsertIntoRbTree(&new_data->rb_node, parent, link_ptr, root);
+}
+
+void MyInsertIntoRbTreeWithHint(MyData* new_data, MyData* hint, RbRoot* root) {
+    if (hint == nullptr) {
+        MyInsertIntoRbTree(new_data, root);
+        return;
+    }
+    RbNode* parent = nullptr;
+    RbNode** link_ptr = MyFindInsertLinkNear(new_data->value, &hint->rb_node, &parent);
     InsertIntoRbTree(&new_data->rb_node, parent, link_ptr, root);
 }
 
+MyData* MyInsertUniqueIntoRbTree(MyData* new_data, RbRoot* root) {
+    RbNode* parent = nullptr;
+    RbNode** link_ptr = nullptr;
+    MyData* existing = MyFindUniqueLink(new_data->value, root, &parent, &link_ptr);
+    if (existing == nullptr) {
+        InsertIntoRbTree(&new_data->rb_node, parent, link_ptr, root);
+    }
+    return existing;
+}
+
+MyData* MyFindOrInsertInRbTree(int value, RbRoot* root, bool* inserted) {
+    RbNode* parent = nullptr;
+    RbNode** link_ptr = nullptr;
+    MyData* data = MyFindUniqueLink(value, root, &parent, &link_ptr);
+    if (inserted) *inserted = data == nullptr;
+    if (data == nullptr) {
+        data = NewMyData(value);
+        InsertIntoRbTree(&data->rb_node, parent, link_ptr, root);
+    }
+    return data;
+}
+
 void MyRemoveFromRbTree(MyData* data, RbRoot* root) {
     RemoveFromRbTree(&data->rb_node, root);
-    free(data);
+    DeleteMyData(data);
 }
 
-void MyPrintRbTree(RbNode* node) {
-    assert(node != nullptr);
-    if (node->left) MyPrintRbTree(node->left);
+void MyReplaceInRbTree(MyData* victim, MyData* new_data, RbRoot* root) {
+    assert(victim->value == new_data->value);
+    ReplaceRbNode(&victim->rb_node, &new_data->rb_node, root);
+}
 
-    MyData* data = ContainerOf(node, struct MyData, rb_node);
-    printf("color=%s value=%d ", node->color == kBlack ? "black" : "red", data->value);
-    
-    if (node->left) {
-        data = ContainerOf(node->left, struct MyData, rb_node);
-        printf("left_value=%d ", data->value);
-    }
-    
-    if (node->right) {
-        data = ContainerOf(node->right, struct MyData, rb_node);
-        printf("right_value=%d ", data->value);
+bool MyUpdateValueInRbTree(MyData* data, int value, RbRoot* root) {
+    data->value = value;
+    // Nothing moves if the new value still fits between the neighbors.
+    RbNode* prev = PrevRbNode(&data->rb_node);
+    RbNode* next = NextRbNode(&data->rb_node);
+    if ((prev == nullptr || ContainerOf(prev, struct MyData, rb_node)->value <= value) &&
+        (next == nullptr || ContainerOf(next, struct MyData, rb_node)->value >= value)) {
+        return false;
     }
-    
-    putchar('\n');
+    RemoveFromRbTree(&data->rb_node, root);
+    MyInsertIntoRbTree(data, root);
+    return true;
+}
 
-    if (node->right) MyPrintRbTree(node->right);
+void MyBuildRbTreeFromSorted(MyData* const* datas, size_t data_num, RbRoot* root) {
+    assert(IsEmptyRbRoot(root));
+    assert(std::is_sorted(datas, datas + data_num,
+                          [](const MyData* a, const MyData* b) { return a->value < b->value; }));
+    BuildRbTreeFromSorted(reinterpret_cast<void* const*>(datas), data_num,
+                          OffsetOf(struct MyData, rb_node), root);
 }
 
-/*
-    Is your tree a legal rb-tree?
-    1. Is this tree a legal BST?
-    2. Are all nodes either red or black in color?
-    3. Are all red nodes' child and parent node black in color? 
-    4. Are the numbers of black nodes in the simple paths from root node to any leaf node same?
-    5. Is the root node black in color?
-*/
+static int MyCompareWithValue(const RbNode* node, const void* key) {
+    int node_value = ContainerOf(node, struct MyData, rb_node)->value;
+    int value = *static_cast<const int*>(key);
+    return node_value < value ? -1 : (node_value > value ? 1 : 0);
+}
 
-static void InorderTraversalChecker(
-    RbNode* node, std::vector<int>* record,
-    int cur_black_count, std::vector<int>* black_count_record
-) {
-    // 2. Are all nodes either red or black in color?
-    if (!IsRed(node) && !IsBlack(node)) {
-        throw "Failed: All nodes are either red or black in color.";
+static int MyCompareNodes(const RbNode* a, const RbNode* b) {
+    return MyCompareWithValue(a, &ContainerOf(b, struct MyData, rb_node)->value);
+}
+
+void MySplitRbTree(int value, RbRoot* root, RbRoot* less, RbRoot* not_less) {
+    SplitRbTree(root, MyCompareWithValue, &value, less, not_less);
+}
+
+void MyExtractRangeFromRbTree(int lo, int hi, RbRoot* root, RbRoot* extracted) {
+    RbRoot less = InitializedRbRoot;
+    RbRoot not_less = InitializedRbRoot;
+    RbRoot greater = InitializedRbRoot;
+    SplitRbTree(root, MyCompareWithValue, &lo, &less, &not_less);
+    SplitRbTree(&not_less, MyCompareWithValue, &hi, extracted, &greater);
+    ConcatRbTree(&less, &greater, root);
+}
+
+static void MyReleaseData(RbNode* node, void* /*context*/) {
+    DeleteMyData(ContainerOf(node, struct MyData, rb_node));
+}
+
+size_t MyEraseRangeFromRbTree(int lo, int hi, RbRoot* root) {
+    return EraseRangeFromRbTree(root, MyCompareWithValue, &lo, &hi, MyReleaseData, nullptr);
+}
+
+size_t MyEraseRangeFromRbTreeCached(int lo, int hi, RbRootCached* root) {
+    return EraseRangeFromRbTreeCached(root, MyCompareWithValue, &lo, &hi, MyReleaseData, nullptr);
+}
+
+void MyUnionRbTree(RbRoot* a, RbRoot* b, RbRoot* root, WorkStealingPool* pool) {
+    UnionRbTree(a, b, MyCompareNodes, MyReleaseData, nullptr, root, pool);
+}
+
+void MyIntersectRbTree(RbRoot* a, RbRoot* b, RbRoot* root, WorkStealingPool* pool) {
+    IntersectRbTree(a, b, MyCompareNodes, MyReleaseData, nullptr, root, pool);
+}
+
+void MyDifferenceRbTree(RbRoot* a, RbRoot* b, RbRoot* root, WorkStealingPool* pool) {
+    DifferenceRbTree(a, b, MyCompareNodes, MyReleaseData, nullptr, root, pool);
+}
+
+MyData* MyFindInRbTree(int value, RbRoot* root) {
+    RbNode* node = root->rb_node;
+    int depth = 0;
+    while (node) {
+        MyData* data = ContainerOf(node, struct MyData, rb_node);
+        ++depth;
+        if (value < data->value) {
+            node = node->left;
+        }
+        else if (value > data->value) {
+            node = node->right;
+        }
+        else {
+            RbStatsSearchDepth(depth);
+            return data;
+        }
     }
-    // 3. Are all red nodes' child and parent node black in color?
-    if (IsRed(node) && (IsRed(node->parent) || IsRed(node->left) || IsRed(node->right))) {
-        throw "Failed: All red nodes' child and parent node are black in color.";
+    RbStatsSearchDepth(depth);
+    return nullptr;
+}
+
+MyData* MyLowerBoundInRbTree(int value, RbRoot* root) {
+    RbNode* node = root->rb_node;
+    MyData* result = nullptr;
+    while (node) {
+        MyData* data = ContainerOf(node, struct MyData, rb_node);
+        if (data->value < value) {
+            node = node->right;
+        }
+        else {
+            result = data;
+            node = node->left;
+        }
+    }
+    return result;
+}
+
+MyData* MyUpperBoundInRbTree(int value, RbRoot* root) {
+    RbNode* node = root->rb_node;
+    MyData* result = nullptr;
+    while (node) {
+        MyData* data = ContainerOf(node, struct MyData, rb_node);
+        if (data->value <= value) {
+            node = node->right;
+        }
+        else {
+            result = data;
+            node = node->left;
+        }
     }
+    return result;
+}
+
+void MyInsertIntoRbTreeCached(MyData* new_data, RbRootCached* root) {
+    RbNode* parent = nullptr;
+    RbNode** link_ptr = MyFindInsertLink(new_data->value, &root->rb_root, &parent);
+    InsertIntoRbTreeCached(&new_data->rb_node, parent, link_ptr, root);
+}
 
-    // Update black count
-    if (IsBlack(node)) {
-        cur_black_count += 1;
+void MyAppendToRbTreeCached(MyData* new_data, RbRootCached* root) {
+    RbNode* rightmost = root->rb_rightmost;
+    RbNode* parent = rightmost;
+    RbNode** link_ptr = nullptr;
+    if (rightmost == nullptr) {
+        link_ptr = &root->rb_root.rb_node;
+    }
+    else if (ContainerOf(rightmost, struct MyData, rb_node)->value <= new_data->value) {
+        // The rightmost node has no right child, so the new maximum simply goes there.
+        link_ptr = &rightmost->right;
+    }
+    else {
+        link_ptr = MyFindInsertLinkNear(new_data->value, rightmost, &parent);
     }
+    InsertIntoRbTreeCached(&new_data->rb_node, parent, link_ptr, root);
+}
+
+void MyRemoveFromRbTreeCached(MyData* data, RbRootCached* root) {
+    RemoveFromRbTreeCached(&data->rb_node, root);
+    DeleteMyData(data);
+}
 
-    // Inorder traversal left
-    if (node->left != nullptr) {
-        InorderTraversalChecker(node->left, record, cur_black_count, black_count_record);
+MyData* MyPopMinFromRbTreeCached(RbRootCached* root) {
+    RbNode* node = PopMinFromRbTreeCached(root);
+    return node ? ContainerOf(node, struct MyData, rb_node) : nullptr;
+}
+
+void MyInsertIntoRankedRbTree(MyRankedData* new_data, RbRoot* root) {
+    RbNode* parent = nullptr;
+    RbNode** link_ptr = &root->rb_node;
+    while (*link_ptr) {
+        parent = *link_ptr;
+        MyRankedData* parent_data = ContainerOf(parent, struct MyRankedData, rb_node.rb_node);
+        if (parent_data->value > new_data->value) {
+            link_ptr = &parent->left;
+        }
+        else {
+            link_ptr = &parent->right;
+        }
     }
+    InsertIntoRbSizedTree(&new_data->rb_node, parent, link_ptr, root);
+}
+
+void MyRemoveFromRankedRbTree(MyRankedData* data, RbRoot* root) {
+    RemoveFromRbSizedTree(&data->rb_node, root);
+}
 
-    // Record node value
-    MyData* my_data_struct = ContainerOf(node, struct MyData, rb_node);
-    record->push_back(my_data_struct->value);
+MyRankedData* MySelectInRankedRbTree(size_t k, RbRoot* root) {
+    RbSizedNode* node = SelectFromRbSizedTree(root, k);
+    return node ? ContainerOf(node, struct MyRankedData, rb_node) : nullptr;
+}
 
-    // Inorder traversal right
-    if (node->right != nullptr) {
-        InorderTraversalChecker(node->right, record, cur_black_count, black_count_record);
+size_t MyRankInRankedRbTree(int value, RbRoot* root) {
+    size_t rank = 0;
+    RbNode* node = root->rb_node;
+    while (node) {
+        MyRankedData* data = ContainerOf(node, struct MyRankedData, rb_node.rb_node);
+        if (data->value < value) {
+            // `node` and its left subtree are all less than `value`.
+            rank += (node->left ? ContainerOf(node->left, RbSizedNode, rb_node)->size : 0) + 1;
+            node = node->right;
+        }
+        else {
+            node = node->left;
+        }
     }
+    return rank;
+}
 
-    // 4. Are the numbers of black nodes in the simple paths from root node to any leaf node same?
-    if (!node->left && !node->right) {
-        if (black_count_record->size() > 0 && cur_black_count != black_count_record->back()) {
-            throw "Failed: The numbers of black nodes in the"
-                  " simple paths from root node to any leaf node are same";
+void MyPrintRbTree(RbNode* node) {
+    assert(node != nullptr);
+    // Walk the subtree of `node` in order, from its leftmost node to its rightmost one.
+    RbNode* last = node;
+    while (last->right) last = last->right;
+    while (node->left) node = node->left;
+
+    for (;;) {
+        MyData* data = ContainerOf(node, struct MyData, rb_node);
+        printf("color=%s value=%d ", GetColor(node) == kBlack ? "black" : "red", data->value);
+
+        if (node->left) {
+            data = ContainerOf(node->left, struct MyData, rb_node);
+            printf("left_value=%d ", data->value);
+        }
+
+        if (node->right) {
+            data = ContainerOf(node->right, struct MyData, rb_node);
+            printf("right_value=%d ", data->value);
         }
-        black_count_record->push_back(cur_black_count);
+
+        putchar('\n');
+
+        if (node == last) break;
+        node = NextRbNode(node);
     }
 }
 
-bool IsLegalRbTree(RbRoot* root_node) {
-    // 5. Is the root node black in color?
-    if (!IsBlack(root_node->rb_node)) {
-        std::cerr << "Failed: The root node is black in color" << std::endl;
-        return false;
+void MyDestroyRbTree(RbRoot* root) {
+    RbNode* node = nullptr;
+    RbNode* next = nullptr;
+    RbPostorderForEachSafe(node, next, root) {
+        DeleteMyData(ContainerOf(node, struct MyData, rb_node));
     }
+    root->rb_node = nullptr;
+}
 
-    std::vector<int> record;
-    std::vector<int> black_count_record;
-    try {
-        InorderTraversalChecker(root_node->rb_node, &record, 0, &black_count_record);
+size_t MyCompactRbTree(RbRoot* root) {
+    std::vector<MyData*> old_datas;
+    for (RbNode* node = FirstRbNode(root); node != nullptr; node = NextRbNode(node)) {
+        old_datas.push_back(ContainerOf(node, struct MyData, rb_node));
     }
-    catch (const char* msg) {
-        std::cerr << msg << std::endl;
-        return false;
+    if (old_datas.empty()) {
+        return 0;
+    }
+    NodePool* pool = MyDataPool();
+    void* run = AllocRunFromNodePool(pool, old_datas.size());
+    if (run == nullptr) {
+        return 0;
     }
+    size_t data_num = RelayoutRbTree(root, run, GetNodePoolSlotSize(pool), OffsetOf(struct MyData, rb_node));
+    assert(data_num == old_datas.size());
+    for (MyData* data : old_datas) {
+        DeleteMyData(data);
+    }
+    // Otherwise every pass would keep the slots of the previous layout, and the pool would grow
+    // by a copy of the tree each time.
+    TrimNodePool(pool);
+    return data_num;
+}
 
-    // 1. Is this tree a legal BST?
-    std::vector<int> sorted_record = record;
-    std::sort(sorted_record.begin(), sorted_record.end());
-    if (!std::equal(record.begin(), record.end(), sorted_record.begin())) {
-        std::cerr << "Failed: This tree is a legal BST." << std::endl;
+/*
+    Is your tree a legal rb-tree?
+    1. Is this tree a legal BST?
+    2. Are all nodes either red or black in color? (Always true, a node has a single color bit.)
+    3. Are all red nodes' child and parent node black in color? 
+    4. Are the numbers of black nodes in the simple paths from root node to any leaf node same?
+    5. Is the root node black in color?
+    CheckRbTree does all of them in one pass, plus the parent links.
+*/
+bool IsLegalRbTree(RbRoot* root_node) {
+    const RbNode* bad_node = nullptr;
+    RbCheckResult result = CheckRbTree(root_node, MyCompareNodes, &bad_node);
+    if (result != kRbCheckOk) {
+        std::cerr << "Failed: " << DescribeRbCheckResult(result) << " value="
+                  << ContainerOf(bad_node, struct MyData, rb_node)->value << std::endl;
         return false;
     }
-    
     return true;
 }
 
@@ -142,18 +456,14 @@ bool RbTreeTesterAuto(int node_num, bool print_log) {
     std::queue<MyData*> datas;
     
     // Test the insert function.
-    std::unordered_set<int> set;
     for (int i = 0; i < node_num; ++i) {
-        MyData* my_data_struct = reinterpret_cast<MyData*>(malloc(sizeof(MyData)));
-        assert(my_data_struct != nullptr);
+        MyData* my_data_struct = NewMyData(0);
+        // Insert the new node to the rb-tree, retrying until its value is new.
         do {
             my_data_struct->value = dis(gen);
-        } while (set.count(my_data_struct->value) > 0);
-        set.insert(my_data_struct->value);
+        } while (MyInsertUniqueIntoRbTree(my_data_struct, &root) != nullptr);
         // Record rb-tree node.
         datas.push(my_data_struct);
-        // Insert the new node to the rb-tree.
-        MyInsertIntoRbTree(my_data_struct, &root);
     }
     if (print_log) std::cout << "Inserted all nodes." << std::endl;
 
@@ -163,6 +473,39 @@ bool RbTreeTesterAuto(int node_num, bool print_log) {
     }
     if (print_log) std::cout << "Passed check after inserting." << std::endl;
 
+    // Check the lookup and iteration functions.
+    int prev_value = 0;
+    size_t visited = 0;
+    for (RbNode* node = FirstRbNode(&root); node != nullptr; node = NextRbNode(node)) {
+        MyData* data = ContainerOf(node, struct MyData, rb_node);
+        if ((visited > 0 && data->value <= prev_value) || MyFindInRbTree(data->value, &root) != data) {
+            std::cerr << "Failed: Lookup or iteration is broken." << std::endl;
+            return false;
+        }
+        prev_value = data->value;
+        ++visited;
+    }
+    if (visited != datas.size()) {
+        std::cerr << "Failed: Iteration misses some nodes." << std::endl;
+        return false;
+    }
+
+    // Check the replace and update functions. Values may repeat afterwards.
+    std::uniform_int_distribution<int> delta_dis(-4, 4);
+    for (size_t i = 0; i < datas.size(); ++i) {
+        MyData* data = datas.front();
+        datas.pop();
+        MyData* new_data = NewMyData(data->value);
+        MyReplaceInRbTree(data, new_data, &root);
+        DeleteMyData(data);
+        MyUpdateValueInRbTree(new_data, new_data->value + delta_dis(gen), &root);
+        datas.push(new_data);
+    }
+    if (!IsLegalRbTree(&root)) {
+        return false;
+    }
+    if (print_log) std::cout << "Passed check after replacing and updating." << std::endl;
+
     if (print_log) MyPrintRbTree(root.rb_node);
 
     // Test the remove function.
@@ -199,9 +542,7 @@ bool RbTreeTesterWithValues(const std::vector<int>& values, bool print_log) {
 
     // Test the insert function.
     for (int value : values) {
-        MyData* my_data_struct = reinterpret_cast<MyData*>(malloc(sizeof(MyData)));
-        assert(my_data_struct != nullptr);
-        my_data_struct->value = value;
+        MyData* my_data_struct = NewMyData(value);
         // Record rb-tree node.
         datas.push(my_data_struct);
         // Insert the new node to the rb-tree.
@@ -0,0 +1,193 @@
+#include "include/my-sharded-rb-tree.h"
+
+#include <algorithm>
+
+#include <cassert>
+
+namespace {
+
+// Neighbors whose sizes differ by this much or less are balanced.
+constexpr size_t kRebalanceSlack = 1024;
+// Inserts check the sizes of the shards once per this many values, to keep their cache lines quiet,
+// and balance a shard only once it's more than twice as large as the average.
+constexpr size_t kRebalanceCheckInterval = 1024;
+// Bounds the time both shards stay locked, since the boundary is found by walking the nodes.
+constexpr size_t kMaxRebalanceMove = 16384;
+
+constexpr int64_t kNoUpperBound = static_cast<int64_t>(INT_MAX) + 1;
+
+bool IsSkewed(size_t larger, size_t smaller) {
+    return larger > smaller * 2 + kRebalanceSlack;
+}
+
+}  // namespace
+
+MyShardedRbTree::MyShardedRbTree(int shard_num, int lo, int hi)
+    : shard_num_(shard_num), shards_(new Shard[shard_num]) {
+    assert(shard_num > 0 && lo < hi);
+    int64_t width = (static_cast<int64_t>(hi) - lo) / shard_num;
+    for (int i = 0; i < shard_num; ++i) {
+        shards_[i].root = InitializedRbRoot;
+        shards_[i].lower = i == 0 ? INT_MIN : static_cast<int>(lo + width * i);
+        shards_[i].size = 0;
+    }
+}
+
+MyShardedRbTree::~MyShardedRbTree() {
+    for (int i = 0; i < shard_num_; ++i) {
+        MyDestroyRbTree(&shards_[i].root);
+    }
+}
+
+MyShardedRbTree::Shard* MyShardedRbTree::LockShardOf(int value, int64_t* upper) {
+    while (true) {
+        // Find the last shard whose lower bound is not greater than `value`.
+        int begin = 0;
+        int end = shard_num_;
+        while (end - begin > 1) {
+            int mid = begin + (end - begin) / 2;
+            if (shards_[mid].lower.load(std::memory_order_relaxed) <= value) {
+                begin = mid;
+            } else {
+                end = mid;
+            }
+        }
+        Shard* shard = &shards_[begin];
+        shard->mutex.lock();
+        // Both bounds of a locked shard are stable, but they may have moved before we got the lock.
+        *upper = begin + 1 < shard_num_ ? shards_[begin + 1].lower.load(std::memory_order_relaxed) : kNoUpperBound;
+        if (shard->lower.load(std::memory_order_relaxed) <= value && value < *upper) {
+            return shard;
+        }
+        shard->mutex.unlock();
+    }
+}
+
+bool MyShardedRbTree::Insert(int value) {
+    // Allocate and free outside of the lock.
+    MyData* new_data = NewMyData(value);
+    int64_t upper = 0;
+    Shard* shard = LockShardOf(value, &upper);
+    MyData* existing = MyInsertUniqueIntoRbTree(new_data, &shard->root);
+    size_t size = shard->size.load(std::memory_order_relaxed);
+    if (existing == nullptr) {
+        shard->size.store(++size, std::memory_order_relaxed);
+    }
+    shard->mutex.unlock();
+
+    if (existing != nullptr) {
+        DeleteMyData(new_data);
+        return false;
+    }
+    if (size % kRebalanceCheckInterval == 0) {
+        MaybeBalanceAround(static_cast<int>(shard - shards_.get()));
+    }
+    return true;
+}
+
+bool MyShardedRbTree::Remove(int value) {
+    int64_t upper = 0;
+    Shard* shard = LockShardOf(value, &upper);
+    MyData* data = MyFindInRbTree(value, &shard->root);
+    if (data != nullptr) {
+        RemoveFromRbTree(&data->rb_node, &shard->root);
+        shard->size.store(shard->size.load(std::memory_order_relaxed) - 1, std::memory_order_relaxed);
+    }
+    shard->mutex.unlock();
+
+    if (data == nullptr) {
+        return false;
+    }
+    DeleteMyData(data);
+    return true;
+}
+
+bool MyShardedRbTree::Contains(int value) {
+    int64_t upper = 0;
+    Shard* shard = LockShardOf(value, &upper);
+    bool found = MyFindInRbTree(value, &shard->root) != nullptr;
+    shard->mutex.unlock();
+    return found;
+}
+
+size_t MyShardedRbTree::GetSize() const {
+    size_t size = 0;
+    for (int i = 0; i < shard_num_; ++i) {
+        size += GetShardSize(i);
+    }
+    return size;
+}
+
+/*
+    Moves the largest values of the left shard to the right one, or the smallest values of the right
+    shard to the left one, so both end up with about the same size:
+        left  [ ..... x ... ]   right [ ... ]
+                      |
+                      v  split left at x, concat the upper part with right, x becomes the boundary
+        left  [ ..... ]   right [ x ... ... ]
+    The split and the concat cost O(log n), but finding x walks over the moved nodes.
+*/
+bool MyShardedRbTree::BalancePair(int index) {
+    assert(index + 1 < shard_num_);
+    Shard* left = &shards_[index];
+    Shard* right = &shards_[index + 1];
+    // Always lock from left to right, so two balancing threads can't deadlock.
+    std::lock_guard<std::mutex> left_lock(left->mutex);
+    std::lock_guard<std::mutex> right_lock(right->mutex);
+    size_t left_size = left->size.load(std::memory_order_relaxed);
+    size_t right_size = right->size.load(std::memory_order_relaxed);
+    bool to_right = left_size > right_size;
+    size_t difference = to_right ? left_size - right_size : right_size - left_size;
+    if (difference <= kRebalanceSlack) {
+        return false;
+    }
+    size_t move_num = std::min(difference / 2, kMaxRebalanceMove);
+
+    // `boundary` is the smallest node which ends up in the right shard.
+    RbNode* boundary = to_right ? LastRbNode(&left->root) : FirstRbNode(&right->root);
+    for (size_t i = 1; i < (to_right ? move_num : move_num + 1); ++i) {
+        boundary = to_right ? PrevRbNode(boundary) : NextRbNode(boundary);
+    }
+    int boundary_value = ContainerOf(boundary, struct MyData, rb_node)->value;
+
+    RbRoot lower_part = InitializedRbRoot;
+    RbRoot upper_part = InitializedRbRoot;
+    if (to_right) {
+        MySplitRbTree(boundary_value, &left->root, &lower_part, &upper_part);
+        left->root = lower_part;
+        ConcatRbTree(&upper_part, &right->root, &right->root);
+    } else {
+        MySplitRbTree(boundary_value, &right->root, &lower_part, &upper_part);
+        right->root = upper_part;
+        ConcatRbTree(&left->root, &lower_part, &left->root);
+    }
+    left->size.store(to_right ? left_size - move_num : left_size + move_num, std::memory_order_relaxed);
+    right->size.store(to_right ? right_size + move_num : right_size - move_num, std::memory_order_relaxed);
+    right->lower.store(boundary_value, std::memory_order_relaxed);
+    return true;
+}
+
+void MyShardedRbTree::MaybeBalanceAround(int index) {
+    size_t size = GetShardSize(index);
+    if (!IsSkewed(size, GetSize() / shard_num_)) {
+        return;
+    }
+    // Push the extra values to the smaller neighbor, which passes them on when it grows too large itself.
+    size_t left_size = index > 0 ? GetShardSize(index - 1) : SIZE_MAX;
+    size_t right_size = index + 1 < shard_num_ ? GetShardSize(index + 1) : SIZE_MAX;
+    BalancePair(left_size < right_size ? index - 1 : index);
+}
+
+void MyShardedRbTree::Rebalance() {
+    // Every sweep pushes values one shard further, so repeat until nothing moves.
+    bool moved = true;
+    while (moved) {
+        moved = false;
+        for (int i = 0; i + 1 < shard_num_; ++i) {
+            moved = BalancePair(i) || moved;
+        }
+        for (int i = shard_num_ - 2; i >= 0; --i) {
+            moved = BalancePair(i) || moved;
+        }
+    }
+}
@@ -0,0 +1,355 @@
+#include "include/node-pool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <unordered_set>
+#include <vector>
+
+#include <cstdint>
+#include <cstdlib>
+#include <cassert>
+
+namespace {
+
+constexpr size_t kCacheLineSize = 64;
+constexpr size_t kPageSize = 4096;
+constexpr size_t kSlabSize = 64 * 1024;
+// Number of entries moved between a thread cache and the shared free list at once.
+constexpr size_t kBatchSize = 32;
+// Number of pools each thread caches entries for.
+constexpr int kThreadCacheSlots = 4;
+
+struct FreeEntry {
+    FreeEntry* next;
+};
+
+// A slab, or a run from AllocRunFromNodePool.
+struct Block {
+    void* raw;
+    // Bytes malloc'ed at `raw`.
+    size_t raw_size;
+    char* begin;
+    size_t slot_num;
+};
+
+}  // namespace
+
+struct NodePool {
+    size_t slot_size;
+    size_t slab_size;
+    uint64_t id;
+
+    std::mutex mutex;
+    // The following fields are protected by `mutex`.
+    FreeEntry* free_list;
+    char* bump;
+    char* bump_end;
+    std::vector<Block> blocks;
+    // Bytes malloc'ed for `blocks`.
+    size_t footprint;
+};
+
+namespace {
+
+/*
+    Ids of live pools. A thread cache may outlive a pool, so before it gives entries back
+    (on eviction or thread exit) it checks the pool is still here, under the registry lock.
+    DestroyNodePool unregisters the pool under the same lock before freeing anything.
+    It's never destroyed, because thread caches may still use it at exit.
+*/
+struct PoolRegistry {
+    std::mutex mutex;
+    std::unordered_set<uint64_t> live_ids;
+    uint64_t next_id = 1;
+};
+
+PoolRegistry& GetPoolRegistry() {
+    static PoolRegistry* registry = new PoolRegistry;
+    return *registry;
+}
+
+size_t RoundUpSlotSize(size_t entry_size) {
+    size_t size = entry_size < sizeof(FreeEntry) ? sizeof(FreeEntry) : entry_size;
+    if (size >= kCacheLineSize) {
+        return (size + kCacheLineSize - 1) / kCacheLineSize * kCacheLineSize;
+    }
+    size_t slot_size = sizeof(FreeEntry);
+    while (slot_size < size) {
+        slot_size *= 2;
+    }
+    return slot_size;
+}
+
+// Carves up to `count` entries from the shared free list and the slabs. Requires `pool->mutex`.
+FreeEntry* TakeEntriesLocked(NodePool* pool, size_t count, size_t* taken) {
+    FreeEntry* head = nullptr;
+    size_t n = 0;
+    while (n < count && pool->free_list != nullptr) {
+        FreeEntry* entry = pool->free_list;
+        pool->free_list = entry->next;
+        entry->next = head;
+        head = entry;
+        ++n;
+    }
+    while (n < count) {
+        // A slot size over a cache line need not divide the slab, so check the room left, not the end.
+        if (pool->bump == nullptr || static_cast<size_t>(pool->bump_end - pool->bump) < pool->slot_size) {
+            void* raw = malloc(pool->slab_size + kCacheLineSize);
+            if (raw == nullptr) {
+                break;
+            }
+            uintptr_t aligned = (reinterpret_cast<uintptr_t>(raw) + kCacheLineSize - 1) & ~(kCacheLineSize - 1);
+            pool->bump = reinterpret_cast<char*>(aligned);
+            pool->bump_end = pool->bump + pool->slab_size;
+            pool->blocks.push_back({ raw, pool->slab_size + kCacheLineSize, pool->bump, pool->slab_size / pool->slot_size });
+            pool->footprint += pool->slab_size + kCacheLineSize;
+        }
+        FreeEntry* entry = reinterpret_cast<FreeEntry*>(pool->bump);
+        pool->bump += pool->slot_size;
+        entry->next = head;
+        head = entry;
+        ++n;
+    }
+    *taken = n;
+    return head;
+}
+
+void GiveEntriesLocked(NodePool* pool, FreeEntry* head, FreeEntry* tail) {
+    tail->next = pool->free_list;
+    pool->free_list = head;
+}
+
+struct CacheSlot {
+    NodePool* pool;
+    uint64_t pool_id;
+    FreeEntry* head;
+    size_t count;
+};
+
+class ThreadCache {
+public:
+    ThreadCache() : slots_(), next_victim_(0) {}
+
+    ~ThreadCache() {
+        for (CacheSlot& slot : slots_) {
+            Evict(&slot);
+        }
+    }
+
+    CacheSlot* SlotFor(NodePool* pool) {
+        CacheSlot* empty_slot = nullptr;
+        for (CacheSlot& slot : slots_) {
+            if (slot.pool == pool && slot.pool_id == pool->id) {
+                return &slot;
+            }
+            if (slot.pool == nullptr && empty_slot == nullptr) {
+                empty_slot = &slot;
+            }
+        }
+        CacheSlot* slot = empty_slot;
+        if (slot == nullptr) {
+            slot = &slots_[next_victim_];
+            next_victim_ = (next_victim_ + 1) % kThreadCacheSlots;
+            Evict(slot);
+        }
+        slot->pool = pool;
+        slot->pool_id = pool->id;
+        return slot;
+    }
+
+    // Gives the entries this thread keeps for `pool` back to it.
+    void Flush(NodePool* pool) {
+        for (CacheSlot& slot : slots_) {
+            if (slot.pool == pool && slot.pool_id == pool->id) {
+                Evict(&slot);
+            }
+        }
+    }
+
+    // Forgets the entries of a pool being destroyed by this thread.
+    void Drop(NodePool* pool) {
+        for (CacheSlot& slot : slots_) {
+            if (slot.pool == pool && slot.pool_id == pool->id) {
+                slot = CacheSlot();
+            }
+        }
+    }
+
+private:
+    // Gives the entries of `slot` back to its pool, unless the pool is already destroyed.
+    static void Evict(CacheSlot* slot) {
+        if (slot->pool != nullptr && slot->head != nullptr) {
+            PoolRegistry& registry = GetPoolRegistry();
+            std::lock_guard<std::mutex> registry_lock(registry.mutex);
+            if (registry.live_ids.count(slot->pool_id) > 0) {
+                FreeEntry* tail = slot->head;
+                while (tail->next != nullptr) {
+                    tail = tail->next;
+                }
+                std::lock_guard<std::mutex> pool_lock(slot->pool->mutex);
+                GiveEntriesLocked(slot->pool, slot->head, tail);
+            }
+        }
+        *slot = CacheSlot();
+    }
+
+    CacheSlot slots_[kThreadCacheSlots];
+    int next_victim_;
+};
+
+thread_local ThreadCache t_thread_cache;
+
+}  // namespace
+
+NodePool* CreateNodePool(size_t entry_size) {
+    NodePool* pool = new NodePool;
+    pool->slot_size = RoundUpSlotSize(entry_size);
+    pool->slab_size = kSlabSize;
+    if (pool->slab_size < pool->slot_size * kBatchSize) {
+        pool->slab_size = pool->slot_size * kBatchSize;
+    }
+    // Don't leave a tail in every slab that no slot fits in.
+    pool->slab_size -= pool->slab_size % pool->slot_size;
+    pool->free_list = nullptr;
+    pool->bump = pool->bump_end = nullptr;
+    pool->footprint = 0;
+
+    PoolRegistry& registry = GetPoolRegistry();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    pool->id = registry.next_id++;
+    registry.live_ids.insert(pool->id);
+    return pool;
+}
+
+void DestroyNodePool(NodePool* pool) {
+    if (pool == nullptr) {
+        return;
+    }
+    {
+        PoolRegistry& registry = GetPoolRegistry();
+        std::lock_guard<std::mutex> lock(registry.mutex);
+        registry.live_ids.erase(pool->id);
+    }
+    // The caches of other threads are left alone. Their slots no longer match any live pool,
+    // so they will be dropped when evicted.
+    t_thread_cache.Drop(pool);
+    for (const Block& block : pool->blocks) {
+        free(block.raw);
+    }
+    delete pool;
+}
+
+void* AllocFromNodePool(NodePool* pool) {
+    CacheSlot* slot = t_thread_cache.SlotFor(pool);
+    if (slot->head == nullptr) {
+        std::lock_guard<std::mutex> lock(pool->mutex);
+        slot->head = TakeEntriesLocked(pool, kBatchSize, &slot->count);
+        if (slot->head == nullptr) {
+            return nullptr;
+        }
+    }
+    FreeEntry* entry = slot->head;
+    slot->head = entry->next;
+    --slot->count;
+    return entry;
+}
+
+void FreeToNodePool(NodePool* pool, void* entry) {
+    assert(entry != nullptr);
+    CacheSlot* slot = t_thread_cache.SlotFor(pool);
+    FreeEntry* free_entry = static_cast<FreeEntry*>(entry);
+    free_entry->next = slot->head;
+    slot->head = free_entry;
+    ++slot->count;
+
+    // Keep up to two batches locally, and give one batch back when it overflows.
+    if (slot->count >= kBatchSize * 2) {
+        FreeEntry* head = slot->head;
+        FreeEntry* tail = head;
+        for (size_t i = 1; i < kBatchSize; ++i) {
+            tail = tail->next;
+        }
+        slot->head = tail->next;
+        slot->count -= kBatchSize;
+        std::lock_guard<std::mutex> lock(pool->mutex);
+        GiveEntriesLocked(pool, head, tail);
+    }
+}
+
+void* AllocRunFromNodePool(NodePool* pool, size_t count) {
+    assert(count > 0);
+    size_t raw_size = pool->slot_size * count + kPageSize;
+    void* raw = malloc(raw_size);
+    if (raw == nullptr) {
+        return nullptr;
+    }
+    uintptr_t aligned = (reinterpret_cast<uintptr_t>(raw) + kPageSize - 1) & ~(kPageSize - 1);
+    std::lock_guard<std::mutex> lock(pool->mutex);
+    pool->blocks.push_back({ raw, raw_size, reinterpret_cast<char*>(aligned), count });
+    pool->footprint += raw_size;
+    return reinterpret_cast<void*>(aligned);
+}
+
+/*
+    Counts the entries on the shared free list per block, with the blocks sorted by address,
+    and releases the blocks whose every slot is there. The slab being carved is kept.
+    Entries cached by other threads keep their blocks alive, which is only conservative.
+*/
+size_t TrimNodePool(NodePool* pool) {
+    t_thread_cache.Flush(pool);
+    std::lock_guard<std::mutex> lock(pool->mutex);
+    std::vector<Block>& blocks = pool->blocks;
+    std::sort(blocks.begin(), blocks.end(), [](const Block& a, const Block& b) { return a.begin < b.begin; });
+    auto block_of = [&](const FreeEntry* entry) {
+        auto it = std::upper_bound(blocks.begin(), blocks.end(), reinterpret_cast<const char*>(entry),
+                                   [](const char* address, const Block& block) { return address < block.begin; });
+        return static_cast<size_t>(it - blocks.begin()) - 1;
+    };
+    std::vector<size_t> free_nums(blocks.size(), 0);
+    for (FreeEntry* entry = pool->free_list; entry != nullptr; entry = entry->next) {
+        ++free_nums[block_of(entry)];
+    }
+    std::vector<bool> released(blocks.size(), false);
+    bool any_released = false;
+    for (size_t i = 0; i < blocks.size(); ++i) {
+        bool is_bump_slab = pool->bump != nullptr && pool->bump_end == blocks[i].begin + pool->slab_size;
+        released[i] = !is_bump_slab && free_nums[i] == blocks[i].slot_num;
+        any_released = any_released || released[i];
+    }
+    if (!any_released) {
+        return 0;
+    }
+
+    // Unlink the entries of the released blocks from the free list, then free the blocks.
+    FreeEntry** link = &pool->free_list;
+    while (*link != nullptr) {
+        if (released[block_of(*link)]) {
+            *link = (*link)->next;
+        } else {
+            link = &(*link)->next;
+        }
+    }
+    size_t released_size = 0;
+    size_t kept_num = 0;
+    for (size_t i = 0; i < blocks.size(); ++i) {
+        if (released[i]) {
+            released_size += blocks[i].raw_size;
+            free(blocks[i].raw);
+        } else {
+            blocks[kept_num++] = blocks[i];
+        }
+    }
+    blocks.resize(kept_num);
+    pool->footprint -= released_size;
+    return released_size;
+}
+
+size_t GetNodePoolFootprint(NodePool* pool) {
+    std::lock_guard<std::mutex> lock(pool->mutex);
+    return pool->footprint;
+}
+
+size_t GetNodePoolSlotSize(const NodePool* pool) {
+    return pool->slot_size;
+}
@@ -0,0 +1,147 @@
+#include "include/rb-latch-tree.h"
+
+#include <stdlib.h>
+#include <assert.h>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+// Every file that links or relinks nodes must be built with it, rb-tree.c above all.
+#if !RB_TREE_LOCKLESS_READERS
+#error "The lockless trees need RB_TREE_LOCKLESS_READERS=1 for the whole build."
+#endif
+
+/*
+    Sequence counter accesses. x86 doesn't reorder loads with loads nor stores with stores,
+    so on MSVC (x86 and x64 only) the fences only have to stop the compiler.
+*/
+#if defined(_MSC_VER)
+#define RbLoadSequence(ptr) (*(const volatile uint32_t*)(ptr))
+#define RbStoreSequence(ptr, value) (*(volatile uint32_t*)(ptr) = (value))
+#define RbReadFence() _ReadWriteBarrier()
+#define RbWriteFence() _ReadWriteBarrier()
+#define RbCpuRelax() _mm_pause()
+#else
+#define RbLoadSequence(ptr) __atomic_load_n((ptr), __ATOMIC_ACQUIRE)
+#define RbStoreSequence(ptr, value) __atomic_store_n((ptr), (value), __ATOMIC_RELAXED)
+#define RbReadFence() __atomic_thread_fence(__ATOMIC_ACQUIRE)
+#define RbWriteFence() __atomic_thread_fence(__ATOMIC_RELEASE)
+#if defined(__i386__) || defined(__x86_64__)
+#define RbCpuRelax() __builtin_ia32_pause()
+#else
+#define RbCpuRelax() ((void)0)
+#endif
+#endif
+
+// A legal rb-tree is never deeper than this (it would need 2^64 nodes),
+// but a lookup may run in a cycle for a moment while a writer is rotating, so it gives up here.
+enum { kMaxLocklessDepth = 128 };
+
+static RbNode* WalkLockless(const RbRoot* root, RbCompareFunc compare, const void* key) {
+    RbNode* node = RbReadLink(root->rb_node);
+    for (int depth = 0; node != NULL && depth < kMaxLocklessDepth; ++depth) {
+        int result = compare(node, key);
+        if (result == 0) {
+            return node;
+        }
+        node = result > 0 ? RbReadLink(node->left) : RbReadLink(node->right);
+    }
+    return NULL;
+}
+
+void BeginRbSeqWrite(RbSeqRoot* root) {
+    assert((root->sequence & 1) == 0);
+    RbStoreSequence(&root->sequence, root->sequence + 1);
+    RbWriteFence();
+}
+
+void EndRbSeqWrite(RbSeqRoot* root) {
+    assert((root->sequence & 1) == 1);
+    RbWriteFence();
+    RbStoreSequence(&root->sequence, root->sequence + 1);
+}
+
+RbNode* FindInRbSeqTree(const RbSeqRoot* root, RbCompareFunc compare, const void* key) {
+    for (;;) {
+        uint32_t sequence = RbLoadSequence(&root->sequence);
+        // An odd sequence means a write is in progress.
+        if (sequence & 1) {
+            RbCpuRelax();
+            continue;
+        }
+        RbNode* node = WalkLockless(&root->rb_root, compare, key);
+        RbReadFence();
+        if (RbLoadSequence(&root->sequence) == sequence) {
+            return node;
+        }
+    }
+}
+
+/* Latch tree */
+static RbLatchNode* LatchNodeOf(const RbNode* node, int index) {
+    return ContainerOf(node - index, RbLatchNode, rb_node[0]);
+}
+
+static RbLatchNode* WalkLatchCopy(const RbRoot* root, int index, RbLatchCompareFunc compare, const void* key) {
+    RbNode* node = RbReadLink(root->rb_node);
+    for (int depth = 0; node != NULL && depth < kMaxLocklessDepth; ++depth) {
+        RbLatchNode* latch_node = LatchNodeOf(node, index);
+        int result = compare(latch_node, key);
+        if (result == 0) {
+            return latch_node;
+        }
+        node = result > 0 ? RbReadLink(node->left) : RbReadLink(node->right);
+    }
+    return NULL;
+}
+
+// Moves the lookups to the other copy of the tree.
+static void FlipRbLatch(RbLatchRoot* root) {
+    RbWriteFence();
+    RbStoreSequence(&root->sequence, root->sequence + 1);
+    RbWriteFence();
+}
+
+static void InsertIntoLatchCopy(RbLatchNode* node, RbLatchRoot* root, int index, RbLatchLessFunc less) {
+    RbNode** link = &root->tree[index].rb_node;
+    RbNode* parent = NULL;
+    while (*link != NULL) {
+        parent = *link;
+        link = less(node, LatchNodeOf(parent, index)) ? &parent->left : &parent->right;
+    }
+    InsertIntoRbTree(&node->rb_node[index], parent, link, &root->tree[index]);
+}
+
+/*
+    Lookups use the copy picked by the lowest bit of the sequence.
+    The first flip sends them to copy 1 while copy 0 changes, and the second one sends them
+    back to copy 0, which is complete again, while copy 1 catches up.
+*/
+void InsertIntoRbLatchTree(RbLatchNode* node, RbLatchRoot* root, RbLatchLessFunc less) {
+    assert((root->sequence & 1) == 0);
+    FlipRbLatch(root);
+    InsertIntoLatchCopy(node, root, 0, less);
+    FlipRbLatch(root);
+    InsertIntoLatchCopy(node, root, 1, less);
+}
+
+void RemoveFromRbLatchTree(RbLatchNode* node, RbLatchRoot* root) {
+    assert((root->sequence & 1) == 0);
+    FlipRbLatch(root);
+    RemoveFromRbTree(&node->rb_node[0], &root->tree[0]);
+    FlipRbLatch(root);
+    RemoveFromRbTree(&node->rb_node[1], &root->tree[1]);
+}
+
+RbLatchNode* FindInRbLatchTree(const RbLatchRoot* root, RbLatchCompareFunc compare, const void* key) {
+    for (;;) {
+        uint32_t sequence = RbLoadSequence(&root->sequence);
+        int index = sequence & 1;
+        RbLatchNode* node = WalkLatchCopy(&root->tree[index], index, compare, key);
+        RbReadFence();
+        if (RbLoadSequence(&root->sequence) == sequence) {
+            return node;
+        }
+    }
+}
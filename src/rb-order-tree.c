@@ -0,0 +1,54 @@
+#include "include/rb-order-tree.h"
+#include "include/rb-tree-augmented.h"
+
+#include <stdlib.h>
+#include <assert.h>
+
+static size_t SubtreeSize(const RbNode* node) {
+    return node ? ContainerOf(node, RbSizedNode, rb_node)->size : 0;
+}
+
+static size_t ComputeSize(RbSizedNode* node) {
+    return SubtreeSize(node->rb_node.left) + SubtreeSize(node->rb_node.right) + 1;
+}
+
+DeclareRbAugmentCallbacks(static, kSizeCallbacks, RbSizedNode, rb_node, size, ComputeSize)
+
+void InsertIntoRbSizedTree(RbSizedNode* node, RbNode* parent, RbNode** parent_link, RbRoot* root) {
+    InsertIntoRbTreeAugmented(&node->rb_node, parent, parent_link, root, &kSizeCallbacks);
+}
+
+void RemoveFromRbSizedTree(RbSizedNode* node, RbRoot* root) {
+    RemoveFromRbTreeAugmented(&node->rb_node, root, &kSizeCallbacks);
+}
+
+RbSizedNode* SelectFromRbSizedTree(const RbRoot* root, size_t k) {
+    RbNode* node = root->rb_node;
+    while (node != NULL) {
+        size_t left_size = SubtreeSize(node->left);
+        if (k < left_size) {
+            node = node->left;
+        } else if (k > left_size) {
+            k -= left_size + 1;
+            node = node->right;
+        } else {
+            return ContainerOf(node, RbSizedNode, rb_node);
+        }
+    }
+    return NULL;
+}
+
+size_t RankOfRbSizedNode(const RbSizedNode* node) {
+    assert(node != NULL);
+    const RbNode* cur = &node->rb_node;
+    size_t rank = SubtreeSize(cur->left);
+    // Every time we come up from a right child, the parent and its left subtree are before `node`.
+    RbNode* parent = NULL;
+    while ((parent = GetParent(cur)) != NULL) {
+        if (cur == parent->right) {
+            rank += SubtreeSize(parent->left) + 1;
+        }
+        cur = parent;
+    }
+    return rank;
+}
@@ -0,0 +1,1115 @@
+#include "include/rb-tree-bench.h"
+
+#include <iostream>
+#include <algorithm>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <atomic>
+
+#include <climits>
+#include <cstdio>
+#include <cstring>
+#include <cassert>
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include "include/rb-tree.h"
+#include "include/my-rb-tree.h"
+#include "include/rb-latch-tree.h"
+#include "include/my-sharded-rb-tree.h"
+#include "include/my-rb-tree-snapshot.h"
+#include "include/persistent-rb-tree.h"
+#include "include/my-bucket-rb-tree.h"
+#include "include/node-pool.h"
+#include "include/work-stealing-pool.h"
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+double SecondsSince(Clock::time_point start) {
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+/*
+    Counts the cache misses of this thread with perf_event_open on Linux.
+    Elsewhere, or without access to the hardware counters, every count is -1.
+*/
+class CacheMissCounter {
+public:
+    enum Event { kL1dReadMiss, kLlcReadMiss, kDtlbReadMiss, kEventNum };
+
+    CacheMissCounter() {
+        for (int event = 0; event < kEventNum; ++event) {
+            fds_[event] = -1;
+#if defined(__linux__)
+            static const uint64_t kCaches[kEventNum] = {
+                PERF_COUNT_HW_CACHE_L1D, PERF_COUNT_HW_CACHE_LL, PERF_COUNT_HW_CACHE_DTLB,
+            };
+            perf_event_attr attr;
+            memset(&attr, 0, sizeof(attr));
+            attr.size = sizeof(attr);
+            attr.type = PERF_TYPE_HW_CACHE;
+            attr.config = kCaches[event] | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+            attr.disabled = 1;
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            fds_[event] = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+#endif
+        }
+    }
+
+    ~CacheMissCounter() {
+#if defined(__linux__)
+        for (int fd : fds_) {
+            if (fd >= 0) close(fd);
+        }
+#endif
+    }
+
+    void Start() {
+#if defined(__linux__)
+        for (int fd : fds_) {
+            if (fd >= 0) {
+                ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+                ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+            }
+        }
+#endif
+    }
+
+    void Stop() {
+#if defined(__linux__)
+        for (int fd : fds_) {
+            if (fd >= 0) ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+        }
+#endif
+    }
+
+    int64_t Read(Event event) const {
+        int64_t count = -1;
+#if defined(__linux__)
+        if (fds_[event] >= 0 && read(fds_[event], &count, sizeof(count)) != sizeof(count)) {
+            count = -1;
+        }
+#endif
+        return count;
+    }
+
+private:
+    int fds_[kEventNum];
+};
+
+}  // namespace
+
+void BenchRbNodeLayout(int node_num, int lookup_num) {
+    std::mt19937 gen(20250101);
+    std::uniform_int_distribution<int> dis(0, node_num * 4);
+
+    // Keep all nodes in one array, so the malloc header doesn't hide the node size.
+    std::vector<MyData> datas(node_num);
+    for (MyData& data : datas) {
+        data.value = dis(gen);
+    }
+
+    RbRoot root = InitializedRbRoot;
+    auto start = Clock::now();
+    for (MyData& data : datas) {
+        MyInsertIntoRbTree(&data, &root);
+    }
+    double insert_seconds = SecondsSince(start);
+
+    std::vector<int> keys(lookup_num);
+    for (int& key : keys) {
+        key = datas[gen() % node_num].value;
+    }
+
+    size_t found = 0;
+    start = Clock::now();
+    for (int key : keys) {
+        if (MyFindInRbTree(key, &root) != nullptr) {
+            ++found;
+        }
+    }
+    double lookup_seconds = SecondsSince(start);
+
+    printf("[node layout] layout=%s sizeof(RbNode)=%zu sizeof(MyData)=%zu total=%.1fMB\n",
+           RB_TREE_COMPACT_NODE ? "compact" : "plain",
+           sizeof(RbNode), sizeof(MyData), sizeof(MyData) * datas.size() / 1048576.0);
+    printf("[node layout] nodes=%d insert=%.3fs lookups=%d found=%zu lookup=%.2fMops/s\n",
+           node_num, insert_seconds, lookup_num, found, lookup_num / lookup_seconds / 1e6);
+}
+
+void BenchTimerQueue(int timer_num, int op_num) {
+    std::mt19937 gen(20250102);
+    std::uniform_int_distribution<int> delay(1, timer_num);
+
+    std::vector<int> deadlines(timer_num);
+    for (int& deadline : deadlines) {
+        deadline = delay(gen);
+    }
+    std::vector<int> delays(op_num);
+    for (int& d : delays) {
+        d = delay(gen);
+    }
+
+    std::vector<MyData> timers(timer_num);
+    for (int i = 0; i < timer_num; ++i) {
+        timers[i].value = deadlines[i];
+    }
+    RbRoot root = InitializedRbRoot;
+    for (MyData& timer : timers) {
+        MyInsertIntoRbTree(&timer, &root);
+    }
+    long long checksum = 0;
+    auto start = Clock::now();
+    for (int d : delays) {
+        RbNode* node = FirstRbNode(&root);
+        RemoveFromRbTree(node, &root);
+        MyData* timer = ContainerOf(node, struct MyData, rb_node);
+        checksum += timer->value;
+        timer->value += d;
+        MyInsertIntoRbTree(timer, &root);
+    }
+    double plain_seconds = SecondsSince(start);
+
+    for (int i = 0; i < timer_num; ++i) {
+        timers[i].value = deadlines[i];
+    }
+    RbRootCached cached_root = InitializedRbRootCached;
+    for (MyData& timer : timers) {
+        MyInsertIntoRbTreeCached(&timer, &cached_root);
+    }
+    long long cached_checksum = 0;
+    start = Clock::now();
+    for (int d : delays) {
+        MyData* timer = MyPopMinFromRbTreeCached(&cached_root);
+        cached_checksum += timer->value;
+        timer->value += d;
+        MyInsertIntoRbTreeCached(timer, &cached_root);
+    }
+    double cached_seconds = SecondsSince(start);
+
+    printf("[timer queue] timers=%d ops=%d plain=%.2fMops/s cached=%.2fMops/s same_order=%s\n",
+           timer_num, op_num, op_num / plain_seconds / 1e6, op_num / cached_seconds / 1e6,
+           checksum == cached_checksum ? "yes" : "no");
+}
+
+void BenchOrderStatistics(int node_num, int query_num, int linear_query_num) {
+    std::mt19937 gen(20250103);
+    std::uniform_int_distribution<int> dis(0, node_num * 4);
+
+    std::vector<MyRankedData> datas(node_num);
+    RbRoot root = InitializedRbRoot;
+    for (MyRankedData& data : datas) {
+        data.value = dis(gen);
+        MyInsertIntoRankedRbTree(&data, &root);
+    }
+
+    std::vector<size_t> ks(query_num);
+    for (size_t& k : ks) {
+        k = gen() % node_num;
+    }
+
+    // select(k) and rank(value) with subtree sizes.
+    long long checksum = 0;
+    auto start = Clock::now();
+    for (size_t k : ks) {
+        checksum += MySelectInRankedRbTree(k, &root)->value;
+    }
+    double select_seconds = SecondsSince(start);
+    start = Clock::now();
+    for (size_t k : ks) {
+        checksum += MyRankInRankedRbTree(static_cast<int>(k) * 4, &root);
+    }
+    double rank_seconds = SecondsSince(start);
+
+    // The same queries with in-order walks.
+    long long linear_checksum = 0;
+    start = Clock::now();
+    for (int i = 0; i < linear_query_num; ++i) {
+        RbNode* node = FirstRbNode(&root);
+        for (size_t step = 0; step < ks[i]; ++step) {
+            node = NextRbNode(node);
+        }
+        linear_checksum += ContainerOf(node, struct MyRankedData, rb_node.rb_node)->value;
+    }
+    double linear_select_seconds = SecondsSince(start);
+    start = Clock::now();
+    for (int i = 0; i < linear_query_num; ++i) {
+        int value = static_cast<int>(ks[i]) * 4;
+        size_t rank = 0;
+        for (RbNode* node = FirstRbNode(&root); node != nullptr; node = NextRbNode(node)) {
+            if (ContainerOf(node, struct MyRankedData, rb_node.rb_node)->value >= value) {
+                break;
+            }
+            ++rank;
+        }
+        linear_checksum += rank;
+    }
+    double linear_rank_seconds = SecondsSince(start);
+
+    // The walks only answer the first queries, so check the fast answers to those against them.
+    long long fast_checksum = 0;
+    for (int i = 0; i < linear_query_num; ++i) {
+        fast_checksum += MySelectInRankedRbTree(ks[i], &root)->value;
+        fast_checksum += MyRankInRankedRbTree(static_cast<int>(ks[i]) * 4, &root);
+    }
+
+    printf("[order statistics] nodes=%d select=%.3fus rank=%.3fus linear_select=%.1fus linear_rank=%.1fus"
+           " checksum=%lld match=%s\n",
+           node_num, select_seconds / query_num * 1e6, rank_seconds / query_num * 1e6,
+           linear_select_seconds / linear_query_num * 1e6, linear_rank_seconds / linear_query_num * 1e6,
+           checksum, fast_checksum == linear_checksum ? "yes" : "no");
+}
+
+void BenchBulkBuild(int node_num) {
+    std::vector<MyData> datas(node_num);
+    std::vector<MyData*> sorted_datas(node_num);
+    for (int i = 0; i < node_num; ++i) {
+        datas[i].value = i * 2;
+        sorted_datas[i] = &datas[i];
+    }
+
+    RbRoot root = InitializedRbRoot;
+    auto start = Clock::now();
+    for (MyData* data : sorted_datas) {
+        MyInsertIntoRbTree(data, &root);
+    }
+    double insert_seconds = SecondsSince(start);
+
+    root = InitializedRbRoot;
+    start = Clock::now();
+    MyBuildRbTreeFromSorted(sorted_datas.data(), sorted_datas.size(), &root);
+    double build_seconds = SecondsSince(start);
+
+    printf("[bulk build] nodes=%d repeated_insert=%.3fs bulk_build=%.3fs legal=%s\n",
+           node_num, insert_seconds, build_seconds, IsLegalRbTree(&root) ? "yes" : "no");
+}
+
+void BenchNodeAllocator(int node_num, int round_num) {
+    std::mt19937 gen(20250104);
+    std::vector<int> values(node_num);
+    for (int& value : values) {
+        value = static_cast<int>(gen());
+    }
+    std::vector<MyData*> datas(node_num);
+
+    double malloc_insert_seconds = 0;
+    double malloc_remove_seconds = 0;
+    for (int round = 0; round < round_num; ++round) {
+        RbRoot root = InitializedRbRoot;
+        auto start = Clock::now();
+        for (int i = 0; i < node_num; ++i) {
+            datas[i] = static_cast<MyData*>(malloc(sizeof(MyData)));
+            datas[i]->value = values[i];
+            MyInsertIntoRbTree(datas[i], &root);
+        }
+        malloc_insert_seconds += SecondsSince(start);
+        start = Clock::now();
+        for (MyData* data : datas) {
+            RemoveFromRbTree(&data->rb_node, &root);
+            free(data);
+        }
+        malloc_remove_seconds += SecondsSince(start);
+    }
+
+    double pool_insert_seconds = 0;
+    double pool_remove_seconds = 0;
+    for (int round = 0; round < round_num; ++round) {
+        RbRoot root = InitializedRbRoot;
+        auto start = Clock::now();
+        for (int i = 0; i < node_num; ++i) {
+            datas[i] = NewMyData(values[i]);
+            MyInsertIntoRbTree(datas[i], &root);
+        }
+        pool_insert_seconds += SecondsSince(start);
+        start = Clock::now();
+        for (MyData* data : datas) {
+            MyRemoveFromRbTree(data, &root);
+        }
+        pool_remove_seconds += SecondsSince(start);
+    }
+
+    RbRoot root = InitializedRbRoot;
+    for (int i = 0; i < node_num; ++i) {
+        MyInsertIntoRbTree(NewMyData(values[i]), &root);
+    }
+    auto start = Clock::now();
+    DeleteAllMyData();
+    root = InitializedRbRoot;
+    double teardown_seconds = SecondsSince(start);
+
+    double ops = static_cast<double>(node_num) * round_num;
+    printf("[node allocator] nodes=%d malloc: insert=%.2fMops/s remove=%.2fMops/s"
+           " pool: insert=%.2fMops/s remove=%.2fMops/s teardown=%.3fms\n",
+           node_num, ops / malloc_insert_seconds / 1e6, ops / malloc_remove_seconds / 1e6,
+           ops / pool_insert_seconds / 1e6, ops / pool_remove_seconds / 1e6, teardown_seconds * 1e3);
+}
+
+void BenchHintedInsert(int node_num) {
+    std::mt19937 gen(20250106);
+    std::vector<int> monotone(node_num);
+    std::vector<int> disordered(node_num);
+    for (int i = 0; i < node_num; ++i) {
+        monotone[i] = disordered[i] = i * 2;
+        // 1% of the values arrive up to 1000 positions late.
+        if (gen() % 100 == 0) {
+            disordered[i] = std::max(0, i - static_cast<int>(gen() % 1000)) * 2 + 1;
+        }
+    }
+
+    std::vector<MyData> datas(node_num);
+    for (const std::vector<int>* values : { &monotone, &disordered }) {
+        for (int i = 0; i < node_num; ++i) {
+            datas[i].value = (*values)[i];
+        }
+
+        RbRootCached cached_root = InitializedRbRootCached;
+        auto start = Clock::now();
+        for (MyData& data : datas) {
+            MyInsertIntoRbTreeCached(&data, &cached_root);
+        }
+        double insert_seconds = SecondsSince(start);
+
+        cached_root = InitializedRbRootCached;
+        start = Clock::now();
+        for (MyData& data : datas) {
+            MyAppendToRbTreeCached(&data, &cached_root);
+        }
+        double append_seconds = SecondsSince(start);
+        bool legal = IsLegalRbTree(&cached_root.rb_root);
+
+        RbRoot root = InitializedRbRoot;
+        MyData* hint = nullptr;
+        start = Clock::now();
+        for (MyData& data : datas) {
+            MyInsertIntoRbTreeWithHint(&data, hint, &root);
+            hint = &data;
+        }
+        double hint_seconds = SecondsSince(start);
+        legal = legal && IsLegalRbTree(&root);
+
+        const char* stream = values == &monotone ? "monotone" : "1%-disordered";
+        printf("[hinted insert] stream=%s nodes=%d cached: insert=%.2fMops/s append=%.2fMops/s\n",
+               stream, node_num, node_num / insert_seconds / 1e6, node_num / append_seconds / 1e6);
+        printf("[hinted insert] stream=%s nodes=%d uncached: hint_prev=%.2fMops/s legal=%s\n",
+               stream, node_num, node_num / hint_seconds / 1e6, legal ? "yes" : "no");
+    }
+}
+
+void BenchEraseRange(int node_num, int window_num) {
+    std::mt19937 gen(20250107);
+    std::vector<int> values(node_num);
+    for (int& value : values) {
+        value = static_cast<int>(gen() % (node_num * 4u));
+    }
+    int window_size = node_num * 4 / window_num;
+
+    // Start both trees from an empty pool, so their nodes are laid out the same way.
+    DeleteAllMyData();
+    RbRootCached root = InitializedRbRootCached;
+    for (int value : values) {
+        MyInsertIntoRbTreeCached(NewMyData(value), &root);
+    }
+    auto start = Clock::now();
+    for (int window = 1; window <= window_num; ++window) {
+        RbNode* node = nullptr;
+        while ((node = PeekMinInRbTreeCached(&root)) != nullptr &&
+               ContainerOf(node, struct MyData, rb_node)->value < window * window_size) {
+            MyRemoveFromRbTreeCached(ContainerOf(node, struct MyData, rb_node), &root);
+        }
+    }
+    double remove_seconds = SecondsSince(start);
+
+    DeleteAllMyData();
+    for (int value : values) {
+        MyInsertIntoRbTreeCached(NewMyData(value), &root);
+    }
+    size_t erased_num = 0;
+    start = Clock::now();
+    for (int window = 1; window <= window_num; ++window) {
+        erased_num += MyEraseRangeFromRbTreeCached(INT_MIN, window * window_size, &root);
+    }
+    double erase_range_seconds = SecondsSince(start);
+
+    printf("[erase range] nodes=%d windows=%d remove_one_by_one=%.3fs erase_range=%.3fs erased=%zu\n",
+           node_num, window_num, remove_seconds, erase_range_seconds, erased_num);
+}
+
+void BenchTeardown(int node_num) {
+    std::mt19937 gen(20250105);
+    std::vector<int> values(node_num);
+    for (int& value : values) {
+        value = static_cast<int>(gen());
+    }
+
+    // Start both trees from an empty pool, so their nodes are laid out the same way.
+    DeleteAllMyData();
+    RbRoot root = InitializedRbRoot;
+    for (int value : values) {
+        MyInsertIntoRbTree(NewMyData(value), &root);
+    }
+    auto start = Clock::now();
+    while (!IsEmptyRbRoot(&root)) {
+        MyRemoveFromRbTree(ContainerOf(root.rb_node, struct MyData, rb_node), &root);
+    }
+    double remove_seconds = SecondsSince(start);
+
+    DeleteAllMyData();
+    for (int value : values) {
+        MyInsertIntoRbTree(NewMyData(value), &root);
+    }
+    start = Clock::now();
+    MyDestroyRbTree(&root);
+    double destroy_seconds = SecondsSince(start);
+
+    printf("[teardown] nodes=%d remove_one_by_one=%.3fs postorder_destroy=%.3fs\n",
+           node_num, remove_seconds, destroy_seconds);
+}
+
+namespace {
+
+// Entry of the read scaling benchmark, linked into a plain tree and a latch tree at the same time.
+struct ConcurrentEntry {
+    RbNode rb_node;
+    RbLatchNode latch_node;
+    int value;
+};
+
+int CompareConcurrentEntry(const RbNode* node, const void* key) {
+    int value = ContainerOf(node, ConcurrentEntry, rb_node)->value;
+    int key_value = *static_cast<const int*>(key);
+    return value < key_value ? -1 : value > key_value ? 1 : 0;
+}
+
+int CompareLatchEntry(const RbLatchNode* node, const void* key) {
+    int value = ContainerOf(node, ConcurrentEntry, latch_node)->value;
+    int key_value = *static_cast<const int*>(key);
+    return value < key_value ? -1 : value > key_value ? 1 : 0;
+}
+
+bool LessLatchEntry(const RbLatchNode* a, const RbLatchNode* b) {
+    return ContainerOf(a, ConcurrentEntry, latch_node)->value < ContainerOf(b, ConcurrentEntry, latch_node)->value;
+}
+
+void InsertConcurrentEntry(ConcurrentEntry* entry, RbRoot* root) {
+    RbNode** link = &root->rb_node;
+    RbNode* parent = nullptr;
+    while (*link != nullptr) {
+        parent = *link;
+        link = entry->value < ContainerOf(parent, ConcurrentEntry, rb_node)->value ? &parent->left : &parent->right;
+    }
+    InsertIntoRbTree(&entry->rb_node, parent, link, root);
+}
+
+RbNode* FindConcurrentEntry(const RbRoot* root, int key) {
+    RbNode* node = root->rb_node;
+    while (node != nullptr) {
+        int result = CompareConcurrentEntry(node, &key);
+        if (result == 0) {
+            return node;
+        }
+        node = result > 0 ? node->left : node->right;
+    }
+    return nullptr;
+}
+
+/*
+    Runs `reader_num` threads calling `lookup(key)` and one thread calling `update(i)` for `seconds`.
+    Returns the lookups per second, and the updates per second through `update_rate`.
+*/
+template <typename Lookup, typename Update>
+double MeasureReadScaling(int reader_num, double seconds, const std::vector<int>& keys,
+                          Lookup lookup, Update update, double* update_rate) {
+    std::atomic<bool> stop(false);
+    std::atomic<uint64_t> lookup_num(0);
+    std::atomic<uint64_t> found_num(0);
+    std::vector<std::thread> readers;
+    for (int i = 0; i < reader_num; ++i) {
+        readers.emplace_back([&, i] {
+            size_t next = static_cast<size_t>(i) * keys.size() / reader_num;
+            uint64_t lookups = 0;
+            uint64_t found = 0;
+            while (!stop.load(std::memory_order_relaxed)) {
+                for (int j = 0; j < 64; ++j) {
+                    found += lookup(keys[next]);
+                    next = next + 1 == keys.size() ? 0 : next + 1;
+                }
+                lookups += 64;
+            }
+            lookup_num += lookups;
+            found_num += found;
+        });
+    }
+    uint64_t update_num = 0;
+    std::thread writer([&] {
+        while (!stop.load(std::memory_order_relaxed)) {
+            update(update_num++);
+            // Readers far outnumber writers, so don't let the writer hog a core.
+            std::this_thread::yield();
+        }
+    });
+
+    auto start = Clock::now();
+    std::this_thread::sleep_for(std::chrono::duration<double>(seconds));
+    stop = true;
+    for (std::thread& reader : readers) {
+        reader.join();
+    }
+    writer.join();
+    double elapsed = SecondsSince(start);
+    *update_rate = update_num / elapsed;
+    // Only the entry being reinserted by the writer may be missed.
+    assert(found_num * 100 >= lookup_num * 99);
+    return lookup_num / elapsed;
+}
+
+}  // namespace
+
+void BenchReadScaling(int node_num, int max_reader_num, double seconds) {
+    std::mt19937 gen(20250107);
+    std::vector<ConcurrentEntry> entries(node_num);
+    for (int i = 0; i < node_num; ++i) {
+        entries[i].value = i * 2;
+    }
+    std::shuffle(entries.begin(), entries.end(), gen);
+    std::vector<int> keys(node_num);
+    for (int i = 0; i < node_num; ++i) {
+        keys[i] = entries[gen() % node_num].value;
+    }
+
+    RbSeqRoot seq_root = InitializedRbSeqRoot;
+    RbLatchRoot latch_root = InitializedRbLatchRoot;
+    for (ConcurrentEntry& entry : entries) {
+        InsertConcurrentEntry(&entry, &seq_root.rb_root);
+        InsertIntoRbLatchTree(&entry.latch_node, &latch_root, LessLatchEntry);
+    }
+
+    // The writer removes and reinserts one entry after another, which rotates the trees like any other change.
+    std::mutex mutex;
+
+    for (int reader_num = 1; reader_num <= max_reader_num; reader_num *= 2) {
+        double mutex_updates = 0.0;
+        double mutex_lookups = MeasureReadScaling(
+            reader_num, seconds, keys,
+            [&](int key) {
+                std::lock_guard<std::mutex> lock(mutex);
+                return FindConcurrentEntry(&seq_root.rb_root, key) != nullptr;
+            },
+            [&](uint64_t i) {
+                std::lock_guard<std::mutex> lock(mutex);
+                ConcurrentEntry* entry = &entries[i % node_num];
+                RemoveFromRbTree(&entry->rb_node, &seq_root.rb_root);
+                InsertConcurrentEntry(entry, &seq_root.rb_root);
+            },
+            &mutex_updates);
+
+        double seq_updates = 0.0;
+        double seq_lookups = MeasureReadScaling(
+            reader_num, seconds, keys,
+            [&](int key) {
+                return FindInRbSeqTree(&seq_root, CompareConcurrentEntry, &key) != nullptr;
+            },
+            [&](uint64_t i) {
+                std::lock_guard<std::mutex> lock(mutex);
+                ConcurrentEntry* entry = &entries[i % node_num];
+                BeginRbSeqWrite(&seq_root);
+                RemoveFromRbTree(&entry->rb_node, &seq_root.rb_root);
+                InsertConcurrentEntry(entry, &seq_root.rb_root);
+                EndRbSeqWrite(&seq_root);
+            },
+            &seq_updates);
+
+        double latch_updates = 0.0;
+        double latch_lookups = MeasureReadScaling(
+            reader_num, seconds, keys,
+            [&](int key) {
+                return FindInRbLatchTree(&latch_root, CompareLatchEntry, &key) != nullptr;
+            },
+            [&](uint64_t i) {
+                std::lock_guard<std::mutex> lock(mutex);
+                ConcurrentEntry* entry = &entries[i % node_num];
+                RemoveFromRbLatchTree(&entry->latch_node, &latch_root);
+                InsertIntoRbLatchTree(&entry->latch_node, &latch_root, LessLatchEntry);
+            },
+            &latch_updates);
+
+        printf("[read scaling] nodes=%d readers=%d lookups: mutex=%.2fM/s seqcount=%.2fM/s latch=%.2fM/s"
+               " updates: mutex=%.2fK/s seqcount=%.2fK/s latch=%.2fK/s\n",
+               node_num, reader_num, mutex_lookups / 1e6, seq_lookups / 1e6, latch_lookups / 1e6,
+               mutex_updates / 1e3, seq_updates / 1e3, latch_updates / 1e3);
+    }
+}
+
+void BenchShardedWrites(int node_num, int max_thread_num, int op_num, int shard_num) {
+    // Shards start out split over the whole int range, but the keys are in [0, 2 * node_num),
+    // so they all land in the middle shards and the online rebalancing has to spread them.
+    MyShardedRbTree sharded(shard_num);
+    RbRoot root = InitializedRbRoot;
+    std::mutex mutex;
+    std::mt19937 gen(20250108);
+    for (int i = 0; i < node_num; ++i) {
+        int value = static_cast<int>(gen() % (node_num * 2u));
+        sharded.Insert(value);
+        MyData* data = NewMyData(value);
+        if (MyInsertUniqueIntoRbTree(data, &root) != nullptr) {
+            DeleteMyData(data);
+        }
+    }
+    size_t max_shard_size = 0;
+    for (int i = 0; i < shard_num; ++i) {
+        max_shard_size = std::max(max_shard_size, sharded.GetShardSize(i));
+    }
+    printf("[sharded writes] nodes=%zu shards=%d largest_shard=%zu after online rebalancing\n",
+           sharded.GetSize(), shard_num, max_shard_size);
+
+    // Every thread inserts a random key and removes another one, so the size stays about the same.
+    auto run = [&](int thread_num, bool use_shards) {
+        std::vector<std::thread> threads;
+        auto start = Clock::now();
+        for (int t = 0; t < thread_num; ++t) {
+            threads.emplace_back([&, t] {
+                std::mt19937 thread_gen(20250108 + t);
+                for (int i = 0; i < op_num; ++i) {
+                    int insert_value = static_cast<int>(thread_gen() % (node_num * 2u));
+                    int remove_value = static_cast<int>(thread_gen() % (node_num * 2u));
+                    if (use_shards) {
+                        sharded.Insert(insert_value);
+                        sharded.Remove(remove_value);
+                        continue;
+                    }
+                    MyData* data = NewMyData(insert_value);
+                    MyData* removed = nullptr;
+                    {
+                        std::lock_guard<std::mutex> lock(mutex);
+                        if (MyInsertUniqueIntoRbTree(data, &root) == nullptr) {
+                            data = nullptr;
+                        }
+                        removed = MyFindInRbTree(remove_value, &root);
+                        if (removed != nullptr) {
+                            RemoveFromRbTree(&removed->rb_node, &root);
+                        }
+                    }
+                    if (data != nullptr) DeleteMyData(data);
+                    if (removed != nullptr) DeleteMyData(removed);
+                }
+            });
+        }
+        for (std::thread& thread : threads) {
+            thread.join();
+        }
+        return 2.0 * op_num * thread_num / SecondsSince(start);
+    };
+    for (int thread_num = 1; thread_num <= max_thread_num; thread_num *= 2) {
+        double locked_rate = run(thread_num, false);
+        double sharded_rate = run(thread_num, true);
+        printf("[sharded writes] threads=%d single_lock=%.2fMops/s sharded=%.2fMops/s\n",
+               thread_num, locked_rate / 1e6, sharded_rate / 1e6);
+    }
+
+    std::vector<int> values;
+    sharded.VisitRange(INT_MIN, INT_MAX, [&](const MyData* data) { values.push_back(data->value); });
+    bool ordered = std::is_sorted(values.begin(), values.end()) && values.size() == sharded.GetSize();
+    printf("[sharded writes] ordered_scan=%s\n", ordered ? "yes" : "no");
+    MyDestroyRbTree(&root);
+}
+
+void BenchSnapshot(int node_num, int lookup_num) {
+    const char* path = "rb-tree-bench.snapshot";
+    std::mt19937 gen(20250109);
+    std::vector<int> values(node_num);
+    for (int& value : values) {
+        value = static_cast<int>(gen());
+    }
+
+    // What every restart does today.
+    DeleteAllMyData();
+    RbRoot root = InitializedRbRoot;
+    auto start = Clock::now();
+    for (int value : values) {
+        MyInsertIntoRbTree(NewMyData(value), &root);
+    }
+    double rebuild_seconds = SecondsSince(start);
+
+    start = Clock::now();
+    bool written = MyWriteRbTreeSnapshot(&root, path);
+    double write_seconds = SecondsSince(start);
+
+    MyRbTreeSnapshot snapshot;
+    start = Clock::now();
+    bool opened = snapshot.Open(path) && snapshot.Contains(values[0]);
+    double open_seconds = SecondsSince(start);
+
+    std::vector<int> keys(lookup_num);
+    for (int& key : keys) {
+        key = values[gen() % node_num];
+    }
+    size_t found = 0;
+    start = Clock::now();
+    for (int key : keys) {
+        found += MyFindInRbTree(key, &root) != nullptr;
+    }
+    double tree_lookup_seconds = SecondsSince(start);
+    start = Clock::now();
+    for (int key : keys) {
+        found += snapshot.Contains(key);
+    }
+    double snapshot_lookup_seconds = SecondsSince(start);
+
+    size_t tree_range = MyVisitRangeInRbTree(0, INT_MAX / 64, &root, [](MyData*) {});
+    size_t snapshot_range = snapshot.VisitRange(0, INT_MAX / 64, [](int) {});
+
+    MyDestroyRbTree(&root);
+    start = Clock::now();
+    bool loaded = snapshot.LoadInto(&root);
+    double load_seconds = SecondsSince(start);
+    loaded = loaded && IsLegalRbTree(&root);
+    MyDestroyRbTree(&root);
+    snapshot.Close();
+    std::remove(path);
+
+    printf("[snapshot] nodes=%d rebuild=%.3fs write=%.3fs open_and_lookup=%.3fms load=%.3fs ok=%s\n",
+           node_num, rebuild_seconds, write_seconds, open_seconds * 1e3, load_seconds,
+           written && opened && loaded && tree_range == snapshot_range ? "yes" : "no");
+    printf("[snapshot] lookups=%d tree=%.2fMops/s mapped=%.2fMops/s found=%zu\n",
+           lookup_num, lookup_num / tree_lookup_seconds / 1e6, lookup_num / snapshot_lookup_seconds / 1e6, found);
+}
+
+void BenchCompaction(int node_num, int churn_num, int lookup_num) {
+    std::mt19937 gen(20250110);
+    DeleteAllMyData();
+    RbRoot root = InitializedRbRoot;
+    std::vector<int> values(node_num);
+    for (int& value : values) {
+        value = static_cast<int>(gen());
+        MyInsertIntoRbTree(NewMyData(value), &root);
+    }
+    // Replace random nodes, so the pool hands out freed slots all over the heap.
+    for (int i = 0; i < churn_num; ++i) {
+        int& victim = values[gen() % node_num];
+        MyRemoveFromRbTree(MyFindInRbTree(victim, &root), &root);
+        victim = static_cast<int>(gen());
+        MyInsertIntoRbTree(NewMyData(victim), &root);
+    }
+    std::vector<int> keys(lookup_num);
+    for (int& key : keys) {
+        key = values[gen() % node_num];
+    }
+
+    CacheMissCounter counter;
+    auto measure = [&](const char* layout) {
+        size_t found = 0;
+        counter.Start();
+        auto start = Clock::now();
+        for (int key : keys) {
+            found += MyFindInRbTree(key, &root) != nullptr;
+        }
+        double seconds = SecondsSince(start);
+        counter.Stop();
+        auto per_lookup = [&](CacheMissCounter::Event event) {
+            int64_t count = counter.Read(event);
+            return count < 0 ? -1.0 : static_cast<double>(count) / lookup_num;
+        };
+        printf("[compaction] layout=%s lookups=%.2fMops/s found=%zu misses per lookup:"
+               " l1d=%.2f llc=%.2f dtlb=%.2f (-1 means no counter)\n",
+               layout, lookup_num / seconds / 1e6, found, per_lookup(CacheMissCounter::kL1dReadMiss),
+               per_lookup(CacheMissCounter::kLlcReadMiss), per_lookup(CacheMissCounter::kDtlbReadMiss));
+        return seconds;
+    };
+
+    double scattered_seconds = measure("scattered");
+    size_t scattered_footprint = GetMyDataFootprint();
+    auto start = Clock::now();
+    size_t moved_num = MyCompactRbTree(&root);
+    double compact_seconds = SecondsSince(start);
+    double compact_lookup_seconds = measure("compacted");
+    // A second pass moves the tree out of the first run, which must be released.
+    size_t compacted_footprint = GetMyDataFootprint();
+    MyCompactRbTree(&root);
+    printf("[compaction] nodes=%d churn=%d compact=%.3fs moved=%zu speedup=%.2fx legal=%s"
+           " footprint: scattered=%.1fMB compacted=%.1fMB recompacted=%.1fMB\n",
+           node_num, churn_num, compact_seconds, moved_num, scattered_seconds / compact_lookup_seconds,
+           IsLegalRbTree(&root) ? "yes" : "no", scattered_footprint / 1e6, compacted_footprint / 1e6,
+           GetMyDataFootprint() / 1e6);
+    MyDestroyRbTree(&root);
+}
+
+void BenchPersistentSnapshots(int node_num, int op_num, int snapshot_interval) {
+    std::mt19937 gen(20250111);
+    std::vector<int> values(node_num);
+    for (int& value : values) {
+        value = static_cast<int>(gen());
+    }
+    // Unique values, so that replacing one keeps the size of the tree.
+    std::sort(values.begin(), values.end());
+    values.erase(std::unique(values.begin(), values.end()), values.end());
+    std::shuffle(values.begin(), values.end(), gen);
+    node_num = static_cast<int>(values.size());
+
+    // What a reader needs today for a consistent view: a copy of the whole tree under the writer's lock.
+    DeleteAllMyData();
+    RbRoot root = InitializedRbRoot;
+    for (int value : values) {
+        MyInsertIntoRbTree(NewMyData(value), &root);
+    }
+    auto start = Clock::now();
+    std::vector<MyData*> copies;
+    copies.reserve(node_num);
+    for (RbNode* node = FirstRbNode(&root); node != nullptr; node = NextRbNode(node)) {
+        copies.push_back(NewMyData(ContainerOf(node, struct MyData, rb_node)->value));
+    }
+    RbRoot copy = InitializedRbRoot;
+    MyBuildRbTreeFromSorted(copies.data(), copies.size(), &copy);
+    double copy_seconds = SecondsSince(start);
+    MyDestroyRbTree(&copy);
+    MyDestroyRbTree(&root);
+
+    PersistentRbTree<int> tree;
+    for (int value : values) {
+        tree.insert(value);
+    }
+    const int snapshot_num = 1000000;
+    start = Clock::now();
+    for (int i = 0; i < snapshot_num; ++i) {
+        PersistentRbTree<int>::Snapshot snapshot = tree.snapshot();
+    }
+    double snapshot_seconds = SecondsSince(start);
+
+    // Replaces random values, and publishes a snapshot every `snapshot_interval` ops if `publish`.
+    // A reader thread looks up keys in the latest published snapshot, and drops the older ones.
+    auto run_writer = [&](bool publish, size_t* lookup_num, bool* consistent) {
+        std::mutex mutex;
+        PersistentRbTree<int>::Snapshot published = tree.snapshot();
+        std::atomic<bool> stop(false);
+        std::thread reader([&] {
+            size_t lookups = 0;
+            bool ok = true;
+            std::mt19937 reader_gen(7);
+            while (!stop.load(std::memory_order_relaxed)) {
+                PersistentRbTree<int>::Snapshot snapshot;
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    snapshot = published;
+                }
+                size_t found = 0;
+                for (int i = 0; i < 1000; ++i) {
+                    found += snapshot.contains(static_cast<int>(reader_gen()));
+                }
+                lookups += 1000;
+                // Nothing changes under a snapshot, however much the writer does meanwhile.
+                ok = ok && snapshot.size() == static_cast<size_t>(node_num) && found <= 1000;
+                std::this_thread::yield();
+            }
+            *lookup_num = lookups;
+            *consistent = ok;
+        });
+        auto writer_start = Clock::now();
+        for (int i = 0; i < op_num; ++i) {
+            int& victim = values[gen() % node_num];
+            int value = static_cast<int>(gen());
+            if (tree.insert(value)) {
+                tree.erase(victim);
+                victim = value;
+            }
+            if (publish && i % snapshot_interval == 0) {
+                PersistentRbTree<int>::Snapshot snapshot = tree.snapshot();
+                std::lock_guard<std::mutex> lock(mutex);
+                published = std::move(snapshot);
+            }
+        }
+        double seconds = SecondsSince(writer_start);
+        stop = true;
+        reader.join();
+        return seconds;
+    };
+    size_t plain_lookup_num = 0;
+    size_t published_lookup_num = 0;
+    bool plain_consistent = false;
+    bool published_consistent = false;
+    double plain_seconds = run_writer(false, &plain_lookup_num, &plain_consistent);
+    double published_seconds = run_writer(true, &published_lookup_num, &published_consistent);
+
+    printf("[persistent] nodes=%d copy_under_lock=%.3fms snapshot=%.1fns\n",
+           node_num, copy_seconds * 1e3, snapshot_seconds / snapshot_num * 1e9);
+    printf("[persistent] writer ops=%d no_snapshot=%.2fMops/s snapshot_every_%d=%.2fMops/s"
+           " reader_lookups=%zu/%zu consistent=%s\n",
+           op_num, op_num / plain_seconds / 1e6, snapshot_interval, op_num / published_seconds / 1e6,
+           plain_lookup_num, published_lookup_num, plain_consistent && published_consistent ? "yes" : "no");
+}
+
+void BenchBucketTree(int node_num, int lookup_num, int scan_num) {
+    std::mt19937 gen(20250112);
+    std::vector<int> values(node_num);
+    for (int& value : values) {
+        value = static_cast<int>(gen());
+    }
+    std::vector<int> keys(lookup_num);
+    for (int& key : keys) {
+        key = values[gen() % node_num];
+    }
+
+    DeleteAllMyData();
+    RbRoot root = InitializedRbRoot;
+    auto start = Clock::now();
+    for (int value : values) {
+        MyInsertIntoRbTree(NewMyData(value), &root);
+    }
+    double tree_insert_seconds = SecondsSince(start);
+    MyBucketRbTree buckets;
+    start = Clock::now();
+    for (int value : values) {
+        buckets.Insert(value);
+    }
+    double bucket_insert_seconds = SecondsSince(start);
+
+    size_t found = 0;
+    start = Clock::now();
+    for (int key : keys) {
+        found += MyFindInRbTree(key, &root) != nullptr;
+    }
+    double tree_lookup_seconds = SecondsSince(start);
+    start = Clock::now();
+    for (int key : keys) {
+        found += buckets.Contains(key);
+    }
+    double bucket_lookup_seconds = SecondsSince(start);
+
+    int64_t sum = 0;
+    start = Clock::now();
+    for (int i = 0; i < scan_num; ++i) {
+        MyVisitRangeInRbTree(INT_MIN, INT_MAX, &root, [&](MyData* data) { sum += data->value; });
+    }
+    double tree_scan_seconds = SecondsSince(start);
+    start = Clock::now();
+    for (int i = 0; i < scan_num; ++i) {
+        buckets.VisitRange(INT_MIN, INT_MAX, [&](int value) { sum += value; });
+    }
+    double bucket_scan_seconds = SecondsSince(start);
+
+    // MyData come from a NodePool too, so compare the slot sizes.
+    NodePool* pool = CreateNodePool(sizeof(MyData));
+    size_t data_slot_size = GetNodePoolSlotSize(pool);
+    DestroyNodePool(pool);
+    MyDestroyRbTree(&root);
+
+    double scanned = static_cast<double>(node_num) * scan_num;
+    printf("[buckets] values=%d nodes: tree=%d buckets=%zu bytes/value: tree=%zu buckets=%.1f legal=%s\n",
+           node_num, node_num, buckets.GetBucketNum(), data_slot_size,
+           static_cast<double>(buckets.GetMemoryUsage()) / buckets.GetSize(), buckets.Check() ? "yes" : "no");
+    printf("[buckets] insert: tree=%.2fMops/s buckets=%.2fMops/s lookup: tree=%.2fMops/s buckets=%.2fMops/s found=%zu\n",
+           node_num / tree_insert_seconds / 1e6, node_num / bucket_insert_seconds / 1e6,
+           lookup_num / tree_lookup_seconds / 1e6, lookup_num / bucket_lookup_seconds / 1e6, found);
+    printf("[buckets] scan: tree=%.1fM values/s buckets=%.1fM values/s sum=%lld\n",
+           scanned / tree_scan_seconds / 1e6, scanned / bucket_scan_seconds / 1e6, static_cast<long long>(sum));
+}
+
+void BenchSetOperations(int node_num, int other_num, int max_thread_num) {
+    std::mt19937 gen(20250113);
+    std::vector<int> a_values(node_num);
+    for (int& value : a_values) {
+        value = static_cast<int>(gen());
+    }
+    // Half of `b` overlaps with `a`, so every operation keeps and drops a fair share.
+    std::vector<int> b_values(other_num);
+    for (int i = 0; i < other_num; ++i) {
+        b_values[i] = i % 2 ? a_values[gen() % node_num] : static_cast<int>(gen());
+    }
+    for (std::vector<int>* values : { &a_values, &b_values }) {
+        std::sort(values->begin(), values->end());
+        values->erase(std::unique(values->begin(), values->end()), values->end());
+    }
+    auto build = [](const std::vector<int>& values, RbRoot* root) {
+        std::vector<MyData*> datas(values.size());
+        for (size_t i = 0; i < values.size(); ++i) {
+            datas[i] = NewMyData(values[i]);
+        }
+        *root = InitializedRbRoot;
+        MyBuildRbTreeFromSorted(datas.data(), datas.size(), root);
+    };
+
+    // What reconciling two sets takes today: walk one tree and insert into or remove from the other.
+    DeleteAllMyData();
+    RbRoot a = InitializedRbRoot;
+    RbRoot b = InitializedRbRoot;
+    build(a_values, &a);
+    build(b_values, &b);
+    auto start = Clock::now();
+    RbNode* node = nullptr;
+    RbNode* next = nullptr;
+    RbPostorderForEachSafe(node, next, &b) {
+        MyData* data = ContainerOf(node, struct MyData, rb_node);
+        if (MyInsertUniqueIntoRbTree(data, &a) != nullptr) {
+            DeleteMyData(data);
+        }
+    }
+    b.rb_node = nullptr;
+    double insert_seconds = SecondsSince(start);
+    MyDestroyRbTree(&a);
+    build(a_values, &a);
+    build(b_values, &b);
+    start = Clock::now();
+    for (node = FirstRbNode(&b); node != nullptr; node = NextRbNode(node)) {
+        MyData* data = MyFindInRbTree(ContainerOf(node, struct MyData, rb_node)->value, &a);
+        if (data != nullptr) {
+            MyRemoveFromRbTree(data, &a);
+        }
+    }
+    double remove_seconds = SecondsSince(start);
+    MyDestroyRbTree(&a);
+    MyDestroyRbTree(&b);
+    printf("[set operations] a=%zu b=%zu one_by_one: union=%.1fms difference=%.1fms\n",
+           a_values.size(), b_values.size(), insert_seconds * 1e3, remove_seconds * 1e3);
+
+    using SetOperation = void (*)(RbRoot*, RbRoot*, RbRoot*, WorkStealingPool*);
+    auto measure = [&](SetOperation operation, WorkStealingPool* pool, bool* legal) {
+        DeleteAllMyData();
+        build(a_values, &a);
+        build(b_values, &b);
+        RbRoot result = InitializedRbRoot;
+        auto operation_start = Clock::now();
+        operation(&a, &b, &result, pool);
+        double seconds = SecondsSince(operation_start);
+        *legal = *legal && IsLegalRbTree(&result);
+        MyDestroyRbTree(&result);
+        return seconds;
+    };
+    for (int thread_num = 1; thread_num <= max_thread_num; thread_num *= 2) {
+        WorkStealingPool pool(thread_num);
+        bool legal = true;
+        double union_seconds = measure(MyUnionRbTree, &pool, &legal);
+        double intersect_seconds = measure(MyIntersectRbTree, &pool, &legal);
+        double difference_seconds = measure(MyDifferenceRbTree, &pool, &legal);
+        printf("[set operations] threads=%d union=%.1fms intersection=%.1fms difference=%.1fms legal=%s\n",
+               thread_num, union_seconds * 1e3, intersect_seconds * 1e3, difference_seconds * 1e3,
+               legal ? "yes" : "no");
+    }
+}
+
+void RunRbTreeBenchmarks() {
+    BenchRbNodeLayout();
+    BenchTimerQueue();
+    BenchOrderStatistics(1000000);
+    BenchOrderStatistics(10000000);
+    BenchBulkBuild();
+    BenchNodeAllocator();
+    BenchTeardown();
+    BenchHintedInsert();
+    BenchEraseRange();
+    BenchReadScaling();
+    BenchShardedWrites();
+    BenchSnapshot();
+    BenchCompaction();
+    BenchPersistentSnapshots();
+    BenchBucketTree();
+    BenchSetOperations(1000000, 1000000);
+    BenchSetOperations(1000000, 1000);
+}
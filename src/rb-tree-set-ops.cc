@@ -0,0 +1,207 @@
+#include "include/rb-tree-set-ops.h"
+#include "include/work-stealing-pool.h"
+
+#include <cassert>
+
+namespace {
+
+// Every worker gets about this many tasks to steal from, so an uneven split doesn't leave it idle.
+constexpr int kTasksPerThread = 8;
+
+struct SetOpContext {
+    RbNodeCompareFunc compare;
+    RbReleaseFunc release;
+    void* context;
+    WorkStealingPool* pool;
+    // Forks the recursion above this depth, and runs it sequentially below.
+    int parallel_depth;
+};
+
+SetOpContext MakeContext(
+    RbNodeCompareFunc compare, RbReleaseFunc release, void* context, WorkStealingPool* pool
+) {
+    int parallel_depth = 0;
+    if (pool != nullptr && pool->GetThreadNum() > 1) {
+        for (int task_num = 1; task_num < pool->GetThreadNum() * kTasksPerThread; task_num *= 2) {
+            ++parallel_depth;
+        }
+    }
+    return { compare, release, context, pool, parallel_depth };
+}
+
+// Adapts an RbNodeCompareFunc to SplitRbTree, which compares nodes with a key.
+struct PivotKey {
+    RbNodeCompareFunc compare;
+    const RbNode* pivot;
+};
+
+int CompareWithPivot(const RbNode* node, const void* key) {
+    const PivotKey* pivot_key = static_cast<const PivotKey*>(key);
+    return pivot_key->compare(node, pivot_key->pivot);
+}
+
+// Takes the root out of `tree`, and moves its subtrees into `left` and `right` as standalone trees.
+RbNode* ExposeRoot(RbRoot* tree, RbRoot* left, RbRoot* right) {
+    RbNode* root = tree->rb_node;
+    tree->rb_node = nullptr;
+    left->rb_node = root->left;
+    right->rb_node = root->right;
+    if (root->left != nullptr) {
+        SetParentAndColor(root->left, nullptr, kBlack);
+    }
+    if (root->right != nullptr) {
+        SetParentAndColor(root->right, nullptr, kBlack);
+    }
+    return root;
+}
+
+// Moves the nodes of `tree` less than `pivot` into `less`, and the greater ones into `greater`.
+// Returns the node equal to `pivot`, unlinked, or nullptr.
+RbNode* SplitAtPivot(RbRoot* tree, const RbNode* pivot, const SetOpContext& ctx, RbRoot* less, RbRoot* greater) {
+    PivotKey key = { ctx.compare, pivot };
+    SplitRbTree(tree, CompareWithPivot, &key, less, greater);
+    RbNode* equal = FirstRbNode(greater);
+    if (equal == nullptr || ctx.compare(equal, pivot) != 0) {
+        return nullptr;
+    }
+    RemoveFromRbTree(equal, greater);
+    return equal;
+}
+
+void Release(RbNode* node, const SetOpContext& ctx) {
+    if (ctx.release) ctx.release(node, ctx.context);
+}
+
+void ReleaseAll(RbRoot* tree, const SetOpContext& ctx) {
+    if (ctx.release == nullptr) {
+        tree->rb_node = nullptr;
+        return;
+    }
+    RbNode* node = nullptr;
+    RbNode* next = nullptr;
+    RbPostorderForEachSafe(node, next, tree) {
+        Release(node, ctx);
+    }
+    tree->rb_node = nullptr;
+}
+
+// Moves whichever of `a` and `b` isn't empty into `root`.
+void TakeNonEmpty(RbRoot* a, RbRoot* b, RbRoot* root) {
+    RbNode* node = a->rb_node ? a->rb_node : b->rb_node;
+    a->rb_node = b->rb_node = nullptr;
+    root->rb_node = node;
+}
+
+// Runs both sides of the recursion, in parallel near its top.
+template <typename Left, typename Right>
+void Fork(const SetOpContext& ctx, int depth, Left&& left, Right&& right) {
+    if (depth < ctx.parallel_depth) {
+        ctx.pool->Invoke(left, right);
+    } else {
+        left();
+        right();
+    }
+}
+
+void Union(RbRoot* a, RbRoot* b, const SetOpContext& ctx, int depth, RbRoot* root) {
+    if (IsEmptyRbRoot(a) || IsEmptyRbRoot(b)) {
+        TakeNonEmpty(a, b, root);
+        return;
+    }
+    RbRoot a_left = InitializedRbRoot;
+    RbRoot a_right = InitializedRbRoot;
+    RbRoot b_less = InitializedRbRoot;
+    RbRoot b_greater = InitializedRbRoot;
+    RbNode* pivot = ExposeRoot(a, &a_left, &a_right);
+    RbNode* duplicate = SplitAtPivot(b, pivot, ctx, &b_less, &b_greater);
+    if (duplicate != nullptr) {
+        Release(duplicate, ctx);
+    }
+
+    RbRoot left = InitializedRbRoot;
+    RbRoot right = InitializedRbRoot;
+    Fork(ctx, depth,
+         [&] { Union(&a_left, &b_less, ctx, depth + 1, &left); },
+         [&] { Union(&a_right, &b_greater, ctx, depth + 1, &right); });
+    JoinRbTree(&left, pivot, &right, root);
+}
+
+void Intersect(RbRoot* a, RbRoot* b, const SetOpContext& ctx, int depth, RbRoot* root) {
+    if (IsEmptyRbRoot(a) || IsEmptyRbRoot(b)) {
+        ReleaseAll(a, ctx);
+        ReleaseAll(b, ctx);
+        root->rb_node = nullptr;
+        return;
+    }
+    RbRoot a_left = InitializedRbRoot;
+    RbRoot a_right = InitializedRbRoot;
+    RbRoot b_less = InitializedRbRoot;
+    RbRoot b_greater = InitializedRbRoot;
+    RbNode* pivot = ExposeRoot(a, &a_left, &a_right);
+    RbNode* match = SplitAtPivot(b, pivot, ctx, &b_less, &b_greater);
+
+    RbRoot left = InitializedRbRoot;
+    RbRoot right = InitializedRbRoot;
+    Fork(ctx, depth,
+         [&] { Intersect(&a_left, &b_less, ctx, depth + 1, &left); },
+         [&] { Intersect(&a_right, &b_greater, ctx, depth + 1, &right); });
+    if (match != nullptr) {
+        Release(match, ctx);
+        JoinRbTree(&left, pivot, &right, root);
+    } else {
+        Release(pivot, ctx);
+        ConcatRbTree(&left, &right, root);
+    }
+}
+
+// Here the root of `b` is the pivot, and `a` is split, since only the nodes of `a` may be kept.
+void Difference(RbRoot* a, RbRoot* b, const SetOpContext& ctx, int depth, RbRoot* root) {
+    if (IsEmptyRbRoot(a) || IsEmptyRbRoot(b)) {
+        ReleaseAll(b, ctx);
+        TakeNonEmpty(a, b, root);
+        return;
+    }
+    RbRoot b_left = InitializedRbRoot;
+    RbRoot b_right = InitializedRbRoot;
+    RbRoot a_less = InitializedRbRoot;
+    RbRoot a_greater = InitializedRbRoot;
+    RbNode* pivot = ExposeRoot(b, &b_left, &b_right);
+    RbNode* match = SplitAtPivot(a, pivot, ctx, &a_less, &a_greater);
+
+    RbRoot left = InitializedRbRoot;
+    RbRoot right = InitializedRbRoot;
+    Fork(ctx, depth,
+         [&] { Difference(&a_less, &b_left, ctx, depth + 1, &left); },
+         [&] { Difference(&a_greater, &b_right, ctx, depth + 1, &right); });
+    if (match != nullptr) {
+        Release(match, ctx);
+    }
+    Release(pivot, ctx);
+    ConcatRbTree(&left, &right, root);
+}
+
+}  // namespace
+
+void UnionRbTree(
+    RbRoot* a, RbRoot* b, RbNodeCompareFunc compare, RbReleaseFunc release, void* context,
+    RbRoot* root, WorkStealingPool* pool
+) {
+    assert(compare != nullptr);
+    Union(a, b, MakeContext(compare, release, context, pool), 0, root);
+}
+
+void IntersectRbTree(
+    RbRoot* a, RbRoot* b, RbNodeCompareFunc compare, RbReleaseFunc release, void* context,
+    RbRoot* root, WorkStealingPool* pool
+) {
+    assert(compare != nullptr);
+    Intersect(a, b, MakeContext(compare, release, context, pool), 0, root);
+}
+
+void DifferenceRbTree(
+    RbRoot* a, RbRoot* b, RbNodeCompareFunc compare, RbReleaseFunc release, void* context,
+    RbRoot* root, WorkStealingPool* pool
+) {
+    assert(compare != nullptr);
+    Difference(a, b, MakeContext(compare, release, context, pool), 0, root);
+}
@@ -0,0 +1,1479 @@
+#include "include/rb-tree-tester.h"
+
+#include <iostream>
+#include <algorithm>
+#include <vector>
+#include <random>
+#include <set>
+#include <climits>
+#include <atomic>
+#include <thread>
+#include <cstdio>
+#include <iterator>
+#include <cstdint>
+#include <cstring>
+
+#include "include/rb-tree.h"
+#include "include/my-rb-tree.h"
+#include "include/my-interval-tree.h"
+#include "include/node-pool.h"
+#include "include/rb-latch-tree.h"
+#include "include/my-sharded-rb-tree.h"
+#include "include/my-rb-tree-snapshot.h"
+#include "include/persistent-rb-tree.h"
+#include "include/my-bucket-rb-tree.h"
+#include "include/rb-tree-set-ops.h"
+#include "include/work-stealing-pool.h"
+#include "include/rb-order-tree.h"
+#include "include/intrusive-rb-tree.h"
+
+namespace {
+
+// Links the values in [lo, hi) into the empty `root`, either in O(n) from sorted nodes,
+// or by inserting them in random order, which colors the nodes differently.
+void BuildMyRbTree(int lo, int hi, bool shuffled, std::mt19937& gen, RbRoot* root) {
+    std::vector<MyData*> datas;
+    for (int value = lo; value < hi; ++value) {
+        datas.push_back(NewMyData(value));
+    }
+    if (!shuffled) {
+        MyBuildRbTreeFromSorted(datas.data(), datas.size(), root);
+        return;
+    }
+    std::shuffle(datas.begin(), datas.end(), gen);
+    for (MyData* data : datas) {
+        MyInsertIntoRbTree(data, root);
+    }
+}
+
+// Returns whether `root` is a legal rb-tree of exactly the values in [lo, hi).
+bool HasMyValues(RbRoot* root, int lo, int hi) {
+    if (!IsLegalRbTree(root)) {
+        return false;
+    }
+    int expected = lo;
+    for (RbNode* node = FirstRbNode(root); node != nullptr; node = NextRbNode(node)) {
+        if (expected == hi || ContainerOf(node, struct MyData, rb_node)->value != expected) {
+            return false;
+        }
+        ++expected;
+    }
+    return expected == hi;
+}
+
+// Returns whether `root` is a legal rb-tree of exactly the values in `values`.
+bool HasMyValues(RbRoot* root, const std::set<int>& values) {
+    if (!IsLegalRbTree(root)) {
+        return false;
+    }
+    auto it = values.begin();
+    for (RbNode* node = FirstRbNode(root); node != nullptr; node = NextRbNode(node), ++it) {
+        if (it == values.end() || ContainerOf(node, struct MyData, rb_node)->value != *it) {
+            return false;
+        }
+    }
+    return it == values.end();
+}
+
+struct MySeqEntry {
+    RbNode rb_node;
+    int key;
+};
+
+struct MyLatchEntry {
+    RbLatchNode latch_node;
+    int key;
+};
+
+int CompareSeqEntry(const RbNode* node, const void* key) {
+    int node_key = ContainerOf(node, struct MySeqEntry, rb_node)->key;
+    int other = *static_cast<const int*>(key);
+    return node_key < other ? -1 : (node_key > other ? 1 : 0);
+}
+
+int CompareSeqEntries(const RbNode* a, const RbNode* b) {
+    return CompareSeqEntry(a, &ContainerOf(b, struct MySeqEntry, rb_node)->key);
+}
+
+int CompareLatchEntry(const RbLatchNode* node, const void* key) {
+    int node_key = ContainerOf(node, struct MyLatchEntry, latch_node)->key;
+    int other = *static_cast<const int*>(key);
+    return node_key < other ? -1 : (node_key > other ? 1 : 0);
+}
+
+bool LessLatchEntries(const RbLatchNode* a, const RbLatchNode* b) {
+    return ContainerOf(a, struct MyLatchEntry, latch_node)->key < ContainerOf(b, struct MyLatchEntry, latch_node)->key;
+}
+
+// Compares the nodes of copy `kIndex` of an RbLatchRoot.
+template <int kIndex>
+int CompareLatchCopies(const RbNode* a, const RbNode* b) {
+    const RbLatchNode* a_entry = ContainerOf(a - kIndex, struct RbLatchNode, rb_node);
+    const RbLatchNode* b_entry = ContainerOf(b - kIndex, struct RbLatchNode, rb_node);
+    return CompareLatchEntry(a_entry, &ContainerOf(b_entry, struct MyLatchEntry, latch_node)->key);
+}
+
+// Calls `write(i)` for i in [0, write_num) on this thread, while `reader_num` threads keep calling
+// `read(gen)` with their own random generator. Returns false if any `read` does.
+template <typename Writer, typename Reader>
+bool RunWithReaders(int reader_num, int write_num, Writer&& write, Reader&& read) {
+    std::atomic<bool> done(false);
+    std::atomic<bool> passed(true);
+    std::vector<std::thread> readers;
+    for (int i = 0; i < reader_num; ++i) {
+        readers.emplace_back([&, i]() {
+            std::mt19937 gen(20250205 + i);
+            while (!done.load(std::memory_order_relaxed)) {
+                if (!read(gen)) {
+                    passed = false;
+                }
+            }
+        });
+    }
+    for (int i = 0; i < write_num; ++i) {
+        write(i);
+    }
+    done = true;
+    for (std::thread& reader : readers) {
+        reader.join();
+    }
+    return passed;
+}
+
+// Reads the whole file at `path` into `bytes`.
+bool ReadMyFile(const char* path, std::vector<char>* bytes) {
+    FILE* file = fopen(path, "rb");
+    if (file == nullptr) {
+        return false;
+    }
+    bytes->clear();
+    char buffer[4096];
+    size_t read_size = 0;
+    while ((read_size = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+        bytes->insert(bytes->end(), buffer, buffer + read_size);
+    }
+    fclose(file);
+    return true;
+}
+
+bool WriteMyFile(const char* path, const std::vector<char>& bytes) {
+    FILE* file = fopen(path, "wb");
+    if (file == nullptr) {
+        return false;
+    }
+    bool written = fwrite(bytes.data(), 1, bytes.size(), file) == bytes.size();
+    return fclose(file) == 0 && written;
+}
+
+// Returns whether `tree` is legal and holds exactly `values`. VisitRange can't reach INT_MAX,
+// so that one is looked up on its own.
+bool HasBucketValues(const MyBucketRbTree& tree, const std::set<int>& values) {
+    std::vector<int> found;
+    size_t count = tree.VisitRange(INT_MIN, INT_MAX, [&](int value) { found.push_back(value); });
+    std::vector<int> expected(values.begin(), values.lower_bound(INT_MAX));
+    return tree.Check() && tree.GetSize() == values.size() && count == found.size() && found == expected
+        && tree.Contains(INT_MAX) == (values.count(INT_MAX) == 1);
+}
+
+int CompareMyDatas(const RbNode* a, const RbNode* b) {
+    int a_value = ContainerOf(a, struct MyData, rb_node)->value;
+    int b_value = ContainerOf(b, struct MyData, rb_node)->value;
+    return a_value < b_value ? -1 : (a_value > b_value ? 1 : 0);
+}
+
+// Frees the node, and counts it in the std::atomic<size_t> at `context`.
+void CountAndDeleteMyData(RbNode* node, void* context) {
+    ++*static_cast<std::atomic<size_t>*>(context);
+    DeleteMyData(ContainerOf(node, struct MyData, rb_node));
+}
+
+int CompareMyRankedDatas(const RbNode* a, const RbNode* b) {
+    int a_value = ContainerOf(a, struct MyRankedData, rb_node.rb_node)->value;
+    int b_value = ContainerOf(b, struct MyRankedData, rb_node.rb_node)->value;
+    return a_value < b_value ? -1 : (a_value > b_value ? 1 : 0);
+}
+
+// Returns whether every node of the order-statistic tree `root` counts its subtree right.
+bool HasRightSizes(const RbRoot* root) {
+    for (RbNode* node = FirstRbNode(root); node != nullptr; node = NextRbNode(node)) {
+        size_t size = 1;
+        for (const RbNode* child : { node->left, node->right }) {
+            size += child != nullptr ? ContainerOf(child, RbSizedNode, rb_node)->size : 0;
+        }
+        if (ContainerOf(node, RbSizedNode, rb_node)->size != size) {
+            return false;
+        }
+    }
+    return true;
+}
+
+struct MyEntry {
+    RbNode rb_node;
+    int key;
+};
+
+struct MyEntryKey {
+    int operator()(const MyEntry& entry) const { return entry.key; }
+};
+
+typedef IntrusiveRbTree<MyEntry, &MyEntry::rb_node, MyEntryKey> MyEntryTree;
+
+// Returns whether `tree` is legal and holds exactly `entries` in this order, both ways.
+bool HasEntries(const MyEntryTree& tree, const std::vector<MyEntry*>& entries) {
+    if (tree.size() != entries.size() || CheckRbTree(tree.root(), nullptr, nullptr) != kRbCheckOk) {
+        return false;
+    }
+    size_t index = 0;
+    for (MyEntry& entry : tree) {
+        if (index == entries.size() || &entry != entries[index++]) {
+            return false;
+        }
+    }
+    // Decrementing end() walks back from the last entry.
+    auto it = tree.end();
+    for (size_t i = entries.size(); i > 0; --i) {
+        if (&*--it != entries[i - 1]) {
+            return false;
+        }
+    }
+    return index == entries.size() && it == tree.begin();
+}
+
+}  // namespace
+
+bool RbTreeTesterIntervals(int interval_num, int query_num) {
+    std::mt19937 gen(20250201);
+    std::uniform_int_distribution<int64_t> start_dis(0, interval_num * 4);
+    std::uniform_int_distribution<int64_t> length_dis(0, 64);
+    std::vector<MyInterval*> intervals;
+    RbRoot root = InitializedRbRoot;
+    for (int i = 0; i < interval_num; ++i) {
+        MyInterval* interval = new MyInterval;
+        interval->start = start_dis(gen);
+        // Some intervals are empty, and some start at the same point.
+        interval->end = interval->start + length_dis(gen);
+        MyInsertIntoIntervalTree(interval, &root);
+        intervals.push_back(interval);
+    }
+
+    bool passed = true;
+    // Remove a third of the intervals halfway, so the max ends have to shrink back.
+    for (int round = 0; round < 2 && passed; ++round) {
+        if (round == 1) {
+            std::shuffle(intervals.begin(), intervals.end(), gen);
+            for (size_t i = 0; i < intervals.size() / 3; ++i) {
+                MyRemoveFromIntervalTree(intervals.back(), &root);
+                delete intervals.back();
+                intervals.pop_back();
+            }
+        }
+        for (int i = 0; i < query_num && passed; ++i) {
+            int64_t lo = start_dis(gen);
+            int64_t hi = lo + length_dis(gen);
+            // An empty query overlaps nothing.
+            std::vector<const MyInterval*> expected;
+            for (const MyInterval* interval : intervals) {
+                if (lo < hi && interval->start < hi && lo < interval->end) {
+                    expected.push_back(interval);
+                }
+            }
+            std::sort(expected.begin(), expected.end(), [](const MyInterval* a, const MyInterval* b) {
+                return a->start < b->start;
+            });
+            std::vector<const MyInterval*> found;
+            MyVisitOverlapsInIntervalTree(lo, hi, &root, [&](MyInterval* interval) { found.push_back(interval); });
+            // Intervals with the same start may come in any order.
+            bool ordered = std::is_sorted(found.begin(), found.end(), [](const MyInterval* a, const MyInterval* b) {
+                return a->start < b->start;
+            });
+            std::sort(expected.begin(), expected.end());
+            std::sort(found.begin(), found.end());
+            if (!ordered || found != expected) {
+                std::cerr << "Failed: Overlaps of [" << lo << ", " << hi << ") are wrong." << std::endl;
+                passed = false;
+            }
+        }
+    }
+
+    for (MyInterval* interval : intervals) {
+        delete interval;
+    }
+    return passed;
+}
+
+bool RbTreeTesterJoinAndSplit() {
+    std::mt19937 gen(20250202);
+    // Sizes of very different black heights, including the empty tree.
+    const int sizes[] = { 0, 1, 2, 3, 5, 8, 31, 100, 1000 };
+    bool passed = true;
+    for (int left_num : sizes) {
+        for (int right_num : sizes) {
+            for (int shuffled = 0; shuffled < 2 && passed; ++shuffled) {
+                int total = left_num + right_num + 1;
+                RbRoot left = InitializedRbRoot;
+                RbRoot right = InitializedRbRoot;
+                BuildMyRbTree(0, left_num, shuffled != 0, gen, &left);
+                BuildMyRbTree(left_num + 1, total, shuffled != 0, gen, &right);
+                MyData* pivot = NewMyData(left_num);
+                // The output tree may be one of the inputs.
+                RbRoot joined = InitializedRbRoot;
+                RbRoot* root = shuffled != 0 ? &right : &joined;
+                JoinRbTree(&left, &pivot->rb_node, &right, root);
+                if (!HasMyValues(root, 0, total) || (root != &right && !IsEmptyRbRoot(&right))
+                        || !IsEmptyRbRoot(&left)) {
+                    std::cerr << "Failed: Join of " << left_num << " and " << right_num
+                              << " nodes is wrong." << std::endl;
+                    passed = false;
+                }
+
+                int key = std::uniform_int_distribution<int>(0, total)(gen);
+                RbRoot less = InitializedRbRoot;
+                RbRoot not_less = InitializedRbRoot;
+                MySplitRbTree(key, root, &less, &not_less);
+                if (passed && (!HasMyValues(&less, 0, key) || !HasMyValues(&not_less, key, total)
+                        || !IsEmptyRbRoot(root))) {
+                    std::cerr << "Failed: Split of " << total << " nodes at " << key << " is wrong." << std::endl;
+                    passed = false;
+                }
+                ConcatRbTree(&less, &not_less, &less);
+                if (passed && (!HasMyValues(&less, 0, total) || !IsEmptyRbRoot(&not_less))) {
+                    std::cerr << "Failed: Concat of " << key << " and " << total - key
+                              << " nodes is wrong." << std::endl;
+                    passed = false;
+                }
+                MyDestroyRbTree(&less);
+                MyDestroyRbTree(&not_less);
+                MyDestroyRbTree(root);
+            }
+        }
+    }
+
+    // Split at every position, and concat the two parts back.
+    const int node_num = 300;
+    RbRoot root = InitializedRbRoot;
+    BuildMyRbTree(0, node_num, true, gen, &root);
+    for (int key = -1; key <= node_num + 1 && passed; ++key) {
+        RbRoot less = InitializedRbRoot;
+        RbRoot not_less = InitializedRbRoot;
+        MySplitRbTree(key, &root, &less, &not_less);
+        int bound = std::min(std::max(key, 0), node_num);
+        if (!HasMyValues(&less, 0, bound) || !HasMyValues(&not_less, bound, node_num)) {
+            std::cerr << "Failed: Split at " << key << " is wrong." << std::endl;
+            passed = false;
+        }
+        ConcatRbTree(&less, &not_less, &root);
+        if (passed && !HasMyValues(&root, 0, node_num)) {
+            std::cerr << "Failed: Concat after the split at " << key << " is wrong." << std::endl;
+            passed = false;
+        }
+    }
+    MyDestroyRbTree(&root);
+    return passed;
+}
+
+bool RbTreeTesterNodePool(int entry_num) {
+    std::mt19937 gen(20250203);
+    // Slot sizes below a cache line, and above it, where 192, 320 and 384 don't divide the slab.
+    const size_t entry_sizes[] = { 8, 24, 64, 150, 320, 384, 1000 };
+    bool passed = true;
+    for (size_t entry_size : entry_sizes) {
+        NodePool* pool = CreateNodePool(entry_size);
+        size_t slot_size = GetNodePoolSlotSize(pool);
+        std::vector<unsigned char*> entries;
+        // Fills every entry with its own byte, so any overlap shows up as a wrong byte.
+        auto alloc = [&](size_t index) {
+            unsigned char* entry = static_cast<unsigned char*>(AllocFromNodePool(pool));
+            memset(entry, static_cast<int>(index % 251), entry_size);
+            return entry;
+        };
+        auto check = [&]() {
+            for (size_t i = 0; i < entries.size(); ++i) {
+                uintptr_t address = reinterpret_cast<uintptr_t>(entries[i]);
+                // A small slot is a power of 2, and never straddles two cache lines.
+                if (slot_size < entry_size || address % std::min<size_t>(slot_size, 64) != 0) {
+                    return false;
+                }
+                for (size_t j = 0; j < entry_size; ++j) {
+                    if (entries[i][j] != i % 251) {
+                        return false;
+                    }
+                }
+            }
+            return true;
+        };
+
+        for (int i = 0; i < entry_num; ++i) {
+            entries.push_back(alloc(entries.size()));
+        }
+        if (!check()) {
+            std::cerr << "Failed: Entries of " << entry_size << " bytes overlap or are misaligned." << std::endl;
+            passed = false;
+        }
+        // Free a random half, and allocate them again, which reuses the freed slots.
+        std::shuffle(entries.begin(), entries.end(), gen);
+        for (int i = 0; i < entry_num / 2; ++i) {
+            FreeToNodePool(pool, entries.back());
+            entries.pop_back();
+        }
+        for (size_t i = 0; i < entries.size(); ++i) {
+            memset(entries[i], static_cast<int>(i % 251), entry_size);
+        }
+        for (int i = 0; i < entry_num; ++i) {
+            entries.push_back(alloc(entries.size()));
+        }
+        if (passed && !check()) {
+            std::cerr << "Failed: Reused entries of " << entry_size << " bytes overlap." << std::endl;
+            passed = false;
+        }
+        DestroyNodePool(pool);
+    }
+    return passed;
+}
+
+bool RbTreeTesterEraseRange(int node_num, int round_num) {
+    std::mt19937 gen(20250204);
+    // The values are about 2 apart, so a range of up to 400 holds up to about 200 nodes,
+    // on both sides of the 64 nodes that are removed one by one before the split.
+    std::uniform_int_distribution<int> value_dis(0, node_num * 4);
+    std::uniform_int_distribution<int> length_dis(0, 400);
+    bool passed = true;
+    for (int cached = 0; cached < 2 && passed; ++cached) {
+        RbRootCached root = InitializedRbRootCached;
+        std::set<int> values;
+        size_t short_num = 0;
+        size_t long_num = 0;
+        for (int round = 0; round < round_num && passed; ++round) {
+            while (values.size() < static_cast<size_t>(node_num)) {
+                int value = value_dis(gen);
+                if (values.insert(value).second) {
+                    MyInsertIntoRbTreeCached(NewMyData(value), &root);
+                }
+            }
+            // Every few rounds, erase from below the minimum, up to above the maximum, or everything.
+            int lo = value_dis(gen);
+            int hi = lo + length_dis(gen);
+            if (round % 10 == 1) {
+                lo = INT_MIN;
+            } else if (round % 10 == 2) {
+                hi = INT_MAX;
+            } else if (round % 50 == 3) {
+                lo = INT_MIN;
+                hi = INT_MAX;
+            }
+            size_t expected = 0;
+            for (auto it = values.lower_bound(lo); it != values.end() && *it < hi;) {
+                it = values.erase(it);
+                ++expected;
+            }
+            if (expected <= 64) {
+                ++short_num;
+            } else {
+                ++long_num;
+            }
+
+            size_t erased = cached != 0 ? MyEraseRangeFromRbTreeCached(lo, hi, &root)
+                                        : MyEraseRangeFromRbTree(lo, hi, &root.rb_root);
+            if (erased != expected || !HasMyValues(&root.rb_root, values)) {
+                std::cerr << "Failed: Erasing [" << lo << ", " << hi << ") is wrong." << std::endl;
+                passed = false;
+            }
+            // The plain version doesn't maintain the cache, so it is only checked after the cached one.
+            if (passed && cached != 0 && (PeekMinInRbTreeCached(&root) != FirstRbNode(&root.rb_root)
+                    || PeekMaxInRbTreeCached(&root) != LastRbNode(&root.rb_root))) {
+                std::cerr << "Failed: The cache is stale after erasing [" << lo << ", " << hi << ")." << std::endl;
+                passed = false;
+            }
+            if (cached == 0) {
+                root.rb_leftmost = FirstRbNode(&root.rb_root);
+                root.rb_rightmost = LastRbNode(&root.rb_root);
+            }
+        }
+        if (passed && (short_num == 0 || long_num == 0)) {
+            std::cerr << "Failed: Erased ranges don't cover both sides of the node by node limit." << std::endl;
+            passed = false;
+        }
+        MyDestroyRbTree(&root.rb_root);
+    }
+    return passed;
+}
+
+bool RbTreeTesterLatchTree(int key_num, int write_num) {
+    std::mt19937 gen(20250205);
+    std::uniform_int_distribution<int> key_dis(0, key_num - 1);
+    constexpr int kReaderNum = 3;
+    bool passed = true;
+
+    // The even keys stay in the tree, and the writer keeps inserting and removing odd ones.
+    // Removed entries go back to the pool, whose memory stays readable for the lookups.
+    NodePool* pool = CreateNodePool(sizeof(MySeqEntry));
+    RbSeqRoot seq_root = InitializedRbSeqRoot;
+    std::vector<MySeqEntry*> seq_churn;
+    auto insert_seq = [&](int key) {
+        MySeqEntry* entry = static_cast<MySeqEntry*>(AllocFromNodePool(pool));
+        entry->key = key;
+        RbNode* parent = nullptr;
+        RbNode** link = &seq_root.rb_root.rb_node;
+        while (*link != nullptr) {
+            parent = *link;
+            link = CompareSeqEntries(parent, &entry->rb_node) > 0 ? &parent->left : &parent->right;
+        }
+        BeginRbSeqWrite(&seq_root);
+        InsertIntoRbTree(&entry->rb_node, parent, link, &seq_root.rb_root);
+        EndRbSeqWrite(&seq_root);
+        return entry;
+    };
+    for (int i = 0; i < key_num; ++i) {
+        insert_seq(i * 2);
+    }
+    bool seq_passed = RunWithReaders(kReaderNum, write_num, [&](int) {
+        if (seq_churn.empty() || gen() % 2 == 0) {
+            seq_churn.push_back(insert_seq(key_dis(gen) * 2 + 1));
+            return;
+        }
+        size_t index = gen() % seq_churn.size();
+        BeginRbSeqWrite(&seq_root);
+        RemoveFromRbTree(&seq_churn[index]->rb_node, &seq_root.rb_root);
+        EndRbSeqWrite(&seq_root);
+        FreeToNodePool(pool, seq_churn[index]);
+        seq_churn[index] = seq_churn.back();
+        seq_churn.pop_back();
+    }, [&](std::mt19937& reader_gen) {
+        int key = std::uniform_int_distribution<int>(0, key_num - 1)(reader_gen) * 2;
+        int missing = -1 - key;
+        RbNode* node = FindInRbSeqTree(&seq_root, CompareSeqEntry, &key);
+        return node != nullptr && ContainerOf(node, struct MySeqEntry, rb_node)->key == key
+            && FindInRbSeqTree(&seq_root, CompareSeqEntry, &missing) == nullptr;
+    });
+    if (!seq_passed || CheckRbTree(&seq_root.rb_root, CompareSeqEntries, nullptr) != kRbCheckOk) {
+        std::cerr << "Failed: Lookups in RbSeqRoot went wrong while writing." << std::endl;
+        passed = false;
+    }
+    DestroyNodePool(pool);
+
+    pool = CreateNodePool(sizeof(MyLatchEntry));
+    RbLatchRoot latch_root = InitializedRbLatchRoot;
+    std::vector<MyLatchEntry*> latch_churn;
+    auto insert_latch = [&](int key) {
+        MyLatchEntry* entry = static_cast<MyLatchEntry*>(AllocFromNodePool(pool));
+        entry->key = key;
+        InsertIntoRbLatchTree(&entry->latch_node, &latch_root, LessLatchEntries);
+        return entry;
+    };
+    for (int i = 0; i < key_num; ++i) {
+        insert_latch(i * 2);
+    }
+    bool latch_passed = RunWithReaders(kReaderNum, write_num, [&](int) {
+        if (latch_churn.empty() || gen() % 2 == 0) {
+            latch_churn.push_back(insert_latch(key_dis(gen) * 2 + 1));
+            return;
+        }
+        size_t index = gen() % latch_churn.size();
+        RemoveFromRbLatchTree(&latch_churn[index]->latch_node, &latch_root);
+        FreeToNodePool(pool, latch_churn[index]);
+        latch_churn[index] = latch_churn.back();
+        latch_churn.pop_back();
+    }, [&](std::mt19937& reader_gen) {
+        int key = std::uniform_int_distribution<int>(0, key_num - 1)(reader_gen) * 2;
+        int missing = -1 - key;
+        RbLatchNode* node = FindInRbLatchTree(&latch_root, CompareLatchEntry, &key);
+        return node != nullptr && ContainerOf(node, struct MyLatchEntry, latch_node)->key == key
+            && FindInRbLatchTree(&latch_root, CompareLatchEntry, &missing) == nullptr;
+    });
+    if (!latch_passed || CheckRbTree(&latch_root.tree[0], CompareLatchCopies<0>, nullptr) != kRbCheckOk
+            || CheckRbTree(&latch_root.tree[1], CompareLatchCopies<1>, nullptr) != kRbCheckOk) {
+        std::cerr << "Failed: Lookups in RbLatchRoot went wrong while writing." << std::endl;
+        passed = false;
+    }
+    DestroyNodePool(pool);
+    return passed;
+}
+
+bool RbTreeTesterShardedTree(int op_num) {
+    constexpr int kShardNum = 8;
+    constexpr int kValueMax = 100000;
+    constexpr int kWriterNum = 3;
+    bool passed = true;
+    MyShardedRbTree tree(kShardNum, 0, kValueMax);
+    // The values are packed into the lower part of the range, so the first shards grow
+    // and have to move key ranges over. A few of them fall out of the range.
+    std::mt19937 gen(20250206);
+    std::uniform_int_distribution<int> value_dis(-100, kValueMax / 5);
+    auto check_range = [&](int lo, int hi, const std::set<int>& expected) {
+        std::vector<int> found;
+        size_t count = tree.VisitRange(lo, hi, [&](const MyData* data) { found.push_back(data->value); });
+        return count == found.size() && found == std::vector<int>(expected.lower_bound(lo), expected.lower_bound(hi));
+    };
+
+    // Every value v with v % 4 == 3 stays in the tree. Writer t owns the values with v % 4 == t.
+    std::set<int> stable;
+    for (int value = 3; value < kValueMax / 5; value += 4) {
+        stable.insert(value);
+        tree.Insert(value);
+    }
+    std::set<int> owned[kWriterNum];
+    std::atomic<int> running_num(kWriterNum);
+    std::atomic<bool> writers_passed(true);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < kWriterNum; ++t) {
+        threads.emplace_back([&, t]() {
+            std::mt19937 writer_gen(20250206 + t);
+            std::set<int>& values = owned[t];
+            for (int i = 0; i < op_num; ++i) {
+                int value = value_dis(writer_gen) / 4 * 4 + t;
+                bool ok = true;
+                switch (writer_gen() % 3) {
+                case 0:
+                case 1:
+                    ok = tree.Insert(value) == values.insert(value).second;
+                    break;
+                default:
+                    ok = tree.Remove(value) == (values.erase(value) == 1);
+                    break;
+                }
+                if (!ok || tree.Contains(value) != (values.count(value) == 1)) {
+                    writers_passed = false;
+                }
+            }
+            --running_num;
+        });
+    }
+    // Rebalances and scans the stable values while the writers run.
+    std::uniform_int_distribution<int> lo_dis(0, kValueMax / 5 - 4);
+    while (running_num.load() > 0) {
+        tree.Rebalance();
+        int lo = lo_dis(gen);
+        int hi = lo + 2000;
+        int stable_value = lo / 4 * 4 + 3;
+        size_t stable_num = 0;
+        tree.VisitRange(lo, hi, [&](const MyData* data) { stable_num += data->value % 4 == 3; });
+        if (!tree.Contains(stable_value) || stable_num != static_cast<size_t>(std::distance(stable.lower_bound(lo), stable.lower_bound(hi)))) {
+            std::cerr << "Failed: Stable values in [" << lo << ", " << hi << ") are lost meanwhile." << std::endl;
+            passed = false;
+        }
+    }
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+    if (!writers_passed) {
+        std::cerr << "Failed: Concurrent writes on the sharded tree disagree with std::set." << std::endl;
+        passed = false;
+    }
+
+    std::set<int> expected = stable;
+    for (const std::set<int>& values : owned) {
+        expected.insert(values.begin(), values.end());
+    }
+    tree.Rebalance();
+    if (tree.GetSize() != expected.size() || !check_range(INT_MIN, INT_MAX, expected)
+            || !check_range(-50, kValueMax / 10, expected)) {
+        std::cerr << "Failed: The sharded tree disagrees with std::set after the writes." << std::endl;
+        passed = false;
+    }
+    // Without moving key ranges, the first two shards would hold almost everything.
+    for (int i = 0; i < kShardNum; ++i) {
+        if (tree.GetShardSize(i) > expected.size() / 2) {
+            std::cerr << "Failed: Shard " << i << " isn't rebalanced." << std::endl;
+            passed = false;
+        }
+    }
+    return passed;
+}
+
+bool RbTreeTesterSnapshot(int node_num) {
+    const char* path = "rb-tree-tester.snapshot";
+    std::mt19937 gen(20250207);
+    std::uniform_int_distribution<int> value_dis(-node_num * 2, node_num * 2);
+    bool passed = true;
+
+    // Round trips of an empty tree, a single node, and a larger one.
+    for (int size : { 0, 1, node_num }) {
+        std::set<int> values;
+        RbRoot root = InitializedRbRoot;
+        while (values.size() < static_cast<size_t>(size)) {
+            int value = value_dis(gen);
+            if (values.insert(value).second) {
+                MyInsertIntoRbTree(NewMyData(value), &root);
+            }
+        }
+        MyRbTreeSnapshot snapshot;
+        if (!MyWriteRbTreeSnapshot(&root, path) || !snapshot.Open(path) || snapshot.GetSize() != values.size()) {
+            std::cerr << "Failed: Snapshot of " << size << " nodes can't be written or opened." << std::endl;
+            passed = false;
+        }
+        for (int i = 0; i < 1000 && passed; ++i) {
+            int value = value_dis(gen);
+            int hi = value + std::uniform_int_distribution<int>(0, 100)(gen);
+            std::vector<int> found;
+            size_t count = snapshot.VisitRange(value, hi, [&](int found_value) { found.push_back(found_value); });
+            if (snapshot.Contains(value) != (values.count(value) == 1) || count != found.size()
+                    || found != std::vector<int>(values.lower_bound(value), values.lower_bound(hi))) {
+                std::cerr << "Failed: Snapshot of " << size << " nodes disagrees with std::set at " << value << "." << std::endl;
+                passed = false;
+            }
+        }
+        RbRoot loaded = InitializedRbRoot;
+        if (passed && (!snapshot.LoadInto(&loaded) || !HasMyValues(&loaded, values))) {
+            std::cerr << "Failed: Snapshot of " << size << " nodes isn't loaded back." << std::endl;
+            passed = false;
+        }
+        snapshot.Close();
+        MyDestroyRbTree(&loaded);
+        MyDestroyRbTree(&root);
+    }
+
+    // Corrupted copies of a snapshot, which must be rejected by Open, or else by LoadInto.
+    // Lookups in the ones that open must stay inside the mapping.
+    RbRoot root = InitializedRbRoot;
+    for (int i = 0; i < node_num; ++i) {
+        MyInsertIntoRbTree(NewMyData(i), &root);
+    }
+    std::vector<char> bytes;
+    if (!MyWriteRbTreeSnapshot(&root, path) || !ReadMyFile(path, &bytes)) {
+        std::cerr << "Failed: Snapshot can't be written." << std::endl;
+        passed = false;
+    }
+    MyDestroyRbTree(&root);
+    struct Corruption {
+        const char* name;
+        bool opens;
+        void (*corrupt)(std::vector<char>* bytes, MySnapshotNode* nodes);
+    };
+    const Corruption corruptions[] = {
+        { "truncated header", false, [](std::vector<char>* bytes, MySnapshotNode*) {
+            bytes->resize(sizeof(MySnapshotHeader) - 1);
+        } },
+        { "truncated nodes", false, [](std::vector<char>* bytes, MySnapshotNode*) {
+            bytes->resize(bytes->size() - sizeof(MySnapshotNode) / 2);
+        } },
+        { "bad magic", false, [](std::vector<char>* bytes, MySnapshotNode*) {
+            (*bytes)[0] ^= 1;
+        } },
+        { "bad node size", false, [](std::vector<char>* bytes, MySnapshotNode*) {
+            reinterpret_cast<MySnapshotHeader*>(bytes->data())->node_size += 4;
+        } },
+        { "dropped link", true, [](std::vector<char>*, MySnapshotNode* nodes) {
+            nodes[0].left = 0;
+        } },
+        { "shared child", true, [](std::vector<char>*, MySnapshotNode* nodes) {
+            nodes[0].left = nodes[0].right;
+        } },
+        { "link out of the file", true, [](std::vector<char>*, MySnapshotNode* nodes) {
+            nodes[1].right = UINT32_MAX;
+        } },
+        { "values out of order", true, [](std::vector<char>*, MySnapshotNode* nodes) {
+            std::swap(nodes[0].value, nodes[1].value);
+        } },
+        { "red root", true, [](std::vector<char>*, MySnapshotNode* nodes) {
+            nodes[0].color = 1;
+        } },
+    };
+    for (const Corruption& corruption : corruptions) {
+        if (!passed) {
+            break;
+        }
+        std::vector<char> corrupted = bytes;
+        corruption.corrupt(&corrupted, reinterpret_cast<MySnapshotNode*>(corrupted.data() + sizeof(MySnapshotHeader)));
+        MyRbTreeSnapshot snapshot;
+        RbRoot loaded = InitializedRbRoot;
+        if (!WriteMyFile(path, corrupted) || snapshot.Open(path) != corruption.opens) {
+            passed = false;
+        } else if (corruption.opens) {
+            for (int i = -1; i <= node_num; ++i) {
+                snapshot.Contains(i);
+            }
+            snapshot.VisitRange(INT_MIN, INT_MAX, [](int) {});
+            passed = !snapshot.LoadInto(&loaded) && IsEmptyRbRoot(&loaded);
+        }
+        if (!passed) {
+            std::cerr << "Failed: Snapshot with " << corruption.name << " isn't rejected." << std::endl;
+        }
+    }
+    remove(path);
+    return passed;
+}
+
+bool RbTreeTesterPersistentTree(int op_num) {
+    constexpr int kSnapshotNum = 4;
+    constexpr int kOpsPerSnapshot = 500;
+    std::mt19937 gen(20250208);
+    std::uniform_int_distribution<int> value_dis(0, 3000);
+    PersistentRbTree<int> tree;
+    std::set<int> values;
+    // Held snapshots, and copies of the values at the time each one was taken.
+    std::vector<PersistentRbTree<int>::Snapshot> snapshots;
+    std::vector<std::set<int>> snapshot_values;
+    bool passed = true;
+    auto check = [&](const PersistentRbTree<int>::Snapshot& snapshot, const std::set<int>& expected) {
+        int lo = value_dis(gen);
+        int hi = lo + std::uniform_int_distribution<int>(0, 300)(gen);
+        std::vector<int> all;
+        std::vector<int> range;
+        snapshot.visit_range(INT_MIN, INT_MAX, [&](int value) { all.push_back(value); });
+        size_t count = snapshot.visit_range(lo, hi, [&](int value) { range.push_back(value); });
+        return snapshot.size() == expected.size() && all == std::vector<int>(expected.begin(), expected.end())
+            && count == range.size() && range == std::vector<int>(expected.lower_bound(lo), expected.lower_bound(hi))
+            && snapshot.contains(lo) == (expected.count(lo) == 1);
+    };
+
+    for (int round = 0; round * kOpsPerSnapshot < op_num && passed; ++round) {
+        // Replaces the oldest snapshot, and every other time, lets another thread drop it
+        // while this one keeps writing, so the reference counts are released concurrently.
+        std::thread releaser;
+        if (snapshots.size() == kSnapshotNum) {
+            PersistentRbTree<int>::Snapshot oldest = std::move(snapshots.front());
+            snapshots.erase(snapshots.begin());
+            snapshot_values.erase(snapshot_values.begin());
+            if (round % 2 == 0) {
+                releaser = std::thread([](PersistentRbTree<int>::Snapshot) {}, std::move(oldest));
+            }
+        }
+        snapshots.push_back(tree.snapshot());
+        snapshot_values.push_back(values);
+
+        for (int i = 0; i < kOpsPerSnapshot; ++i) {
+            int value = value_dis(gen);
+            bool inserting = gen() % 2 == 0;
+            bool changed = inserting ? tree.insert(value) : tree.erase(value);
+            bool expected = inserting ? values.insert(value).second : values.erase(value) == 1;
+            if (changed != expected || tree.size() != values.size()) {
+                std::cerr << "Failed: Persistent tree disagrees with std::set at " << value << "." << std::endl;
+                passed = false;
+                break;
+            }
+        }
+        if (releaser.joinable()) {
+            releaser.join();
+        }
+        for (size_t i = 0; i < snapshots.size() && passed; ++i) {
+            if (!check(snapshots[i], snapshot_values[i])) {
+                std::cerr << "Failed: Snapshot " << i << " of round " << round << " changed after later writes." << std::endl;
+                passed = false;
+            }
+        }
+        if (passed && !check(tree.snapshot(), values)) {
+            std::cerr << "Failed: Persistent tree disagrees with std::set in round " << round << "." << std::endl;
+            passed = false;
+        }
+    }
+    return passed;
+}
+
+bool RbTreeTesterBucketTree(int op_num) {
+    bool passed = true;
+
+    // MyLowerBoundInBucket against a scalar count, with the keys at both ends of int32_t.
+    std::mt19937 gen(20250209);
+    MyBucket bucket;
+    for (int round = 0; round < 1000 && passed; ++round) {
+        std::set<int> keys;
+        int count = static_cast<int>(gen() % (kMyBucketCapacity + 1));
+        while (static_cast<int>(keys.size()) < count) {
+            keys.insert(gen() % 4 == 0 ? (gen() % 2 == 0 ? INT32_MIN : INT32_MAX - 1) : static_cast<int>(gen() % 100) - 50);
+        }
+        std::copy(keys.begin(), keys.end(), bucket.keys);
+        std::fill(bucket.keys + count, bucket.keys + kMyBucketCapacity, INT32_MAX);
+        bucket.count = count;
+        for (int value : { INT32_MIN, INT32_MIN + 1, -51, -1, 0, 7, 50, INT32_MAX - 1, INT32_MAX }) {
+            int expected = static_cast<int>(std::distance(keys.begin(), keys.lower_bound(value)));
+            if (MyLowerBoundInBucket(&bucket, value) != expected) {
+                std::cerr << "Failed: Lower bound of " << value << " in a bucket of " << count << " keys is wrong." << std::endl;
+                passed = false;
+            }
+        }
+    }
+
+    // Every path of insert and remove on a few full buckets of even values:
+    //     0, 2, ..., 30 | 32, 34, ..., 62 | 64, 66, ..., 94
+    enum Scenario { kSplit, kAppend, kMergeWithNext, kMergeWithPrev, kDropEmpty, kScenarioNum };
+    const char* scenario_names[] = { "split", "append", "merge with next", "merge with prev", "drop empty" };
+    for (int scenario = 0; scenario < kScenarioNum && passed; ++scenario) {
+        MyBucketRbTree tree;
+        std::set<int> values;
+        auto insert = [&](int value) { passed = tree.Insert(value) == values.insert(value).second && passed; };
+        auto remove = [&](int value) { passed = tree.Remove(value) == (values.erase(value) == 1) && passed; };
+        for (int value = 0; value < 96; value += 2) {
+            insert(value);
+        }
+        size_t bucket_num = 3;
+        switch (scenario) {
+        case kSplit:
+            // The middle bucket is full, so it splits.
+            insert(33);
+            bucket_num = 4;
+            break;
+        case kAppend:
+            // Past the last full bucket, a new one starts.
+            insert(96);
+            bucket_num = 4;
+            break;
+        case kMergeWithNext:
+            // The middle bucket drains to a quarter first, while both neighbors are full.
+            for (int value = 32; value < 56; value += 2) {
+                remove(value);
+            }
+            for (int value = 0; value < 24; value += 2) {
+                remove(value);
+            }
+            bucket_num = 2;
+            break;
+        case kMergeWithPrev:
+            for (int value = 0; value < 24; value += 2) {
+                remove(value);
+            }
+            // The next bucket is full, so the middle one merges into the first one.
+            for (int value = 32; value < 56; value += 2) {
+                remove(value);
+            }
+            bucket_num = 2;
+            break;
+        case kDropEmpty:
+            // Neither neighbor has room, so the middle bucket stays until it's empty.
+            for (int value = 32; value < 64; value += 2) {
+                remove(value);
+            }
+            bucket_num = 2;
+            break;
+        }
+        if (!passed || tree.GetBucketNum() != bucket_num || !HasBucketValues(tree, values)) {
+            std::cerr << "Failed: Bucket tree is wrong after " << scenario_names[scenario] << "." << std::endl;
+            passed = false;
+        }
+    }
+
+    // Random operations against std::set, including values at both ends of int,
+    // and the padding value INT_MAX, which must not be found unless inserted.
+    MyBucketRbTree tree;
+    std::set<int> values;
+    std::uniform_int_distribution<int> value_dis(-500, 500);
+    for (int i = 0; i < op_num && passed; ++i) {
+        int value = value_dis(gen);
+        if (i % 50 == 0) {
+            value = i % 100 == 0 ? INT_MAX : INT_MIN;
+        }
+        bool changed = false;
+        bool expected = false;
+        // Drain the tree now and then, so buckets merge and disappear.
+        if ((i / 2000) % 2 == 0 ? gen() % 3 != 0 : gen() % 3 == 0) {
+            changed = tree.Insert(value);
+            expected = values.insert(value).second;
+        } else {
+            changed = tree.Remove(value);
+            expected = values.erase(value) == 1;
+        }
+        int hi = static_cast<int>(std::min<int64_t>(INT_MAX, static_cast<int64_t>(value) + gen() % 100));
+        std::vector<int> found;
+        tree.VisitRange(value, hi, [&](int found_value) { found.push_back(found_value); });
+        if (changed != expected || tree.Contains(value) != (values.count(value) == 1)
+                || found != std::vector<int>(values.lower_bound(value), values.lower_bound(hi))
+                || !HasBucketValues(tree, values)) {
+            std::cerr << "Failed: Bucket tree disagrees with std::set at " << value << "." << std::endl;
+            passed = false;
+        }
+    }
+    return passed;
+}
+
+bool RbTreeTesterSetOps() {
+    typedef void (*SetOp)(RbRoot*, RbRoot*, RbNodeCompareFunc, RbReleaseFunc, void*, RbRoot*, WorkStealingPool*);
+    const SetOp ops[] = { UnionRbTree, IntersectRbTree, DifferenceRbTree };
+    const char* op_names[] = { "union", "intersection", "difference" };
+    // Empty trees, very different sizes, and large ones which are forked over many tasks.
+    const std::pair<int, int> sizes[] = { { 0, 0 }, { 0, 100 }, { 100, 0 }, { 1, 5000 }, { 5000, 1 },
+                                          { 3000, 3000 }, { 20000, 500 }, { 500, 20000 } };
+    WorkStealingPool pool(4);
+    std::mt19937 gen(20250210);
+    bool passed = true;
+    for (int op = 0; op < 3; ++op) {
+        for (const std::pair<int, int>& size : sizes) {
+            // Overlapping values, so some are in both trees.
+            std::uniform_int_distribution<int> value_dis(0, (size.first + size.second) * 3 / 2 + 1);
+            std::set<int> a_values;
+            std::set<int> b_values;
+            while (a_values.size() < static_cast<size_t>(size.first)) {
+                a_values.insert(value_dis(gen));
+            }
+            while (b_values.size() < static_cast<size_t>(size.second)) {
+                b_values.insert(value_dis(gen));
+            }
+            std::vector<int> expected;
+            if (op == 0) {
+                std::set_union(a_values.begin(), a_values.end(), b_values.begin(), b_values.end(), std::back_inserter(expected));
+            } else if (op == 1) {
+                std::set_intersection(a_values.begin(), a_values.end(), b_values.begin(), b_values.end(), std::back_inserter(expected));
+            } else {
+                std::set_difference(a_values.begin(), a_values.end(), b_values.begin(), b_values.end(), std::back_inserter(expected));
+            }
+
+            std::vector<int> results[2];
+            for (int with_pool = 0; with_pool < 2 && passed; ++with_pool) {
+                RbRoot a = InitializedRbRoot;
+                RbRoot b = InitializedRbRoot;
+                std::set<const MyData*> a_nodes;
+                for (int value : a_values) {
+                    MyData* data = NewMyData(value);
+                    a_nodes.insert(data);
+                    MyInsertIntoRbTree(data, &a);
+                }
+                for (int value : b_values) {
+                    MyInsertIntoRbTree(NewMyData(value), &b);
+                }
+                // The result may go into either input too.
+                RbRoot result = InitializedRbRoot;
+                RbRoot* root = with_pool != 0 ? &a : &result;
+                std::atomic<size_t> released_num(0);
+                ops[op](&a, &b, CompareMyDatas, CountAndDeleteMyData, &released_num, root,
+                        with_pool != 0 ? &pool : nullptr);
+
+                // A value in `a` must keep the node of `a`, and any other one the node of `b`.
+                bool nodes_kept = true;
+                for (RbNode* node = FirstRbNode(root); node != nullptr; node = NextRbNode(node)) {
+                    const MyData* data = ContainerOf(node, struct MyData, rb_node);
+                    results[with_pool].push_back(data->value);
+                    nodes_kept = nodes_kept && (a_nodes.count(data) == 1) == (a_values.count(data->value) == 1);
+                }
+                if (CheckRbTree(root, CompareMyDatas, nullptr) != kRbCheckOk || results[with_pool] != expected
+                        || !nodes_kept || (root != &a && !IsEmptyRbRoot(&a)) || !IsEmptyRbRoot(&b)
+                        || released_num != a_values.size() + b_values.size() - expected.size()) {
+                    std::cerr << "Failed: The " << op_names[op] << " of " << size.first << " and " << size.second
+                              << " nodes is wrong " << (with_pool != 0 ? "with" : "without") << " a pool." << std::endl;
+                    passed = false;
+                }
+                MyDestroyRbTree(root);
+            }
+            if (passed && results[0] != results[1]) {
+                std::cerr << "Failed: The " << op_names[op] << " differs with and without a pool." << std::endl;
+                passed = false;
+            }
+        }
+    }
+    return passed;
+}
+
+bool RbTreeTesterBounds(int node_num, int query_num) {
+    std::mt19937 gen(20250211);
+    // Few distinct values, so there are long runs of equal ones.
+    std::uniform_int_distribution<int> value_dis(0, node_num / 4);
+    std::uniform_int_distribution<int> query_dis(-10, node_num / 4 + 10);
+    bool passed = true;
+    for (int size : { 0, 1, node_num }) {
+        RbRoot root = InitializedRbRoot;
+        std::multiset<int> values;
+        for (int i = 0; i < size; ++i) {
+            int value = value_dis(gen);
+            values.insert(value);
+            MyInsertIntoRbTree(NewMyData(value), &root);
+        }
+        // The nodes in order, and walked backwards with PrevRbNode.
+        std::vector<MyData*> datas;
+        for (RbNode* node = FirstRbNode(&root); node != nullptr; node = NextRbNode(node)) {
+            datas.push_back(ContainerOf(node, struct MyData, rb_node));
+        }
+        std::vector<MyData*> reversed;
+        for (RbNode* node = LastRbNode(&root); node != nullptr; node = PrevRbNode(node)) {
+            reversed.push_back(ContainerOf(node, struct MyData, rb_node));
+        }
+        std::reverse(reversed.begin(), reversed.end());
+        if (datas.size() != values.size() || reversed != datas
+                || !std::equal(values.begin(), values.end(), datas.begin(), [](int value, const MyData* data) {
+                    return value == data->value;
+                })) {
+            std::cerr << "Failed: Walking a tree of " << size << " nodes both ways is wrong." << std::endl;
+            passed = false;
+        }
+        // The bound is the node at the index of the std::multiset bound, or nullptr at the end.
+        auto node_at = [&](std::multiset<int>::iterator it) {
+            size_t index = static_cast<size_t>(std::distance(values.begin(), it));
+            return index < datas.size() ? datas[index] : nullptr;
+        };
+        for (int i = 0; i < query_num && passed; ++i) {
+            int lo = query_dis(gen);
+            // Some ranges are empty or inverted.
+            int hi = lo + std::uniform_int_distribution<int>(-3, 20)(gen);
+            std::vector<MyData*> found;
+            size_t count = MyVisitRangeInRbTree(lo, hi, &root, [&](MyData* data) { found.push_back(data); });
+            std::vector<MyData*> expected;
+            if (lo < hi) {
+                expected.assign(datas.begin() + std::distance(values.begin(), values.lower_bound(lo)),
+                                datas.begin() + std::distance(values.begin(), values.lower_bound(hi)));
+            }
+            if (MyLowerBoundInRbTree(lo, &root) != node_at(values.lower_bound(lo))
+                    || MyUpperBoundInRbTree(lo, &root) != node_at(values.upper_bound(lo))
+                    || count != found.size() || found != expected) {
+                std::cerr << "Failed: Bounds of [" << lo << ", " << hi << ") in a tree of " << size
+                          << " nodes are wrong." << std::endl;
+                passed = false;
+            }
+        }
+        MyDestroyRbTree(&root);
+    }
+    return passed;
+}
+
+bool RbTreeTesterRankedTree(int op_num) {
+    std::mt19937 gen(20250212);
+    // Few distinct values, so equal ones share ranks.
+    std::uniform_int_distribution<int> value_dis(0, 200);
+    RbRoot root = InitializedRbRoot;
+    std::vector<MyRankedData*> datas;
+    std::multiset<int> values;
+    bool passed = true;
+    for (int i = 0; i < op_num && passed; ++i) {
+        // Grow to about 300 nodes, then shrink back now and then.
+        bool inserting = datas.empty() || ((i / 1000) % 2 == 0 ? gen() % 4 != 0 : gen() % 4 == 0);
+        if (inserting) {
+            MyRankedData* data = new MyRankedData;
+            data->value = value_dis(gen);
+            MyInsertIntoRankedRbTree(data, &root);
+            datas.push_back(data);
+            values.insert(data->value);
+        } else {
+            size_t index = gen() % datas.size();
+            MyRankedData* data = datas[index];
+            MyRemoveFromRankedRbTree(data, &root);
+            values.erase(values.find(data->value));
+            datas[index] = datas.back();
+            datas.pop_back();
+            delete data;
+        }
+
+        bool ok = CheckRbTree(&root, CompareMyRankedDatas, nullptr) == kRbCheckOk && HasRightSizes(&root)
+            && SizeOfRbSizedTree(&root) == values.size() && MySelectInRankedRbTree(values.size(), &root) == nullptr;
+        size_t k = 0;
+        for (auto it = values.begin(); it != values.end() && ok; ++it, ++k) {
+            MyRankedData* selected = MySelectInRankedRbTree(k, &root);
+            ok = selected != nullptr && selected->value == *it && RankOfRbSizedNode(&selected->rb_node) == k;
+        }
+        for (int value = -1; value <= value_dis.max() + 1 && ok; ++value) {
+            ok = MyRankInRankedRbTree(value, &root) == static_cast<size_t>(std::distance(values.begin(), values.lower_bound(value)));
+        }
+        if (!ok) {
+            std::cerr << "Failed: Select or rank is wrong after " << (inserting ? "inserting" : "removing")
+                      << " in a tree of " << values.size() << " nodes." << std::endl;
+            passed = false;
+        }
+    }
+    for (MyRankedData* data : datas) {
+        delete data;
+    }
+    return passed;
+}
+
+bool RbTreeTesterIntrusiveTree(int op_num) {
+    std::mt19937 gen(20250213);
+    // Few distinct keys, so equal ones have to stay in insertion order.
+    std::uniform_int_distribution<int> key_dis(0, 100);
+    MyEntryTree tree;
+    // The entries in the order the tree must keep them.
+    std::vector<MyEntry*> entries;
+    auto upper_bound = [&](int key) {
+        return std::upper_bound(entries.begin(), entries.end(), key, [](int k, const MyEntry* e) { return k < e->key; });
+    };
+    auto lower_bound = [&](int key) {
+        return std::lower_bound(entries.begin(), entries.end(), key, [](const MyEntry* e, int k) { return e->key < k; });
+    };
+    auto at = [&](std::vector<MyEntry*>::iterator it) { return it != entries.end() ? *it : nullptr; };
+    auto to_entry = [&](MyEntryTree::iterator it) { return it != tree.end() ? &*it : nullptr; };
+    bool passed = true;
+    for (int i = 0; i < op_num && passed; ++i) {
+        MyEntry* entry = new MyEntry;
+        entry->key = key_dis(gen);
+        // Keep about 300 entries.
+        int op = static_cast<int>(gen() % 8);
+        if (entries.size() < 300 ? op >= 5 : op < 5) {
+            op = static_cast<int>(gen() % 4);
+        }
+        const char* op_name = "";
+        MyEntry* victim = entries.empty() ? nullptr : entries[gen() % entries.size()];
+        switch (entries.empty() && op >= 4 ? 0 : op) {
+        case 0:
+            op_name = "insert";
+            entries.insert(upper_bound(entry->key), entry);
+            passed = &*tree.insert(entry) == entry;
+            entry = nullptr;
+            break;
+        case 1: {
+            op_name = "hinted insert";
+            MyEntryTree::iterator hint = victim != nullptr ? tree.iterator_to(*victim) : tree.end();
+            entries.insert(upper_bound(entry->key), entry);
+            passed = &*tree.insert(hint, entry) == entry;
+            entry = nullptr;
+            break;
+        }
+        case 2: {
+            op_name = "insert_unique";
+            MyEntry* existing = at(lower_bound(entry->key));
+            bool unique = existing == nullptr || existing->key != entry->key;
+            std::pair<MyEntryTree::iterator, bool> result = tree.insert_unique(entry);
+            // With equal keys in the tree, any one of them may be returned.
+            passed = result.second == unique && (unique ? &*result.first == entry : result.first->key == entry->key);
+            if (unique) {
+                entries.insert(upper_bound(entry->key), entry);
+                entry = nullptr;
+            }
+            break;
+        }
+        case 3: {
+            op_name = "find_or_insert";
+            MyEntry* existing = at(lower_bound(entry->key));
+            bool unique = existing == nullptr || existing->key != entry->key;
+            std::pair<MyEntryTree::iterator, bool> result = tree.find_or_insert(entry->key, [&]() { return entry; });
+            // With equal keys in the tree, any one of them may be returned.
+            passed = result.second == unique && (unique ? &*result.first == entry : result.first->key == entry->key);
+            if (unique) {
+                entries.insert(upper_bound(entry->key), entry);
+                entry = nullptr;
+            }
+            break;
+        }
+        case 4: {
+            op_name = "erase";
+            auto it = std::find(entries.begin(), entries.end(), victim);
+            MyEntry* next = at(it + 1);
+            entries.erase(it);
+            passed = to_entry(gen() % 2 == 0 ? tree.erase(victim) : tree.erase(tree.iterator_to(*victim))) == next;
+            delete victim;
+            break;
+        }
+        case 5:
+            op_name = "replace_node";
+            entry->key = victim->key;
+            *std::find(entries.begin(), entries.end(), victim) = entry;
+            tree.replace_node(victim, entry);
+            entry = victim;
+            break;
+        default: {
+            op_name = "update_position";
+            // Only moved if the new key breaks the order with the neighbors, and then after the equal ones.
+            auto it = std::find(entries.begin(), entries.end(), victim);
+            victim->key = entry->key;
+            bool in_order = (it == entries.begin() || (*(it - 1))->key <= victim->key)
+                && (it + 1 == entries.end() || victim->key <= (*(it + 1))->key);
+            if (!in_order) {
+                entries.erase(it);
+                entries.insert(upper_bound(victim->key), victim);
+            }
+            passed = &*tree.update_position(victim) == victim;
+            break;
+        }
+        }
+        delete entry;
+
+        // Lookups with the key type, and transparent ones with another type.
+        int key = key_dis(gen) - 1;
+        long long wide_key = key;
+        MyEntry* first = at(lower_bound(key));
+        bool present = first != nullptr && first->key == key;
+        MyEntry* found = to_entry(tree.find(key));
+        passed = passed && HasEntries(tree, entries)
+            && (present ? found != nullptr && found->key == key : found == nullptr)
+            && tree.contains(key) == present && tree.contains(wide_key) == present
+            && (tree.find(wide_key) == tree.end()) == !present
+            && to_entry(tree.lower_bound(key)) == first && to_entry(tree.lower_bound(wide_key)) == first
+            && to_entry(tree.upper_bound(key)) == at(upper_bound(key))
+            && to_entry(tree.upper_bound(wide_key)) == at(upper_bound(key));
+        if (!passed) {
+            std::cerr << "Failed: IntrusiveRbTree disagrees with the model after " << op_name << "." << std::endl;
+        }
+
+        // Move the tree out and back now and then.
+        if (passed && i % 1000 == 999) {
+            MyEntryTree moved(std::move(tree));
+            passed = tree.empty() && tree.size() == 0 && HasEntries(moved, entries);
+            tree = std::move(moved);
+            passed = passed && moved.empty() && HasEntries(tree, entries);
+            if (!passed) {
+                std::cerr << "Failed: Moving IntrusiveRbTree loses entries." << std::endl;
+            }
+        }
+    }
+
+    size_t disposed_num = 0;
+    tree.clear_and_dispose([&](MyEntry* entry) {
+        ++disposed_num;
+        delete entry;
+    });
+    if (passed && (disposed_num != entries.size() || !tree.empty() || tree.size() != 0 || tree.begin() != tree.end())) {
+        std::cerr << "Failed: clear_and_dispose doesn't dispose every entry." << std::endl;
+        passed = false;
+    }
+    return passed;
+}
+
+bool RbTreeTesterCheck() {
+    /*
+        Links a small legal tree of MyData by hand, so every corruption below has a known result:
+                   4(B)
+                 /      \
+              2(R)      6(R)
+             /   \     /   \
+           1(B) 3(B) 5(B) 7(B)
+    */
+    MyData datas[8];
+    RbRoot root = InitializedRbRoot;
+    auto node = [&](int value) { return &datas[value].rb_node; };
+    auto build = [&]() {
+        for (int value = 1; value <= 7; ++value) {
+            datas[value].value = value;
+            node(value)->left = node(value)->right = nullptr;
+        }
+        const int parents[8] = { 0, 2, 4, 2, 0, 6, 4, 6 };
+        for (int value = 1; value <= 7; ++value) {
+            RbNode* parent = parents[value] != 0 ? node(parents[value]) : nullptr;
+            SetParentAndColor(node(value), parent, value == 2 || value == 6 ? kRed : kBlack);
+            if (parent != nullptr) {
+                (value < parents[value] ? parent->left : parent->right) = node(value);
+            }
+        }
+        root.rb_node = node(4);
+    };
+
+    struct Corruption {
+        const char* name;
+        RbCheckResult result;
+        int bad_value;
+    };
+    const Corruption corruptions[] = {
+        { "none", kRbCheckOk, 0 },
+        { "red root", kRbCheckRedRoot, 4 },
+        { "root with a parent", kRbCheckBadParentLink, 4 },
+        { "child linked to another parent", kRbCheckBadParentLink, 2 },
+        { "red child of a red node", kRbCheckRedRed, 6 },
+        { "extra black node", kRbCheckBlackHeight, 5 },
+        { "swapped values", kRbCheckOutOfOrder, 4 },
+    };
+    bool passed = true;
+    for (size_t i = 0; i < sizeof(corruptions) / sizeof(corruptions[0]); ++i) {
+        build();
+        switch (i) {
+        case 1: SetColor(node(4), kRed); break;
+        case 2: SetParent(node(4), node(1)); break;
+        case 3: SetParent(node(3), node(6)); break;
+        case 4: SetColor(node(5), kRed); break;
+        case 5: SetColor(node(2), kBlack); break;
+        case 6: std::swap(datas[3].value, datas[5].value); break;
+        }
+        const Corruption& corruption = corruptions[i];
+        const RbNode* bad_node = nullptr;
+        RbCheckResult result = CheckRbTree(&root, CompareMyDatas, &bad_node);
+        const RbNode* expected_bad_node = corruption.bad_value != 0 ? node(corruption.bad_value) : nullptr;
+        if (result != corruption.result || bad_node != expected_bad_node) {
+            std::cerr << "Failed: CheckRbTree says \"" << DescribeRbCheckResult(result) << "\" on a tree with "
+                      << corruption.name << "." << std::endl;
+            passed = false;
+        }
+        // Without `compare`, only the order goes unchecked.
+        RbCheckResult unordered_result = CheckRbTree(&root, nullptr, nullptr);
+        if (unordered_result != (corruption.result == kRbCheckOutOfOrder ? kRbCheckOk : corruption.result)) {
+            std::cerr << "Failed: CheckRbTree without compare says \"" << DescribeRbCheckResult(unordered_result)
+                      << "\" on a tree with " << corruption.name << "." << std::endl;
+            passed = false;
+        }
+    }
+    return passed;
+}
+
+bool RbTreeTesterHintedInsert(int insert_num) {
+    std::mt19937 gen(20250214);
+    std::uniform_int_distribution<int> value_dis(0, 50);
+    RbRoot root = InitializedRbRoot;
+    MyEntryTree tree;
+    // The nodes in the order both trees must keep them, equal values in insertion order.
+    std::vector<MyData*> datas;
+    std::vector<MyEntry*> entries;
+    bool passed = true;
+    for (int i = 0; i < insert_num && passed; ++i) {
+        // Runs of values after the maximum and before the minimum, with hints on those ends,
+        // mixed with random values and random, stale hints.
+        int phase = (i / 200) % 3;
+        int value = value_dis(gen);
+        size_t hint_index = datas.empty() ? 0 : gen() % datas.size();
+        if (phase == 1 && !datas.empty()) {
+            value = datas.back()->value + static_cast<int>(gen() % 2);
+            hint_index = gen() % 4 != 0 ? datas.size() - 1 : 0;
+        } else if (phase == 2 && !datas.empty()) {
+            value = datas.front()->value - static_cast<int>(gen() % 2);
+            hint_index = gen() % 4 != 0 ? 0 : datas.size() - 1;
+        }
+        bool no_hint = datas.empty() || gen() % 16 == 0;
+
+        MyData* data = NewMyData(value);
+        MyInsertIntoRbTreeWithHint(data, no_hint ? nullptr : datas[hint_index], &root);
+        datas.insert(std::upper_bound(datas.begin(), datas.end(), value, [](int v, const MyData* d) {
+            return v < d->value;
+        }), data);
+
+        MyEntry* entry = new MyEntry;
+        entry->key = value;
+        MyEntryTree::iterator hint = no_hint ? tree.end() : tree.iterator_to(*entries[hint_index]);
+        bool linked = &*tree.insert(hint, entry) == entry;
+        entries.insert(std::upper_bound(entries.begin(), entries.end(), value, [](int v, const MyEntry* e) {
+            return v < e->key;
+        }), entry);
+
+        size_t index = 0;
+        bool in_order = IsLegalRbTree(&root);
+        for (RbNode* node = FirstRbNode(&root); node != nullptr && in_order; node = NextRbNode(node)) {
+            in_order = index < datas.size() && ContainerOf(node, struct MyData, rb_node) == datas[index++];
+        }
+        if (!in_order || index != datas.size() || !linked || !HasEntries(tree, entries)) {
+            std::cerr << "Failed: Inserting " << value << " next to the hint at " << hint_index
+                      << " breaks the order." << std::endl;
+            passed = false;
+        }
+    }
+    MyDestroyRbTree(&root);
+    tree.clear_and_dispose([](MyEntry* entry) { delete entry; });
+    return passed;
+}
+
+bool RbTreeTesterCompaction() {
+    std::mt19937 gen(20250215);
+    bool passed = true;
+    // Around the sizes where the top block of the layout fills up, and a large tree.
+    for (int size : { 1, 127, 128, 129, 100000 }) {
+        std::uniform_int_distribution<int> value_dis(0, size);
+        RbRoot root = InitializedRbRoot;
+        std::multiset<int> values;
+        std::vector<MyData*> datas;
+        for (int i = 0; i < size; ++i) {
+            int value = value_dis(gen);
+            values.insert(value);
+            MyInsertIntoRbTree(NewMyData(value), &root);
+        }
+        size_t last_footprint = 0;
+        for (int pass = 0; pass < 5 && passed; ++pass) {
+            // Replace some nodes before the first passes, and none before the last ones.
+            for (int i = 0; pass < 3 && i < size / 10 + 1; ++i) {
+                int value = value_dis(gen);
+                MyData* victim = MyLowerBoundInRbTree(value, &root);
+                if (victim != nullptr) {
+                    values.erase(values.find(victim->value));
+                    MyRemoveFromRbTree(victim, &root);
+                }
+                value = value_dis(gen);
+                values.insert(value);
+                MyInsertIntoRbTree(NewMyData(value), &root);
+            }
+            size_t moved_num = MyCompactRbTree(&root);
+            auto it = values.begin();
+            bool in_order = moved_num == values.size() && CheckRbTree(&root, CompareMyDatas, nullptr) == kRbCheckOk;
+            for (RbNode* node = FirstRbNode(&root); node != nullptr && in_order; node = NextRbNode(node), ++it) {
+                in_order = it != values.end() && ContainerOf(node, struct MyData, rb_node)->value == *it;
+            }
+            if (!in_order || it != values.end()) {
+                std::cerr << "Failed: Compaction pass " << pass << " of " << size << " nodes is wrong." << std::endl;
+                passed = false;
+            }
+            // Without inserts in between, a pass releases the run of the previous one.
+            size_t footprint = GetMyDataFootprint();
+            if (passed && pass == 4 && footprint > last_footprint) {
+                std::cerr << "Failed: Compacting " << size << " nodes again grows the pool from "
+                          << last_footprint << " to " << footprint << " bytes." << std::endl;
+                passed = false;
+            }
+            last_footprint = footprint;
+        }
+        MyDestroyRbTree(&root);
+    }
+    return passed;
+}
@@ -1,24 +1,90 @@
 #include "include/rb-tree.h"
+#include "include/rb-tree-augmented.h"
+#include "include/rb-tree-stats.h"
 
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <assert.h>
 
-inline void Transplant(RbNode* old_node, RbNode* new_node, RbRoot* root) {
+#if (RB_TREE_STATS || RB_TREE_CHECK_INTERVAL) && defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#if defined(_MSC_VER) && (defined(_M_IX86) || defined(_M_X64))
+#include <xmmintrin.h>
+#endif
+
+// Hints the CPU to start loading `ptr`, so that a walk can wait for several cache misses at once.
+#if defined(_MSC_VER) && (defined(_M_IX86) || defined(_M_X64))
+#define RbPrefetch(ptr) _mm_prefetch((const char*)(ptr), _MM_HINT_T0)
+#elif defined(__GNUC__)
+#define RbPrefetch(ptr) __builtin_prefetch(ptr)
+#else
+#define RbPrefetch(ptr) ((void)(ptr))
+#endif
+
+/* Relaxed atomic counters, for the statistics and the sampled checks */
+#if defined(_MSC_VER)
+#define RbAtomicIncrement(counter) _InterlockedIncrement64((volatile long long*)(counter))
+#define RbAtomicLoad(counter) ((uint64_t)_InterlockedCompareExchange64((volatile long long*)(counter), 0, 0))
+#define RbAtomicClear(counter) _InterlockedExchange64((volatile long long*)(counter), 0)
+#else
+#define RbAtomicIncrement(counter) __atomic_fetch_add((counter), 1, __ATOMIC_RELAXED)
+#define RbAtomicLoad(counter) __atomic_load_n((counter), __ATOMIC_RELAXED)
+#define RbAtomicClear(counter) __atomic_store_n((counter), 0, __ATOMIC_RELAXED)
+#endif
+
+/* Statistics, see rb-tree-stats.h */
+#if RB_TREE_STATS
+static RbTreeStats g_stats;
+
+#define RbStatsIncrement(counter) RbAtomicIncrement(&g_stats.counter)
+#define RbStatsHistogram(histogram, value) \
+    RbAtomicIncrement(&g_stats.histogram[(value) < kRbStatsHistogramSize ? (value) : kRbStatsHistogramSize - 1])
+#else
+#define RbStatsIncrement(counter) ((void)0)
+#define RbStatsHistogram(histogram, value) ((void)(value))
+#endif
+
+/* Sampled checks, see RB_TREE_CHECK_INTERVAL in rb-tree.h */
+#if RB_TREE_CHECK_INTERVAL
+static uint64_t g_check_op_count;
+
+static void SampleCheckRbTree(const RbRoot* root) {
+    if (RbAtomicIncrement(&g_check_op_count) % RB_TREE_CHECK_INTERVAL != 0) {
+        return;
+    }
+    const RbNode* bad_node = NULL;
+    RbCheckResult result = CheckRbTree(root, NULL, &bad_node);
+    if (result != kRbCheckOk) {
+        fprintf(stderr, "Broken rb-tree at node %p: %s\n", (const void*)bad_node, DescribeRbCheckResult(result));
+        abort();
+    }
+}
+
+#define RbSampleCheck(root) SampleCheckRbTree(root)
+#else
+#define RbSampleCheck(root) ((void)0)
+#endif
+
+// Same with CLRS
+static inline void Transplant(RbNode* old_node, RbNode* new_node, RbRoot* root) {
     assert(old_node != NULL);
+    RbNode* parent = GetParent(old_node);
     if (old_node == root->rb_node) {
-        assert(old_node->parent == NULL);
-        root->rb_node = new_node;
-    } else if (old_node->parent->left == old_node) {
-        old_node->parent->left = new_node;
-    } else if (old_node->parent->right == old_node) {
-        old_node->parent->right = new_node;
+        assert(parent == NULL);
+        RbWriteLink(root->rb_node, new_node);
+    } else if (parent->left == old_node) {
+        RbWriteLink(parent->left, new_node);
+    } else if (parent->right == old_node) {
+        RbWriteLink(parent->right, new_node);
     }
     if (new_node) {
-        new_node->parent = old_node->parent;
+        SetParent(new_node, parent);
     }
 }
 
-inline void RotateLeft(RbNode* x, RbRoot* root) {
+static inline void RotateLeft(RbNode* x, RbRoot* root) {
     /*
         Before rotate.
                 p
@@ -49,14 +115,14 @@ inline void RotateLeft(RbNode* x, RbRoot* root) {
     // Reset y's parent.
     Transplant(x, y, root);
     // Reconnect x with y.
-    y->left = x;
-    x->parent = y;
+    RbWriteLink(y->left, x);
+    SetParent(x, y);
     // Reconnect b with x.
-    x->right = b;
-    if (b) b->parent = x;
+    RbWriteLink(x->right, b);
+    if (b) SetParent(b, x);
 }
 
-inline void RotateRight(RbNode* x, RbRoot* root) {
+static inline void RotateRight(RbNode* x, RbRoot* root) {
     /*
         Before rotate.
                 p
@@ -87,24 +153,45 @@ inline void RotateRight(RbNode* x, RbRoot* root) {
     // Reset y's parent.
     Transplant(x, y, root);
     // Reconnect x with y.
-    y->right = x;
-    x->parent = y;
+    RbWriteLink(y->right, x);
+    SetParent(x, y);
     // Connect b with x;
-    x->left = b;
-    if (b) b->parent = x;
+    RbWriteLink(x->left, b);
+    if (b) SetParent(b, x);
 }
 
-void FixupAfterInsert(RbNode* node, RbRoot* root) {
+/*
+    Rotations used by the fixup routines.
+    `y` takes the place of `x`, so it inherits the metadata of the whole subtree,
+    and only `x` has to be recomputed by the augmented callbacks.
+*/
+static void RotateLeftAugmented(RbNode* x, RbRoot* root, const RbAugmentCallbacks* augment) {
+    RbStatsIncrement(rotate_left);
+    RotateLeft(x, root);
+    if (augment) augment->rotate(x, GetParent(x));
+}
+
+static void RotateRightAugmented(RbNode* x, RbRoot* root, const RbAugmentCallbacks* augment) {
+    RbStatsIncrement(rotate_right);
+    RotateRight(x, root);
+    if (augment) augment->rotate(x, GetParent(x));
+}
+
+// Returns true if the root was red before the final recoloring,
+// which means the black height of the whole tree has grown by one.
+static bool DoFixupAfterInsert(RbNode* node, RbRoot* root, const RbAugmentCallbacks* augment) {
     assert(node != NULL);
 
     RbNode* uncle = NULL;
     RbNode* parent = NULL;
     RbNode* gparent = NULL;
+    int loops = 0;
 
-    while (IsRed(parent = node->parent)) {
-        assert(node->color == kRed);
+    while (IsRed(parent = GetParent(node))) {
+        assert(GetColor(node) == kRed);
+        ++loops;
 
-        gparent = parent->parent;
+        gparent = GetParent(parent);
         assert(gparent != NULL);
         
         if (parent == gparent->left) {
@@ -125,6 +212,7 @@ void FixupAfterInsert(RbNode* node, RbRoot* root) {
 
             */
             if (IsRed(uncle)) {
+                RbStatsIncrement(insert_cases[0]);
                 SetColor(gparent, kRed);
                 SetColor(parent, kBlack);
                 SetColor(uncle, kBlack);
@@ -147,7 +235,8 @@ void FixupAfterInsert(RbNode* node, RbRoot* root) {
                        node                 `node` pointer --->  parent
             */
             if (node == parent->right) {
-                RotateLeft(parent, root);
+                RbStatsIncrement(insert_cases[1]);
+                RotateLeftAugmented(parent, root, augment);
                 RbNode* tmp = parent;
                 parent = node;
                 node = tmp;
@@ -167,7 +256,8 @@ void FixupAfterInsert(RbNode* node, RbRoot* root) {
                   /                                           \
                 node                                        [uncle]
             */
-            RotateRight(gparent, root);
+            RbStatsIncrement(insert_cases[2]);
+            RotateRightAugmented(gparent, root, augment);
             SetColor(parent, kBlack);
             SetColor(gparent, kRed);
             break;
@@ -176,6 +266,7 @@ void FixupAfterInsert(RbNode* node, RbRoot* root) {
             uncle = gparent->left;
             /* Case 1 */
             if (IsRed(uncle)) {
+                RbStatsIncrement(insert_cases[0]);
                 SetColor(gparent, kRed);
                 SetColor(parent, kBlack);
                 SetColor(uncle, kBlack);
@@ -184,40 +275,67 @@ void FixupAfterInsert(RbNode* node, RbRoot* root) {
             }
             /* Case 2 */
             if (node == parent->left) {
-                RotateRight(parent, root);
+                RbStatsIncrement(insert_cases[1]);
+                RotateRightAugmented(parent, root, augment);
                 RbNode* tmp = parent;
                 parent = node;
                 node = tmp;
             }
             /* Case 3 */
-            RotateLeft(gparent, root);
+            RbStatsIncrement(insert_cases[2]);
+            RotateLeftAugmented(gparent, root, augment);
             SetColor(parent, kBlack);
             SetColor(gparent, kRed);
             break;
         }
     }
+    RbStatsHistogram(insert_fixup_loops, loops);
     // Don't forget to force to set root node to black.
+    bool root_was_red = IsRed(root->rb_node);
     SetColor(root->rb_node, kBlack);
+    return root_was_red;
 }
 
-void InsertIntoRbTree(RbNode* node, RbNode* parent, RbNode** parent_link, RbRoot* root) {
+void FixupAfterInsert(RbNode* node, RbRoot* root) {
+    DoFixupAfterInsert(node, root, NULL);
+}
+
+static void LinkRbNode(RbNode* node, RbNode* parent, RbNode** parent_link) {
     assert(node != NULL && parent_link != NULL);
     assert(*parent_link == NULL);
     assert(!parent || (&parent->left == parent_link || &parent->right == parent_link));
 
     node->left = node->right = NULL;
-    SetColor(node, kRed);
-    node->parent = parent;
-    *parent_link = node;
+    SetParentAndColor(node, parent, kRed);
+    RbWriteLink(*parent_link, node);
+}
 
-    FixupAfterInsert(node, root);
+void InsertIntoRbTree(RbNode* node, RbNode* parent, RbNode** parent_link, RbRoot* root) {
+    LinkRbNode(node, parent, parent_link);
+    DoFixupAfterInsert(node, root, NULL);
+    RbSampleCheck(root);
 }
 
-void FixupAfterRemove(RbNode* node, RbNode* node_parent, RbRoot* root) {
+void InsertIntoRbTreeAugmented(
+    RbNode* node, RbNode* parent, RbNode** parent_link,
+    RbRoot* root, const RbAugmentCallbacks* augment
+) {
+    LinkRbNode(node, parent, parent_link);
+    // Update the new path first, then the rotations will keep it correct.
+    augment->propagate(node, NULL);
+    DoFixupAfterInsert(node, root, augment);
+    RbSampleCheck(root);
+}
+
+static void DoFixupAfterRemove(
+    RbNode* node, RbNode* node_parent, RbRoot* root, const RbAugmentCallbacks* augment
+) {
+    int loops = 0;
     while ((node == NULL || IsBlack(node)) && node != root->rb_node) {
+        ++loops;
         assert(node_parent != NULL);
         assert(node_parent->left == node || node_parent->right == node);
-        assert(node == NULL || node->parent == node_parent);
+        assert(node == NULL || GetParent(node) == node_parent);
 
         RbNode* sibling = NULL;
         if (node == node_parent->left) {
@@ -244,7 +362,8 @@ void FixupAfterRemove(RbNode* node, RbNode* node_parent, RbRoot* root) {
             */
             if (IsRed(sibling)) {
                 assert(IsBlack(node_parent));
-                RotateLeft(node_parent, root);
+                RbStatsIncrement(remove_cases[0]);
+                RotateLeftAugmented(node_parent, root, augment);
                 SetColor(node_parent, kRed);
                 SetColor(sibling, kBlack);
             }
@@ -267,9 +386,10 @@ void FixupAfterRemove(RbNode* node, RbNode* node_parent, RbRoot* root) {
                       c   d   e   f                             c   d  e   f
             */
             else if (!IsRed(sibling->left) && !IsRed(sibling->right)) {
+                RbStatsIncrement(remove_cases[1]);
                 SetColor(sibling, kRed);
                 node = node_parent;
-                node_parent = node->parent;
+                node_parent = GetParent(node);
             }
             /*
                 Case 3: The `node` has a black sibling, and the sibling has a red child in left but not right.
@@ -296,9 +416,10 @@ void FixupAfterRemove(RbNode* node, RbNode* node_parent, RbRoot* root) {
             */
             else if (IsBlack(sibling->right)) {
                 assert(IsRed(sibling->left));
+                RbStatsIncrement(remove_cases[2]);
                 SetColor(sibling, kRed);
                 SetColor(sibling->left, kBlack);
-                RotateRight(sibling, root);
+                RotateRightAugmented(sibling, root, augment);
             }
             /*
                 Case 4: The `node` has a black sibling, and the sibling's right child is red.
@@ -320,10 +441,11 @@ void FixupAfterRemove(RbNode* node, RbNode* node_parent, RbRoot* root) {
                       c   d   e   f                  a   b   c   d
             */
             else {
-                SetColor(sibling, node_parent->color);
+                RbStatsIncrement(remove_cases[3]);
+                SetColor(sibling, GetColor(node_parent));
                 SetColor(node_parent, kBlack);
                 SetColor(sibling->right, kBlack);
-                RotateLeft(node_parent, root);
+                RotateLeftAugmented(node_parent, root, augment);
                 // Ok, now the rb-tree is rebalanced.
                 // Let's exit the loop simply.
                 break;
@@ -335,35 +457,40 @@ void FixupAfterRemove(RbNode* node, RbNode* node_parent, RbRoot* root) {
             /* Case 1: The `node` has a red sibling. */
             if (IsRed(sibling)) {
                 assert(IsBlack(node_parent));
-                RotateRight(node_parent, root);
+                RbStatsIncrement(remove_cases[0]);
+                RotateRightAugmented(node_parent, root, augment);
                 SetColor(node_parent, kRed);
                 SetColor(sibling, kBlack);
             }
             /* Case 2 */
             else if (!IsRed(sibling->left) && !IsRed(sibling->right)) {
+                RbStatsIncrement(remove_cases[1]);
                 SetColor(sibling, kRed);
                 node = node_parent;
-                node_parent = node->parent;
+                node_parent = GetParent(node);
             }
             /* Case 3 */
             else if (IsBlack(sibling->left)) {
                 assert(IsRed(sibling->right));
+                RbStatsIncrement(remove_cases[2]);
                 SetColor(sibling, kRed);
                 SetColor(sibling->right, kBlack);
-                RotateLeft(sibling, root);
+                RotateLeftAugmented(sibling, root, augment);
             }
             /* Case 4 */
             else {
-                SetColor(sibling, node_parent->color);
+                RbStatsIncrement(remove_cases[3]);
+                SetColor(sibling, GetColor(node_parent));
                 SetColor(node_parent, kBlack);
                 SetColor(sibling->left, kBlack);
-                RotateRight(node_parent, root);
+                RotateRightAugmented(node_parent, root, augment);
                 // Ok, now the rb-tree is rebalanced.
                 // Let's exit the loop simply.
                 break;
             }
         }
     }
+    RbStatsHistogram(remove_fixup_loops, loops);
     // If `node` is tree root, it will "absorb" additional black color.
     // If `node` is red, it will be recolored to black simply.
     if (node != NULL) {
@@ -371,10 +498,14 @@ void FixupAfterRemove(RbNode* node, RbNode* node_parent, RbRoot* root) {
     }
 }
 
-void RemoveFromRbTree(RbNode* node, RbRoot* root) {
+void FixupAfterRemove(RbNode* node, RbNode* node_parent, RbRoot* root) {
+    DoFixupAfterRemove(node, node_parent, root, NULL);
+}
+
+static void DoRemoveFromRbTree(RbNode* node, RbRoot* root, const RbAugmentCallbacks* augment) {
     RbNode* replacement = NULL;
-    RbNode* replacement_parent = node->parent;
-    Color removed_color = node->color;
+    RbNode* replacement_parent = GetParent(node);
+    Color removed_color = GetColor(node);
     if (node->left == NULL) {
         replacement = node->right;
         Transplant(node, replacement, root);
@@ -394,27 +525,665 @@ void RemoveFromRbTree(RbNode* node, RbRoot* root) {
         replacement = successor->right;
         if (successor != node->right) {
             // Reset the parent of successor's right child
-            replacement_parent = successor->parent;
+            replacement_parent = GetParent(successor);
             Transplant(successor, replacement, root);
             // Reconnect node's right child with successor.
-            successor->right = node->right;
-            node->right->parent = successor;
+            RbWriteLink(successor->right, node->right);
+            SetParent(node->right, successor);
         } else {
             replacement_parent = successor;
         }
         // Replace node with successor.
         Transplant(node, successor, root);
         // Reconnect node's left child with successor.
-        successor->left = node->left;
-        node->left->parent = successor;
+        RbWriteLink(successor->left, node->left);
+        SetParent(node->left, successor);
         // Record the original color of successor,
         // which is the real color the rb-tree lost.
-        removed_color = successor->color;
+        removed_color = GetColor(successor);
         // Recolor successor with node's color.
-        SetColor(successor, node->color);
+        SetColor(successor, GetColor(node));
+        // Successor now roots the old subtree of node.
+        if (augment) augment->copy(node, successor);
     }
+    // Every node whose subtree lost a node lies on the path from `replacement_parent` to root.
+    if (augment) augment->propagate(replacement_parent, NULL);
     // Don't forget to rebalance the rb-tree.
     if (removed_color == kBlack) {
-        FixupAfterRemove(replacement, replacement_parent, root);
+        DoFixupAfterRemove(replacement, replacement_parent, root, augment);
+    }
+    RbSampleCheck(root);
+}
+
+void RemoveFromRbTree(RbNode* node, RbRoot* root) {
+    DoRemoveFromRbTree(node, root, NULL);
+}
+
+void RemoveFromRbTreeAugmented(RbNode* node, RbRoot* root, const RbAugmentCallbacks* augment) {
+    DoRemoveFromRbTree(node, root, augment);
+}
+
+void ReplaceRbNode(RbNode* victim, RbNode* new_node, RbRoot* root) {
+    assert(victim != NULL && new_node != NULL);
+    // Copy the color and the links, then let the parent and children point to `new_node`.
+    *new_node = *victim;
+    Transplant(victim, new_node, root);
+    if (victim->left) SetParent(victim->left, new_node);
+    if (victim->right) SetParent(victim->right, new_node);
+}
+
+/*
+    Splitting the range at the middle makes a tree whose levels are all full except the deepest one.
+    Coloring that partial level red and everything else black gives the same black height
+    to every path, and red nodes there have no children.
+
+    e.g. 5 nodes:
+                [3]
+                / \
+               /   \
+             [2]   [5]
+             /     /
+            1     4
+*/
+static RbNode* BuildSubtree(
+    void* const* entries, size_t begin, size_t end, size_t node_offset,
+    RbNode* parent, size_t depth, size_t red_depth
+) {
+    if (begin >= end) {
+        return NULL;
+    }
+    size_t mid = begin + (end - begin) / 2;
+    RbNode* node = (RbNode*)((uintptr_t)entries[mid] + node_offset);
+    SetParentAndColor(node, parent, depth == red_depth ? kRed : kBlack);
+    node->left = BuildSubtree(entries, begin, mid, node_offset, node, depth + 1, red_depth);
+    node->right = BuildSubtree(entries, mid + 1, end, node_offset, node, depth + 1, red_depth);
+    return node;
+}
+
+void BuildRbTreeFromSorted(void* const* entries, size_t entry_num, size_t node_offset, RbRoot* root) {
+    // The deepest level is floor(log2(n)), and it's full only if n + 1 is a power of 2.
+    size_t deepest = 0;
+    while ((entry_num >> deepest) > 1) {
+        ++deepest;
+    }
+    bool deepest_is_full = ((entry_num + 1) & entry_num) == 0;
+    size_t red_depth = deepest_is_full ? (size_t)-1 : deepest;
+    root->rb_node = BuildSubtree(entries, 0, entry_num, node_offset, NULL, 0, red_depth);
+}
+
+/*
+    Relayout in blocks of `levels` levels, each one at most a page:
+    the top block of the tree holds its first levels in breadth-first order, and it's followed
+    by the blocks of the subtrees hanging below it, one subtree after another, and so on.
+    The blocks are packed without padding, so only the top one starts a page (if `buffer` does,
+    like the runs of AllocRunFromNodePool), and any other may straddle two pages.
+    A descent then touches at most two pages per `levels` levels, and its first levels share a few cache lines.
+
+    e.g. levels = 2:
+                0
+               / \
+              1   2         block 0: 0 1 2
+             / \   \        block 1: 3 4 5  (below 1)
+            3   6   9       block 2: 6 ...
+           / \
+          4   5
+*/
+enum {
+    kRelayoutPageSize = 4096,
+    kRelayoutMaxBlockLevels = 7,
+    kRelayoutMaxBlockSize = (1 << kRelayoutMaxBlockLevels) - 1,
+    // Blocks are laid out depth first, and every block on the way down leaves at most 2^levels
+    // subtrees pending. No legal rb-tree is deeper than 128 levels.
+    kRelayoutStackSize = (128 / kRelayoutMaxBlockLevels + 1) << kRelayoutMaxBlockLevels,
+};
+
+size_t RelayoutRbTree(RbRoot* root, void* buffer, size_t entry_size, size_t node_offset) {
+    if (root->rb_node == NULL) {
+        return 0;
+    }
+    int levels = 1;
+    while (levels < kRelayoutMaxBlockLevels && ((size_t)2 << levels) * entry_size <= kRelayoutPageSize) {
+        ++levels;
+    }
+
+    // Copy the entries block by block. The copies still link to the old nodes, and every old node
+    // gets the address of its copy in `left`, as a forwarding pointer.
+    RbNode* pending[kRelayoutStackSize];
+    size_t pending_num = 0;
+    pending[pending_num++] = root->rb_node;
+    size_t entry_num = 0;
+    while (pending_num > 0) {
+        RbNode* block[kRelayoutMaxBlockSize];
+        size_t block_begin = 0;
+        size_t block_end = 0;
+        block[block_end++] = pending[--pending_num];
+        size_t level_end = block_end;
+        int level = 0;
+        RbNode* below[1 << kRelayoutMaxBlockLevels];
+        size_t below_num = 0;
+        while (block_begin < block_end) {
+            RbNode* old_node = block[block_begin++];
+            char* new_entry = (char*)buffer + entry_num++ * entry_size;
+            memcpy(new_entry, (char*)old_node - node_offset, entry_size);
+            old_node->left = (RbNode*)(new_entry + node_offset);
+            RbNode* copy = old_node->left;
+            RbNode* children[2] = { copy->left, copy->right };
+            for (int i = 0; i < 2; ++i) {
+                if (children[i] == NULL) {
+                    continue;
+                }
+                if (level + 1 < levels) {
+                    block[block_end++] = children[i];
+                } else {
+                    below[below_num++] = children[i];
+                }
+            }
+            if (block_begin == level_end) {
+                ++level;
+                level_end = block_end;
+            }
+        }
+        // Push the subtrees below in reverse, so the leftmost one is laid out next.
+        while (below_num > 0) {
+            pending[pending_num++] = below[--below_num];
+        }
+    }
+
+    // Follow the forwarding pointers to relink the copies.
+    for (size_t i = 0; i < entry_num; ++i) {
+        RbNode* node = (RbNode*)((char*)buffer + i * entry_size + node_offset);
+        RbNode* parent = GetParent(node);
+        SetParentAndColor(node, parent ? parent->left : NULL, GetColor(node));
+        if (node->left) node->left = node->left->left;
+        if (node->right) node->right = node->right->left;
+    }
+    root->rb_node = root->rb_node->left;
+    return entry_num;
+}
+
+RbNode* FirstRbNode(const RbRoot* root) {
+    RbNode* node = root->rb_node;
+    if (node == NULL) {
+        return NULL;
+    }
+    while (node->left != NULL) {
+        node = node->left;
+    }
+    return node;
+}
+
+RbNode* LastRbNode(const RbRoot* root) {
+    RbNode* node = root->rb_node;
+    if (node == NULL) {
+        return NULL;
+    }
+    while (node->right != NULL) {
+        node = node->right;
+    }
+    return node;
+}
+
+RbNode* NextRbNode(const RbNode* node) {
+    assert(node != NULL);
+    // If `node` has a right child, the successor is the leftmost node of the right subtree.
+    if (node->right != NULL) {
+        RbNode* next = node->right;
+        while (next->left != NULL) {
+            next = next->left;
+        }
+        return next;
+    }
+    // Otherwise, go up until we come from a left child.
+    // The parent of that left child is the successor.
+    RbNode* parent = NULL;
+    while ((parent = GetParent(node)) != NULL && node == parent->right) {
+        node = parent;
+    }
+    return parent;
+}
+
+RbNode* PrevRbNode(const RbNode* node) {
+    assert(node != NULL);
+    if (node->left != NULL) {
+        RbNode* prev = node->left;
+        while (prev->right != NULL) {
+            prev = prev->right;
+        }
+        return prev;
+    }
+    RbNode* parent = NULL;
+    while ((parent = GetParent(node)) != NULL && node == parent->left) {
+        node = parent;
+    }
+    return parent;
+}
+
+// Returns the first node of the subtree `node` in post-order, i.e. its deepest leftmost leaf.
+static RbNode* FirstPostorderInSubtree(RbNode* node) {
+    for (;;) {
+        if (node->left != NULL) {
+            // The right subtree comes right after the left one. Near the leaves, that's soon.
+            if (node->right != NULL) RbPrefetch(node->right);
+            node = node->left;
+        } else if (node->right != NULL) {
+            node = node->right;
+        } else {
+            return node;
+        }
+    }
+}
+
+RbNode* FirstPostorderRbNode(const RbRoot* root) {
+    return root->rb_node ? FirstPostorderInSubtree(root->rb_node) : NULL;
+}
+
+RbNode* NextPostorderRbNode(const RbNode* node) {
+    assert(node != NULL);
+    RbNode* parent = GetParent(node);
+    // After a left child comes the right subtree of its parent, if any.
+    if (parent != NULL && node == parent->left && parent->right != NULL) {
+        return FirstPostorderInSubtree(parent->right);
+    }
+    // Otherwise both subtrees of the parent are done.
+    return parent;
+}
+
+void InsertIntoRbTreeCached(RbNode* node, RbNode* parent, RbNode** parent_link, RbRootCached* root) {
+    // The new node becomes the leftmost node only when it is linked as the left child of
+    // the old leftmost node, and so does the rightmost one. No extra comparison is needed.
+    if (parent == NULL) {
+        root->rb_leftmost = root->rb_rightmost = node;
+    } else if (parent_link == &root->rb_leftmost->left) {
+        root->rb_leftmost = node;
+    } else if (parent_link == &root->rb_rightmost->right) {
+        root->rb_rightmost = node;
     }
+    InsertIntoRbTree(node, parent, parent_link, &root->rb_root);
+}
+
+void RemoveFromRbTreeCached(RbNode* node, RbRootCached* root) {
+    // The leftmost node has no left child, so its successor is either its only (red) child
+    // or its parent. Likewise for the rightmost node. Both updates are O(1).
+    if (node == root->rb_leftmost) {
+        root->rb_leftmost = NextRbNode(node);
+    }
+    if (node == root->rb_rightmost) {
+        root->rb_rightmost = PrevRbNode(node);
+    }
+    RemoveFromRbTree(node, &root->rb_root);
+}
+
+void ReplaceRbNodeCached(RbNode* victim, RbNode* new_node, RbRootCached* root) {
+    if (victim == root->rb_leftmost) {
+        root->rb_leftmost = new_node;
+    }
+    if (victim == root->rb_rightmost) {
+        root->rb_rightmost = new_node;
+    }
+    ReplaceRbNode(victim, new_node, &root->rb_root);
+}
+
+size_t EraseRangeFromRbTreeCached(
+    RbRootCached* root, RbCompareFunc compare, const void* lo, const void* hi,
+    RbReleaseFunc release, void* context
+) {
+    size_t erased_num = EraseRangeFromRbTree(&root->rb_root, compare, lo, hi, release, context);
+    if (erased_num > 0) {
+        root->rb_leftmost = FirstRbNode(&root->rb_root);
+        root->rb_rightmost = LastRbNode(&root->rb_root);
+    }
+    return erased_num;
+}
+
+RbNode* PopMinFromRbTreeCached(RbRootCached* root) {
+    RbNode* node = root->rb_leftmost;
+    if (node != NULL) {
+        RemoveFromRbTreeCached(node, root);
+    }
+    return node;
+}
+
+/*
+    Join and split.
+    Subtrees are passed around together with their black heights,
+    i.e. the number of black nodes on any path from the subtree root down to NULL.
+*/
+static int BlackHeight(const RbNode* node) {
+    int height = 0;
+    for (; node != NULL; node = node->left) {
+        if (IsBlack((RbNode*)node)) ++height;
+    }
+    return height;
+}
+
+// Makes `node` a standalone tree with a black root, and returns its new black height.
+static int DetachSubtree(RbNode* node, int height) {
+    if (node == NULL) {
+        return 0;
+    }
+    SetParent(node, NULL);
+    if (IsRed(node)) {
+        SetColor(node, kBlack);
+        ++height;
+    }
+    return height;
+}
+
+/*
+    Joins two trees with black roots and a pivot between them, and returns the new root.
+    If the heights are equal, `pivot` simply becomes the black root. Otherwise, e.g. left is higher:
+
+                 [L]                                [L]
+                 / \                                / \
+                a  ...                             a  ...
+                      \          ====>                  \
+                      [c]    +  pivot  +  [R]          pivot
+                      / \                               /   \
+                     d   e                            [c]   [R]
+
+    where `c` is the first black node on the right spine of L with the same black height as R.
+    `pivot` is red, so only a red-red violation may remain, which is what FixupAfterInsert fixes.
+    It costs O(|left_height - right_height| + 1).
+*/
+static RbNode* JoinSubtrees(
+    RbNode* left, int left_height, RbNode* pivot, RbNode* right, int right_height, int* height
+) {
+    assert(IsBlack(left) && IsBlack(right));
+    if (left_height == right_height) {
+        pivot->left = left;
+        pivot->right = right;
+        SetParentAndColor(pivot, NULL, kBlack);
+        if (left) SetParent(left, pivot);
+        if (right) SetParent(right, pivot);
+        *height = left_height + 1;
+        return pivot;
+    }
+
+    bool left_is_higher = left_height > right_height;
+    RbRoot root = { left_is_higher ? left : right };
+    RbNode* lower = left_is_higher ? right : left;
+    int lower_height = left_is_higher ? right_height : left_height;
+
+    // Walk down the inner spine of the higher tree.
+    RbNode* parent = NULL;
+    RbNode* cur = root.rb_node;
+    int cur_height = left_is_higher ? left_height : right_height;
+    while (!(IsBlack(cur) && cur_height == lower_height)) {
+        if (IsBlack(cur)) --cur_height;
+        parent = cur;
+        cur = left_is_higher ? cur->right : cur->left;
+    }
+    assert(parent != NULL);
+
+    pivot->left = left_is_higher ? cur : lower;
+    pivot->right = left_is_higher ? lower : cur;
+    SetParentAndColor(pivot, parent, kRed);
+    if (left_is_higher) {
+        parent->right = pivot;
+    } else {
+        parent->left = pivot;
+    }
+    if (cur) SetParent(cur, pivot);
+    if (lower) SetParent(lower, pivot);
+
+    *height = left_is_higher ? left_height : right_height;
+    if (DoFixupAfterInsert(pivot, &root, NULL)) {
+        ++*height;
+    }
+    return root.rb_node;
+}
+
+/*
+    Splits the tree `node` (with a black root) into nodes less than `key` and the others.
+    At each level, one child subtree is kept whole and joined with the current node,
+    while the other one is split recursively. The joins cost O(log n) in total,
+    because the heights of the joined trees increase along the way.
+*/
+static void SplitSubtree(
+    RbNode* node, int height, RbCompareFunc compare, const void* key,
+    RbNode** less, int* less_height, RbNode** not_less, int* not_less_height
+) {
+    if (node == NULL) {
+        *less = *not_less = NULL;
+        *less_height = *not_less_height = 0;
+        return;
+    }
+    int child_height = height - (IsBlack(node) ? 1 : 0);
+    RbNode* left = node->left;
+    RbNode* right = node->right;
+    int left_height = DetachSubtree(left, child_height);
+    int right_height = DetachSubtree(right, child_height);
+
+    if (compare(node, key) < 0) {
+        // `node` and its left subtree are less than `key`.
+        RbNode* right_less = NULL;
+        int right_less_height = 0;
+        SplitSubtree(right, right_height, compare, key,
+                     &right_less, &right_less_height, not_less, not_less_height);
+        *less = JoinSubtrees(left, left_height, node, right_less, right_less_height, less_height);
+    } else {
+        RbNode* left_not_less = NULL;
+        int left_not_less_height = 0;
+        SplitSubtree(left, left_height, compare, key,
+                     less, less_height, &left_not_less, &left_not_less_height);
+        *not_less = JoinSubtrees(left_not_less, left_not_less_height, node, right, right_height, not_less_height);
+    }
+}
+
+void JoinRbTree(RbRoot* left, RbNode* pivot, RbRoot* right, RbRoot* root) {
+    assert(pivot != NULL);
+    assert(IsBlack(left->rb_node) && IsBlack(right->rb_node));
+    RbNode* left_node = left->rb_node;
+    RbNode* right_node = right->rb_node;
+    left->rb_node = right->rb_node = NULL;
+
+    int height = 0;
+    root->rb_node = JoinSubtrees(left_node, BlackHeight(left_node), pivot,
+                                 right_node, BlackHeight(right_node), &height);
+}
+
+void ConcatRbTree(RbRoot* left, RbRoot* right, RbRoot* root) {
+    if (IsEmptyRbRoot(left) || IsEmptyRbRoot(right)) {
+        RbNode* node = left->rb_node ? left->rb_node : right->rb_node;
+        left->rb_node = right->rb_node = NULL;
+        root->rb_node = node;
+        return;
+    }
+    // Borrow the largest node of `left` as the pivot.
+    RbNode* pivot = LastRbNode(left);
+    RemoveFromRbTree(pivot, left);
+    JoinRbTree(left, pivot, right, root);
+}
+
+void SplitRbTree(RbRoot* root, RbCompareFunc compare, const void* key, RbRoot* less, RbRoot* not_less) {
+    RbNode* node = root->rb_node;
+    root->rb_node = NULL;
+
+    RbNode* less_node = NULL;
+    RbNode* not_less_node = NULL;
+    int less_height = 0;
+    int not_less_height = 0;
+    SplitSubtree(node, BlackHeight(node), compare, key,
+                 &less_node, &less_height, &not_less_node, &not_less_height);
+    less->rb_node = less_node;
+    not_less->rb_node = not_less_node;
+}
+
+// Short ranges are cheaper to remove node by node than to split and concat the whole tree,
+// because removals only rebalance O(1) nodes amortized. So the first nodes of a range are removed
+// one by one, and only a longer rest is cut out with split and concat.
+enum { kEraseRangeNodeByNodeLimit = 64 };
+
+size_t EraseRangeFromRbTree(
+    RbRoot* root, RbCompareFunc compare, const void* lo, const void* hi,
+    RbReleaseFunc release, void* context
+) {
+    // Find the first node not less than `lo`, and remove the head of the range node by node.
+    RbNode* node = NULL;
+    for (RbNode* cur = root->rb_node; cur != NULL;) {
+        if (compare(cur, lo) < 0) {
+            cur = cur->right;
+        } else {
+            node = cur;
+            cur = cur->left;
+        }
+    }
+    size_t erased_num = 0;
+    while (node != NULL && compare(node, hi) < 0) {
+        if (erased_num == kEraseRangeNodeByNodeLimit) {
+            break;
+        }
+        RbNode* next = NextRbNode(node);
+        RemoveFromRbTree(node, root);
+        if (release) release(node, context);
+        ++erased_num;
+        node = next;
+    }
+    if (node == NULL || compare(node, hi) >= 0) {
+        return erased_num;
+    }
+
+    // The range is long, cut the rest of it out at once.
+    RbRoot less = InitializedRbRoot;
+    RbRoot not_less = InitializedRbRoot;
+    RbRoot erased = InitializedRbRoot;
+    RbRoot greater = InitializedRbRoot;
+    SplitRbTree(root, compare, lo, &less, &not_less);
+    SplitRbTree(&not_less, compare, hi, &erased, &greater);
+    ConcatRbTree(&less, &greater, root);
+
+    // The erased nodes are a standalone tree now, so nothing has to be relinked on the way.
+    RbNode* next = NULL;
+    RbPostorderForEachSafe(node, next, &erased) {
+        if (release) release(node, context);
+        ++erased_num;
+    }
+    return erased_num;
+}
+
+/*
+    Validation.
+    The tree is walked in order by following the parent links, so no stack is needed.
+    `black_depth` is the number of black nodes from the root down to the current node.
+    Every NULL child ends a path, so the black depth of its parent must be the same everywhere.
+*/
+static RbCheckResult CheckRbNodeLocally(const RbNode* node, int black_depth, int* black_height) {
+    const RbNode* children[2] = { node->left, node->right };
+    for (int i = 0; i < 2; ++i) {
+        const RbNode* child = children[i];
+        if (child == NULL) {
+            if (*black_height < 0) {
+                *black_height = black_depth;
+            } else if (*black_height != black_depth) {
+                return kRbCheckBlackHeight;
+            }
+        } else if (GetParent(child) != node) {
+            // Don't walk into `child`, or we can't come back through its parent link.
+            return kRbCheckBadParentLink;
+        } else if (GetColor(node) == kRed && GetColor(child) == kRed) {
+            return kRbCheckRedRed;
+        }
+    }
+    return kRbCheckOk;
+}
+
+RbCheckResult CheckRbTree(const RbRoot* root, RbNodeCompareFunc compare, const RbNode** bad_node) {
+    const RbNode* node = root->rb_node;
+    const RbNode* prev = NULL;
+    int black_depth = 1;
+    int black_height = -1;
+    RbCheckResult result = kRbCheckOk;
+
+    if (node == NULL) {
+        return kRbCheckOk;
+    }
+    if (GetParent(node) != NULL) {
+        result = kRbCheckBadParentLink;
+    } else if (GetColor(node) == kRed) {
+        result = kRbCheckRedRoot;
+    }
+    while (result == kRbCheckOk) {
+        // First time at `node`, check it and go down to the left.
+        result = CheckRbNodeLocally(node, black_depth, &black_height);
+        if (result != kRbCheckOk) {
+            break;
+        }
+        if (node->left != NULL) {
+            node = node->left;
+            black_depth += GetColor(node) == kBlack;
+            continue;
+        }
+        // The left subtree of `node` is done, so it's the turn of `node` itself.
+        for (;;) {
+            if (compare != NULL && prev != NULL && compare(prev, node) > 0) {
+                result = kRbCheckOutOfOrder;
+                break;
+            }
+            prev = node;
+            if (node->right != NULL) {
+                node = node->right;
+                black_depth += GetColor(node) == kBlack;
+                break;
+            }
+            // Go up until we come from a left child, whose parent is the next one in order.
+            const RbNode* child = NULL;
+            do {
+                child = node;
+                black_depth -= GetColor(child) == kBlack;
+                node = GetParent(child);
+                if (node == NULL) {
+                    return kRbCheckOk;
+                }
+            } while (child == node->right);
+        }
+    }
+    if (bad_node != NULL) {
+        *bad_node = node;
+    }
+    return result;
+}
+
+const char* DescribeRbCheckResult(RbCheckResult result) {
+    switch (result) {
+    case kRbCheckOk:
+        return "The rb-tree is legal.";
+    case kRbCheckRedRoot:
+        return "The root node is red.";
+    case kRbCheckBadParentLink:
+        return "The parent link of a child doesn't point back to its parent.";
+    case kRbCheckRedRed:
+        return "A red node has a red child.";
+    case kRbCheckBlackHeight:
+        return "The numbers of black nodes on the paths from the root to the leaves differ.";
+    case kRbCheckOutOfOrder:
+        return "The keys are not in order.";
+    }
+    return "Unknown result.";
+}
+
+/* Statistics */
+void GetRbTreeStats(RbTreeStats* stats) {
+#if RB_TREE_STATS
+    // RbTreeStats only holds uint64_t, so copy it counter by counter.
+    const uint64_t* from = (const uint64_t*)&g_stats;
+    uint64_t* to = (uint64_t*)stats;
+    for (size_t i = 0; i < sizeof(RbTreeStats) / sizeof(uint64_t); ++i) {
+        to[i] = RbAtomicLoad(&from[i]);
+    }
+#else
+    memset(stats, 0, sizeof(RbTreeStats));
+#endif
+}
+
+void ResetRbTreeStats(void) {
+#if RB_TREE_STATS
+    uint64_t* counters = (uint64_t*)&g_stats;
+    for (size_t i = 0; i < sizeof(RbTreeStats) / sizeof(uint64_t); ++i) {
+        RbAtomicClear(&counters[i]);
+    }
+#endif
+}
+
+void RecordRbSearchDepth(int depth) {
+    RbStatsHistogram(search_depth, depth);
 }
@@ -0,0 +1,119 @@
+#include "include/work-stealing-pool.h"
+
+#include <algorithm>
+
+WorkStealingPool::WorkStealingPool(int thread_num) : queued_num_(0), sleeping_num_(0), stopping_(false) {
+    if (thread_num <= 0) {
+        thread_num = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+    }
+    for (int i = 0; i < thread_num; ++i) {
+        workers_.emplace_back(new Worker);
+    }
+    // Worker 0 is whichever thread calls Invoke from outside.
+    for (int i = 1; i < thread_num; ++i) {
+        threads_.emplace_back(&WorkStealingPool::RunWorker, this, i);
+    }
+}
+
+WorkStealingPool::~WorkStealingPool() {
+    {
+        std::lock_guard<std::mutex> lock(idle_mutex_);
+        stopping_ = true;
+    }
+    idle_cv_.notify_all();
+    for (std::thread& thread : threads_) {
+        thread.join();
+    }
+}
+
+WorkStealingPool::WorkerSlot& WorkStealingPool::CurrentWorkerSlot() {
+    static thread_local WorkerSlot slot = { nullptr, nullptr };
+    return slot;
+}
+
+void WorkStealingPool::Push(Worker* worker, Task* task) {
+    {
+        std::lock_guard<std::mutex> lock(worker->mutex);
+        worker->tasks.push_back(task);
+    }
+    // A worker going to sleep counts itself before it checks `queued_num_` under `idle_mutex_`,
+    // so either it sees this task, or this sees it and wakes it up.
+    queued_num_.fetch_add(1);
+    if (sleeping_num_.load() > 0) {
+        std::lock_guard<std::mutex> lock(idle_mutex_);
+        idle_cv_.notify_one();
+    }
+}
+
+bool WorkStealingPool::PopIfLast(Worker* worker, Task* task) {
+    std::lock_guard<std::mutex> lock(worker->mutex);
+    if (worker->tasks.empty() || worker->tasks.back() != task) {
+        return false;
+    }
+    worker->tasks.pop_back();
+    queued_num_.fetch_sub(1);
+    return true;
+}
+
+WorkStealingPool::Task* WorkStealingPool::Take(Worker* worker) {
+    {
+        std::lock_guard<std::mutex> lock(worker->mutex);
+        if (!worker->tasks.empty()) {
+            Task* task = worker->tasks.back();
+            worker->tasks.pop_back();
+            queued_num_.fetch_sub(1);
+            return task;
+        }
+    }
+    if (queued_num_.load(std::memory_order_relaxed) == 0) {
+        return nullptr;
+    }
+    // Start from the next worker, so the thieves spread over the victims.
+    int worker_num = GetThreadNum();
+    int index = 0;
+    while (workers_[index].get() != worker) {
+        ++index;
+    }
+    for (int i = 1; i < worker_num; ++i) {
+        Worker* victim = workers_[(index + i) % worker_num].get();
+        std::lock_guard<std::mutex> lock(victim->mutex);
+        if (!victim->tasks.empty()) {
+            Task* task = victim->tasks.front();
+            victim->tasks.pop_front();
+            queued_num_.fetch_sub(1);
+            return task;
+        }
+    }
+    return nullptr;
+}
+
+void WorkStealingPool::WaitFor(Task* task) {
+    Worker* worker = CurrentWorkerSlot().worker;
+    while (!task->done.load(std::memory_order_acquire)) {
+        Task* other = Take(worker);
+        if (other != nullptr) {
+            other->Run();
+        } else {
+            std::this_thread::yield();
+        }
+    }
+}
+
+void WorkStealingPool::RunWorker(int index) {
+    Worker* worker = workers_[index].get();
+    CurrentWorkerSlot() = { this, worker };
+    while (true) {
+        Task* task = Take(worker);
+        if (task != nullptr) {
+            task->Run();
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(idle_mutex_);
+        sleeping_num_.fetch_add(1);
+        idle_cv_.wait(lock, [this] { return stopping_ || queued_num_.load() > 0; });
+        sleeping_num_.fetch_sub(1);
+        if (stopping_) {
+            return;
+        }
+    }
+}